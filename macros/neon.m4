@@ -633,6 +633,10 @@ char *stpcpy(char *, const char *);
 # Haiku requires -lnetwork for socket functions.
 NE_SEARCH_LIBS(socket, socket inet ws2_32 network)
 
+# clock_gettime is in librt with glibc before 2.17.
+NE_SEARCH_LIBS(clock_gettime, rt,, [:],
+  [AC_DEFINE([HAVE_CLOCK_GETTIME], 1, [Define if clock_gettime is available])])
+
 # Enable getaddrinfo support if it, gai_strerror and inet_ntop are
 # all available.
 NE_SEARCH_LIBS(getaddrinfo, nsl,,
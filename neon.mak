@@ -116,6 +116,7 @@ LIB32_OBJS= \
 	"$(INTDIR)\ne_dates.obj" \
 	"$(INTDIR)\ne_i18n.obj" \
 	"$(INTDIR)\ne_md5.obj" \
+	"$(INTDIR)\ne_hash.obj" \
 	"$(INTDIR)\ne_pkcs11.obj" \
 	"$(INTDIR)\ne_redirect.obj" \
 	"$(INTDIR)\ne_request.obj" \
@@ -172,6 +173,7 @@ CLEAN: $(ZLIB_CLEAN)
 	-@erase "$(INTDIR)\ne_i18n.obj"
 	-@erase "$(INTDIR)\ne_locks.obj"
 	-@erase "$(INTDIR)\ne_md5.obj"
+	-@erase "$(INTDIR)\ne_hash.obj"
 	-@erase "$(INTDIR)\ne_props.obj"
 	-@erase "$(INTDIR)\ne_redirect.obj"
 	-@erase "$(INTDIR)\ne_request.obj"
@@ -221,6 +223,7 @@ CLEAN: $(ZLIB_CLEAN)
 "$(INTDIR)\ne_i18n.obj":     .\src\ne_i18n.c
 "$(INTDIR)\ne_locks.obj":    .\src\ne_locks.c
 "$(INTDIR)\ne_md5.obj":      .\src\ne_md5.c
+"$(INTDIR)\ne_hash.obj":     .\src\ne_hash.c
 "$(INTDIR)\ne_props.obj":    .\src\ne_props.c
 "$(INTDIR)\ne_redirect.obj": .\src\ne_redirect.c
 "$(INTDIR)\ne_request.obj":  .\src\ne_request.c
@@ -42,6 +42,7 @@ struct ne_207_parser_s {
     ne_207_start_propstat *start_propstat;
     ne_207_end_propstat *end_propstat;
     ne_xml_parser *parser;
+    ne_xml_idtable *ids; /* compiled form of map207 */
     void *userdata;
 
     ne_uri base;
@@ -118,6 +119,9 @@ static int can_handle(int parent, int child)
           child == ELM_responsedescription));
 }
 
+/* Threshold for delivery of coalesced character data. */
+#define CDATA_BATCH (8192)
+
 static int cdata_207(void *userdata, int state, const char *buf, size_t len)
 {
     ne_207_parser *p = userdata;
@@ -134,7 +138,7 @@ static int start_element(void *userdata, int parent,
                          const char **atts) 
 {
     ne_207_parser *p = userdata;
-    int state = ne_xml_mapid(map207, NE_XML_MAPLEN(map207), nspace, name);
+    int state = ne_xml_idtable_lookup(p->ids, nspace, name);
 
     if (!can_handle(parent, state))
         return NE_XML_DECLINE;
@@ -238,10 +242,18 @@ ne_207_parser *ne_207_create(ne_xml_parser *parser, const ne_uri *base,
     p->userdata = userdata;
     p->cdata = ne_buffer_create();
 
+    p->ids = ne_xml_idtable_create(map207, NE_XML_MAPLEN(map207));
+
     ne_uri_copy(&p->base, base);
 
     /* Add handler for the standard 207 elements */
     ne_xml_push_handler(parser, start_element, cdata_207, end_element, p);
+    ne_xml_handler_accepts(parser, p->ids);
+
+    /* Multistatus responses are handled by the built-in tokenizer,
+     * with character data passed to the handlers in one piece. */
+    ne_xml_set_fastparse(parser, 1);
+    ne_xml_coalesce_cdata(parser, CDATA_BATCH);
     
     return p;
 }
@@ -250,6 +262,7 @@ void ne_207_destroy(ne_207_parser *p)
 {
     if (p->status.reason_phrase) ne_free(p->status.reason_phrase);
     ne_buffer_destroy(p->cdata);
+    ne_xml_idtable_destroy(p->ids);
     ne_uri_free(&p->base);
     ne_free(p);
 }
@@ -57,7 +57,12 @@
 #include <errno.h>
 #include <time.h>
 
+#ifdef HAVE_PTHREAD_MUTEX_LOCK
+#include <pthread.h>
+#endif
+
 #include "ne_md5.h"
+#include "ne_hash.h"
 #include "ne_dates.h"
 #include "ne_request.h"
 #include "ne_auth.h"
@@ -88,13 +93,34 @@
  
 #define HOOK_SERVER_ID "http://webdav.org/neon/hooks/server-auth"
 #define HOOK_PROXY_ID "http://webdav.org/neon/hooks/proxy-auth"
+#define HOOK_CACHE_ID "http://webdav.org/neon/hooks/auth-cache"
 
 typedef enum { 
     auth_alg_md5,
     auth_alg_md5_sess,
+    auth_alg_sha256,
+    auth_alg_sha256_sess,
+    auth_alg_sha512_256,
+    auth_alg_sha512_256_sess,
     auth_alg_unknown
 } auth_algorithm;
 
+/* Digest algorithms, indexed by auth_algorithm, in increasing order
+ * of preference.  The -sess variants hash the nonce and cnonce into
+ * H(A1). */
+static const struct {
+    const char *name;
+    unsigned int hash; /* NE_HASH_* */
+    int sess;
+} digest_algs[] = {
+    { "MD5", NE_HASH_MD5, 0 },
+    { "MD5-sess", NE_HASH_MD5, 1 },
+    { "SHA-256", NE_HASH_SHA256, 0 },
+    { "SHA-256-sess", NE_HASH_SHA256, 1 },
+    { "SHA-512-256", NE_HASH_SHA512_256, 0 },
+    { "SHA-512-256-sess", NE_HASH_SHA512_256, 1 }
+};
+
 /* Selected method of qop which the client is using */
 typedef enum {
     auth_qop_none,
@@ -122,6 +148,7 @@ struct auth_challenge {
     unsigned int stale; /* if stale=true */
     unsigned int got_qop; /* we were given a qop directive */
     unsigned int qop_auth; /* "auth" token in qop attrib */
+    unsigned int userhash; /* if userhash=true */
     auth_algorithm alg;
     struct auth_challenge *next;
 };
@@ -170,6 +197,9 @@ typedef struct {
 
     /* This used for Basic auth */
     char *basic; 
+    /* Non-zero if the Basic credentials were taken from the auth
+     * cache. */
+    int basic_cached;
 #ifdef HAVE_GSSAPI
     /* for the GSSAPI/Negotiate scheme: */
     char *gssapi_token;
@@ -197,13 +227,69 @@ typedef struct {
     auth_algorithm alg;
     unsigned int nonce_count;
     /* The ASCII representation of the session's H(A1) value */
-    char h_a1[33];
+    char h_a1[NE_HASH_MAXHEX + 1];
+    /* The hashed username if userhash is used, else empty. */
+    char userhash[NE_HASH_MAXHEX + 1];
 
     /* Temporary store for half of the Request-Digest
      * (an optimisation - used in the response-digest calculation) */
-    struct ne_md5_ctx *stored_rdig;
+    ne_hash_ctx *stored_rdig;
+
+    /* Server identity used as the auth cache key, or NULL if not yet
+     * determined. */
+    char *server;
+    /* Non-zero if the Digest state has changed since it was last
+     * saved to the auth cache. */
+    int pspace_dirty;
 } auth_session;
 
+/* A Digest protection space stored in an auth cache, identified by
+ * the server, realm and domain list.  The nonce-count is shared by
+ * every session using the entry. */
+struct auth_pspace {
+    char *server, *realm, *nonce, *cnonce, *opaque;
+    char **domains;
+    size_t ndomains;
+    auth_qop qop;
+    auth_algorithm alg;
+    unsigned int nonce_count;
+    char username[NE_ABUFSIZ];
+    char h_a1[NE_HASH_MAXHEX + 1];
+    char userhash[NE_HASH_MAXHEX + 1];
+    struct auth_pspace *next;
+};
+
+/* Basic credentials stored in an auth cache, sent preemptively for
+ * any Request-URI beneath 'path' on the server.  For a prefix
+ * configured by ne_auth_cache_add_basic(), 'token' is NULL until
+ * credentials have been accepted by the server. */
+struct auth_basic {
+    char *server, *path, *realm, *token;
+    char username[NE_ABUFSIZ];
+    int configured;
+    struct auth_basic *next;
+};
+
+/* Maximum number of protection spaces held in an auth cache, and of
+ * (unconfigured) Basic credential entries. */
+#define PSPACE_MAX (64)
+
+struct ne_auth_cache_s {
+    struct auth_pspace *spaces; /* most recently saved first */
+    struct auth_basic *basics; /* likewise */
+#ifdef HAVE_PTHREAD_MUTEX_LOCK
+    pthread_mutex_t lock;
+#endif
+};
+
+#ifdef HAVE_PTHREAD_MUTEX_LOCK
+#define CACHE_LOCK(c) pthread_mutex_lock(&(c)->lock)
+#define CACHE_UNLOCK(c) pthread_mutex_unlock(&(c)->lock)
+#else
+#define CACHE_LOCK(c)
+#define CACHE_UNLOCK(c)
+#endif
+
 struct auth_request {
     /*** Per-request details. ***/
     ne_request *request; /* the request object. */
@@ -278,8 +364,9 @@ static void clean_session(auth_session *sess)
     if (sess->realm) ne_free(sess->realm);
     sess->realm = sess->basic = sess->cnonce = sess->nonce =
         sess->opaque = NULL;
+    sess->basic_cached = 0;
     if (sess->stored_rdig) {
-        ne_md5_destroy_ctx(sess->stored_rdig);
+        ne_hash_destroy(sess->stored_rdig);
         sess->stored_rdig = NULL;
     }
     if (sess->ndomains) free_domains(sess);
@@ -386,6 +473,8 @@ static int get_credentials(auth_session *sess, ne_buffer **errmsg, int attempt,
     }
 }
 
+static int cached_basic(auth_session *sess);
+
 /* Examine a Basic auth challenge.
  * Returns 0 if an valid challenge, else non-zero. */
 static int basic_challenge(auth_session *sess, int attempt,
@@ -393,6 +482,7 @@ static int basic_challenge(auth_session *sess, int attempt,
                            ne_buffer **errmsg) 
 {
     char *tmp, password[NE_ABUFSIZ];
+    int was_cached = sess->basic_cached;
 
     /* Verify challenge... must have a realm */
     if (parms->realm == NULL) {
@@ -404,6 +494,13 @@ static int basic_challenge(auth_session *sess, int attempt,
     
     sess->realm = ne_strdup(parms->realm);
 
+    /* Use credentials from the auth cache, unless they have just
+     * been rejected. */
+    if (!was_cached && attempt == 0 && cached_basic(sess) == 0) {
+        sess->pspace_dirty = 1;
+        return 0;
+    }
+
     if (get_credentials(sess, errmsg, attempt, parms, password)) {
 	/* Failed to get credentials */
 	return -1;
@@ -416,6 +513,8 @@ static int basic_challenge(auth_session *sess, int attempt,
     /* Paranoia. */
     memset(password, 0, sizeof password);
 
+    sess->pspace_dirty = 1;
+
     return 0;
 }
 
@@ -806,7 +905,7 @@ static int digest_challenge(auth_session *sess, int attempt,
         challenge_error(errmsg, _("unknown algorithm in Digest challenge"));
         return -1;
     }
-    else if (parms->alg == auth_alg_md5_sess && !parms->qop_auth) {
+    else if (digest_algs[parms->alg].sess && !parms->qop_auth) {
         challenge_error(errmsg, _("incompatible algorithm in Digest challenge"));
         return -1;
     }
@@ -869,51 +968,67 @@ static int digest_challenge(auth_session *sess, int attempt,
     }
     
     if (!parms->stale) {
-        struct ne_md5_ctx *tmp;
+        unsigned int hash = digest_algs[sess->alg].hash;
+        ne_hash_ctx *tmp;
 
 	/* Calculate H(A1).
 	 * tmp = H(unq(username-value) ":" unq(realm-value) ":" passwd)
 	 */
-	tmp = ne_md5_create_ctx();
-	ne_md5_process_bytes(sess->username, strlen(sess->username), tmp);
-	ne_md5_process_bytes(":", 1, tmp);
-	ne_md5_process_bytes(sess->realm, strlen(sess->realm), tmp);
-	ne_md5_process_bytes(":", 1, tmp);
-	ne_md5_process_bytes(password, strlen(password), tmp);
+	tmp = ne_hash_create(hash);
+	ne_hash_update(tmp, sess->username, strlen(sess->username));
+	ne_hash_update(tmp, ":", 1);
+	ne_hash_update(tmp, sess->realm, strlen(sess->realm));
+	ne_hash_update(tmp, ":", 1);
+	ne_hash_update(tmp, password, strlen(password));
 	memset(password, 0, sizeof password); /* done with that. */
-	if (sess->alg == auth_alg_md5_sess) {
-	    struct ne_md5_ctx *a1;
-	    char tmp_md5_ascii[33];
+	if (digest_algs[sess->alg].sess) {
+	    ne_hash_ctx *a1;
+	    char tmp_ascii[NE_HASH_MAXHEX + 1];
 
 	    /* Now we calculate the SESSION H(A1)
 	     *    A1 = H(...above...) ":" unq(nonce-value) ":" unq(cnonce-value) 
 	     */
-	    ne_md5_finish_ascii(tmp, tmp_md5_ascii);
-	    a1 = ne_md5_create_ctx();
-	    ne_md5_process_bytes(tmp_md5_ascii, 32, a1);
-	    ne_md5_process_bytes(":", 1, a1);
-	    ne_md5_process_bytes(sess->nonce, strlen(sess->nonce), a1);
-	    ne_md5_process_bytes(":", 1, a1);
-	    ne_md5_process_bytes(sess->cnonce, strlen(sess->cnonce), a1);
-	    ne_md5_finish_ascii(a1, sess->h_a1);
-            ne_md5_destroy_ctx(a1);
+	    ne_hash_finish_ascii(tmp, tmp_ascii);
+	    a1 = ne_hash_create(hash);
+	    ne_hash_update(a1, tmp_ascii, strlen(tmp_ascii));
+	    ne_hash_update(a1, ":", 1);
+	    ne_hash_update(a1, sess->nonce, strlen(sess->nonce));
+	    ne_hash_update(a1, ":", 1);
+	    ne_hash_update(a1, sess->cnonce, strlen(sess->cnonce));
+	    ne_hash_finish_ascii(a1, sess->h_a1);
+            ne_hash_destroy(a1);
 	    NE_DEBUG(NE_DBG_HTTPAUTH, "auth: Session H(A1) is [%s]\n", sess->h_a1);
 	} else {
-	    ne_md5_finish_ascii(tmp, sess->h_a1);
+	    ne_hash_finish_ascii(tmp, sess->h_a1);
 	    NE_DEBUG(NE_DBG_HTTPAUTH, "auth: H(A1) is [%s]\n", sess->h_a1);
 	}
-        ne_md5_destroy_ctx(tmp);
-	
+        ne_hash_destroy(tmp);
+
+        /* RFC 7616 userhash: the username is sent as
+         *    H(unq(username) ":" unq(realm)) */
+        if (parms->userhash) {
+            tmp = ne_hash_create(hash);
+            ne_hash_update(tmp, sess->username, strlen(sess->username));
+            ne_hash_update(tmp, ":", 1);
+            ne_hash_update(tmp, sess->realm, strlen(sess->realm));
+            ne_hash_finish_ascii(tmp, sess->userhash);
+            ne_hash_destroy(tmp);
+        }
+        else {
+            sess->userhash[0] = '\0';
+        }
     }
     
     NE_DEBUG(NE_DBG_HTTPAUTH, "auth: Accepting digest challenge.\n");
 
+    sess->pspace_dirty = 1;
+
     return 0;
 }
 
 /* Returns non-zero if given Request-URI is inside the authentication
- * domain defined for the session. */
-static int inside_domain(auth_session *sess, const char *req_uri)
+ * domain defined by the 'ndomains' paths in 'domains'. */
+static int inside_domain(char **domains, size_t ndomains, const char *req_uri)
 {
     int inside = 0;
     size_t n;
@@ -926,8 +1041,8 @@ static int inside_domain(auth_session *sess, const char *req_uri)
         return 0;
     }
 
-    for (n = 0; n < sess->ndomains && !inside; n++) {
-        const char *d = sess->domains[n];
+    for (n = 0; n < ndomains && !inside; n++) {
+        const char *d = domains[n];
         
         inside = strncmp(uri.path, d, strlen(d)) == 0;
     }
@@ -939,78 +1054,140 @@ static int inside_domain(auth_session *sess, const char *req_uri)
     return inside;
 }            
 
+/* Returns the auth cache used by the session, or NULL.  The cache is
+ * only used for server auth. */
+static ne_auth_cache *get_cache(auth_session *sess)
+{
+    if (sess->spec != &ah_server_class)
+        return NULL;
+
+    return ne_get_session_private(sess->sess, HOOK_CACHE_ID);
+}
+
+/* Returns the string identifying the server in the auth cache. */
+static const char *server_key(auth_session *sess)
+{
+    if (sess->server == NULL) {
+        ne_uri uri = {0};
+
+        ne_fill_server_uri(sess->sess, &uri);
+        uri.path = "/";
+        sess->server = ne_uri_unparse(&uri);
+        uri.path = NULL;
+        ne_uri_free(&uri);
+    }
+
+    return sess->server;
+}
+
+/* Returns the nonce-count to use for the next request.  Where the
+ * session's nonce is shared with other sessions through the auth
+ * cache, so is the count. */
+static unsigned int next_nonce_count(auth_session *sess)
+{
+    ne_auth_cache *cache = get_cache(sess);
+    unsigned int count = sess->nonce_count + 1;
+
+    if (cache) {
+        const char *server = server_key(sess);
+        struct auth_pspace *ps;
+
+        CACHE_LOCK(cache);
+        for (ps = cache->spaces; ps; ps = ps->next) {
+            if (strcmp(ps->nonce, sess->nonce) == 0
+                && strcmp(ps->cnonce, sess->cnonce) == 0
+                && strcmp(ps->server, server) == 0) {
+                if (ps->nonce_count >= count)
+                    count = ps->nonce_count + 1;
+                ps->nonce_count = count;
+                break;
+            }
+        }
+        CACHE_UNLOCK(cache);
+    }
+
+    return count;
+}
+
 /* Return Digest authentication credentials header value for the given
  * session. */
 static char *request_digest(auth_session *sess, struct auth_request *req) 
 {
-    struct ne_md5_ctx *a2, *rdig;
-    char a2_md5_ascii[33], rdig_md5_ascii[33];
+    unsigned int hash = digest_algs[sess->alg].hash;
+    ne_hash_ctx *a2, *rdig;
+    char a2_ascii[NE_HASH_MAXHEX + 1], rdig_ascii[NE_HASH_MAXHEX + 1];
     char nc_value[9] = {0};
     const char *qop_value = "auth"; /* qop-value */
     ne_buffer *ret;
 
     /* Do not submit credentials if an auth domain is defined and this
      * request-uri fails outside it. */
-    if (sess->ndomains && !inside_domain(sess, req->uri)) {
+    if (sess->ndomains 
+        && !inside_domain(sess->domains, sess->ndomains, req->uri)) {
         return NULL;
     }
 
     /* Increase the nonce-count */
     if (sess->qop != auth_qop_none) {
-	sess->nonce_count++;
+	sess->nonce_count = next_nonce_count(sess);
 	ne_snprintf(nc_value, 9, "%08x", sess->nonce_count);
     }
 
     /* Calculate H(A2). */
-    a2 = ne_md5_create_ctx();
-    ne_md5_process_bytes(req->method, strlen(req->method), a2);
-    ne_md5_process_bytes(":", 1, a2);
-    ne_md5_process_bytes(req->uri, strlen(req->uri), a2);
-    ne_md5_finish_ascii(a2, a2_md5_ascii);
-    ne_md5_destroy_ctx(a2);
-    NE_DEBUG(NE_DBG_HTTPAUTH, "auth: H(A2): %s\n", a2_md5_ascii);
+    a2 = ne_hash_create(hash);
+    ne_hash_update(a2, req->method, strlen(req->method));
+    ne_hash_update(a2, ":", 1);
+    ne_hash_update(a2, req->uri, strlen(req->uri));
+    ne_hash_finish_ascii(a2, a2_ascii);
+    ne_hash_destroy(a2);
+    NE_DEBUG(NE_DBG_HTTPAUTH, "auth: H(A2): %s\n", a2_ascii);
 
     /* Now, calculation of the Request-Digest.
      * The first section is the regardless of qop value
      *     H(A1) ":" unq(nonce-value) ":" */
-    rdig = ne_md5_create_ctx();
+    rdig = ne_hash_create(hash);
 
     /* Use the calculated H(A1) */
-    ne_md5_process_bytes(sess->h_a1, 32, rdig);
+    ne_hash_update(rdig, sess->h_a1, strlen(sess->h_a1));
 
-    ne_md5_process_bytes(":", 1, rdig);
-    ne_md5_process_bytes(sess->nonce, strlen(sess->nonce), rdig);
-    ne_md5_process_bytes(":", 1, rdig);
+    ne_hash_update(rdig, ":", 1);
+    ne_hash_update(rdig, sess->nonce, strlen(sess->nonce));
+    ne_hash_update(rdig, ":", 1);
     if (sess->qop != auth_qop_none) {
 	/* Add on:
 	 *    nc-value ":" unq(cnonce-value) ":" unq(qop-value) ":"
 	 */
-	ne_md5_process_bytes(nc_value, 8, rdig);
-	ne_md5_process_bytes(":", 1, rdig);
-	ne_md5_process_bytes(sess->cnonce, strlen(sess->cnonce), rdig);
-	ne_md5_process_bytes(":", 1, rdig);
+	ne_hash_update(rdig, nc_value, 8);
+	ne_hash_update(rdig, ":", 1);
+	ne_hash_update(rdig, sess->cnonce, strlen(sess->cnonce));
+	ne_hash_update(rdig, ":", 1);
 	/* Store a copy of this structure (see note below) */
-        if (sess->stored_rdig) ne_md5_destroy_ctx(sess->stored_rdig);
-	sess->stored_rdig = ne_md5_dup_ctx(rdig);
-	ne_md5_process_bytes(qop_value, strlen(qop_value), rdig);
-	ne_md5_process_bytes(":", 1, rdig);
+        if (sess->stored_rdig) ne_hash_destroy(sess->stored_rdig);
+	sess->stored_rdig = ne_hash_dup(rdig);
+	ne_hash_update(rdig, qop_value, strlen(qop_value));
+	ne_hash_update(rdig, ":", 1);
     }
 
     /* And finally, H(A2) */
-    ne_md5_process_bytes(a2_md5_ascii, 32, rdig);
-    ne_md5_finish_ascii(rdig, rdig_md5_ascii);
-    ne_md5_destroy_ctx(rdig);
+    ne_hash_update(rdig, a2_ascii, strlen(a2_ascii));
+    ne_hash_finish_ascii(rdig, rdig_ascii);
+    ne_hash_destroy(rdig);
 
     ret = ne_buffer_create();
 
     ne_buffer_concat(ret, 
-		     "Digest username=\"", sess->username, "\", "
+		     "Digest username=\"", 
+                     sess->userhash[0] ? sess->userhash : sess->username, "\", "
 		     "realm=\"", sess->realm, "\", "
 		     "nonce=\"", sess->nonce, "\", "
 		     "uri=\"", req->uri, "\", "
-		     "response=\"", rdig_md5_ascii, "\", "
-		     "algorithm=\"", sess->alg == auth_alg_md5 ? "MD5" : "MD5-sess", "\"", 
+		     "response=\"", rdig_ascii, "\", "
+		     "algorithm=\"", digest_algs[sess->alg].name, "\"", 
 		     NULL);
+
+    if (sess->userhash[0]) {
+        ne_buffer_czappend(ret, ", userhash=true");
+    }
     
     if (sess->opaque != NULL) {
 	ne_buffer_concat(ret, ", opaque=\"", sess->opaque, "\"", NULL);
@@ -1172,38 +1349,37 @@ static int verify_digest_response(struct auth_request *req, auth_session *sess,
     /* Finally, for qop=auth cases, if everything else is OK, verify
      * the response-digest field. */    
     if (qop == auth_qop_auth && ret == NE_OK) {
-        struct ne_md5_ctx *a2;
-        char a2_md5_ascii[33], rdig_md5_ascii[33];
+        ne_hash_ctx *a2;
+        char a2_ascii[NE_HASH_MAXHEX + 1], rdig_ascii[NE_HASH_MAXHEX + 1];
 
         /* Modified H(A2): */
-        a2 = ne_md5_create_ctx();
-        ne_md5_process_bytes(":", 1, a2);
-        ne_md5_process_bytes(req->uri, strlen(req->uri), a2);
-        ne_md5_finish_ascii(a2, a2_md5_ascii);
-        ne_md5_destroy_ctx(a2);
+        a2 = ne_hash_create(digest_algs[sess->alg].hash);
+        ne_hash_update(a2, ":", 1);
+        ne_hash_update(a2, req->uri, strlen(req->uri));
+        ne_hash_finish_ascii(a2, a2_ascii);
+        ne_hash_destroy(a2);
 
         /* sess->stored_rdig contains digest-so-far of:
          *   H(A1) ":" unq(nonce-value) 
          */
         
         /* Add in qop-value */
-        ne_md5_process_bytes(qop_value, strlen(qop_value), 
-                             sess->stored_rdig);
-        ne_md5_process_bytes(":", 1, sess->stored_rdig);
+        ne_hash_update(sess->stored_rdig, qop_value, strlen(qop_value));
+        ne_hash_update(sess->stored_rdig, ":", 1);
 
         /* Digest ":" H(A2) */
-        ne_md5_process_bytes(a2_md5_ascii, 32, sess->stored_rdig);
+        ne_hash_update(sess->stored_rdig, a2_ascii, strlen(a2_ascii));
         /* All done */
-        ne_md5_finish_ascii(sess->stored_rdig, rdig_md5_ascii);
-        ne_md5_destroy_ctx(sess->stored_rdig);
+        ne_hash_finish_ascii(sess->stored_rdig, rdig_ascii);
+        ne_hash_destroy(sess->stored_rdig);
         sess->stored_rdig = NULL;
 
         /* And... do they match? */
-        ret = ne_strcasecmp(rdig_md5_ascii, rspauth) == 0 ? NE_OK : NE_ERROR;
+        ret = ne_strcasecmp(rdig_ascii, rspauth) == 0 ? NE_OK : NE_ERROR;
         
         NE_DEBUG(NE_DBG_HTTPAUTH, "auth: response-digest match: %s "
                  "(expected [%s] vs actual [%s])\n", 
-                 ret == NE_OK ? "yes" : "no", rdig_md5_ascii, rspauth);
+                 ret == NE_OK ? "yes" : "no", rdig_ascii, rspauth);
 
         if (ret) {
             ne_set_error(sess->sess, _("Digest mutual authentication failure: "
@@ -1217,6 +1393,7 @@ static int verify_digest_response(struct auth_request *req, auth_session *sess,
         ne_free(sess->nonce);
 	sess->nonce = ne_strdup(nextnonce);
         sess->nonce_count = 0;
+        sess->pspace_dirty = 1;
     }
 
     ne_free(hdr);
@@ -1252,6 +1429,390 @@ static const struct auth_protocol protocols[] = {
     { 0 }
 };
 
+/* Returns a copy of the 'n' paths in 'domains'. */
+static char **dup_domains(char **domains, size_t n)
+{
+    char **ret = ne_malloc(n * sizeof *ret);
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        ret[i] = ne_strdup(domains[i]);
+
+    return ret;
+}
+
+/* Free the contents of a protection space entry. */
+static void clear_pspace(struct auth_pspace *ps)
+{
+    ne_free(ps->server);
+    ne_free(ps->realm);
+    ne_free(ps->nonce);
+    ne_free(ps->cnonce);
+    if (ps->opaque) ne_free(ps->opaque);
+    while (ps->ndomains)
+        ne_free(ps->domains[--ps->ndomains]);
+    if (ps->domains) ne_free(ps->domains);
+    memset(ps, 0, sizeof *ps);
+}
+
+/* Returns non-zero if the protection space 'ps' has the same realm
+ * and domain list as the session. */
+static int same_pspace(const struct auth_pspace *ps, const auth_session *sess)
+{
+    size_t n;
+
+    if (strcmp(ps->realm, sess->realm) || ps->ndomains != sess->ndomains)
+        return 0;
+
+    for (n = 0; n < ps->ndomains; n++)
+        if (strcmp(ps->domains[n], sess->domains[n]))
+            return 0;
+
+    return 1;
+}
+
+/* Save the session's Digest state to the auth cache, replacing any
+ * existing entry for the same protection space. */
+static void save_pspace(auth_session *sess, ne_auth_cache *cache)
+{
+    const char *server = server_key(sess);
+    struct auth_pspace *ps, **pp;
+    unsigned int count = sess->nonce_count;
+    size_t n;
+
+    CACHE_LOCK(cache);
+
+    for (pp = &cache->spaces; (ps = *pp) != NULL; pp = &ps->next) {
+        if (strcmp(ps->server, server) == 0 && same_pspace(ps, sess)) {
+            *pp = ps->next;
+            break;
+        }
+    }
+
+    if (ps) {
+        /* Another session may have used the same nonce since. */
+        if (strcmp(ps->nonce, sess->nonce) == 0
+            && strcmp(ps->cnonce, sess->cnonce) == 0
+            && ps->nonce_count > count)
+            count = ps->nonce_count;
+        clear_pspace(ps);
+    }
+    else {
+        ps = ne_calloc(sizeof *ps);
+    }
+
+    ps->server = ne_strdup(server);
+    ps->realm = ne_strdup(sess->realm);
+    ps->nonce = ne_strdup(sess->nonce);
+    ps->cnonce = ne_strdup(sess->cnonce);
+    if (sess->opaque) ps->opaque = ne_strdup(sess->opaque);
+    if (sess->ndomains) {
+        ps->domains = dup_domains(sess->domains, sess->ndomains);
+        ps->ndomains = sess->ndomains;
+    }
+    ps->qop = sess->qop;
+    ps->alg = sess->alg;
+    ps->nonce_count = count;
+    strcpy(ps->username, sess->username);
+    strcpy(ps->h_a1, sess->h_a1);
+    strcpy(ps->userhash, sess->userhash);
+
+    ps->next = cache->spaces;
+    cache->spaces = ps;
+
+    /* Drop the least recently saved entry if the cache is full. */
+    for (n = 0, pp = &cache->spaces; *pp; pp = &(*pp)->next) {
+        if (++n > PSPACE_MAX) {
+            clear_pspace(*pp);
+            ne_free(*pp);
+            *pp = NULL;
+            break;
+        }
+    }
+
+    CACHE_UNLOCK(cache);
+
+    NE_DEBUG(NE_DBG_HTTPAUTH, "auth: Saved protection space '%s' for %s.\n",
+             sess->realm, server);
+}
+
+/* If the auth cache holds a Digest protection space for the server
+ * which covers Request-URI 'uri', set up the session to send
+ * credentials for it without waiting for a challenge. */
+static void load_pspace(auth_session *sess, ne_auth_cache *cache,
+                        const char *uri)
+{
+    const struct auth_protocol *proto;
+    struct auth_handler *hdl;
+    struct auth_pspace *ps;
+    const char *server;
+
+    /* Only use the cache if Digest auth is enabled. */
+    for (hdl = sess->handlers; hdl; hdl = hdl->next)
+        if (hdl->protomask & NE_AUTH_DIGEST)
+            break;
+    if (hdl == NULL)
+        return;
+
+    for (proto = protocols; proto->id != NE_AUTH_DIGEST; proto++)
+        /* nothing */;
+
+    server = server_key(sess);
+
+    CACHE_LOCK(cache);
+
+    for (ps = cache->spaces; ps; ps = ps->next) {
+        if (strcmp(ps->server, server) == 0
+            && (ps->ndomains == 0 
+                || inside_domain(ps->domains, ps->ndomains, uri)))
+            break;
+    }
+
+    if (ps) {
+        NE_DEBUG(NE_DBG_HTTPAUTH, "auth: Using cached protection space "
+                 "'%s' for %s.\n", ps->realm, uri);
+
+        clean_session(sess);
+        sess->realm = ne_strdup(ps->realm);
+        sess->nonce = ne_strdup(ps->nonce);
+        sess->cnonce = ne_strdup(ps->cnonce);
+        if (ps->opaque) sess->opaque = ne_strdup(ps->opaque);
+        if (ps->ndomains) {
+            sess->domains = dup_domains(ps->domains, ps->ndomains);
+            sess->ndomains = ps->ndomains;
+        }
+        sess->qop = ps->qop;
+        sess->alg = ps->alg;
+        sess->nonce_count = ps->nonce_count;
+        strcpy(sess->username, ps->username);
+        strcpy(sess->h_a1, ps->h_a1);
+        strcpy(sess->userhash, ps->userhash);
+        sess->protocol = proto;
+        sess->pspace_dirty = 0;
+    }
+
+    CACHE_UNLOCK(cache);
+}
+
+/* Returns the Basic auth protocol. */
+static const struct auth_protocol *basic_protocol(void)
+{
+    const struct auth_protocol *proto;
+
+    for (proto = protocols; proto->id != NE_AUTH_BASIC; proto++)
+        /* nothing */;
+
+    return proto;
+}
+
+/* Free a Basic credential entry. */
+static void free_basic(struct auth_basic *ent)
+{
+    ne_free(ent->server);
+    ne_free(ent->path);
+    ne_free(ent->realm);
+    if (ent->token) ne_free(ent->token);
+    memset(ent->username, 0, sizeof ent->username);
+    ne_free(ent);
+}
+
+/* Returns non-zero if Request-URI path 'path' is beneath 'ent'. */
+static int basic_covers(const struct auth_basic *ent, const char *server,
+                        const char *path)
+{
+    size_t len = strlen(ent->path);
+
+    /* The prefix must end on a path segment boundary: "/dav" covers
+     * "/dav/x" but not "/davx/". */
+    return strcmp(ent->server, server) == 0
+        && strncmp(path, ent->path, len) == 0
+        && (len == 0 || ent->path[len - 1] == '/'
+            || path[len] == '\0' || path[len] == '/');
+}
+
+/* Look up Basic credentials for the session's realm in the auth
+ * cache.  Returns 0 and sets up the session if found, else
+ * non-zero. */
+static int cached_basic(auth_session *sess)
+{
+    ne_auth_cache *cache = get_cache(sess);
+    struct auth_basic *ent;
+    const char *server;
+
+    if (cache == NULL) return -1;
+
+    server = server_key(sess);
+
+    CACHE_LOCK(cache);
+
+    for (ent = cache->basics; ent; ent = ent->next) {
+        if (ent->token && strcmp(ent->server, server) == 0
+            && strcmp(ent->realm, sess->realm) == 0)
+            break;
+    }
+
+    if (ent) {
+        sess->basic = ne_strdup(ent->token);
+        strcpy(sess->username, ent->username);
+        sess->basic_cached = 1;
+    }
+
+    CACHE_UNLOCK(cache);
+
+    if (ent) {
+        NE_DEBUG(NE_DBG_HTTPAUTH, "auth: Using cached Basic credentials "
+                 "for '%s'.\n", sess->realm);
+    }
+
+    return ent ? 0 : -1;
+}
+
+/* Save the session's Basic credentials, which were accepted for
+ * Request-URI 'uri', to the auth cache.  Unless a configured prefix
+ * covers the URI, the credentials are subsequently used for any
+ * Request-URI beneath its parent collection, per RFC 7617. */
+static void save_basic(auth_session *sess, ne_auth_cache *cache,
+                       const char *uri)
+{
+    const char *server = server_key(sess);
+    struct auth_basic *ent, **pp;
+    ne_uri u;
+    size_t n;
+
+    if (strcmp(uri, "*") == 0 || ne_uri_parse(uri, &u) != 0) {
+        return;
+    }
+
+    CACHE_LOCK(cache);
+
+    for (pp = &cache->basics; (ent = *pp) != NULL; pp = &ent->next) {
+        if (basic_covers(ent, server, u.path)
+            && strcmp(ent->realm, sess->realm) == 0)
+            break;
+    }
+
+    if (ent) {
+        if (ent->token) ne_free(ent->token);
+        if (!ent->configured) {
+            /* Move to the head of the list. */
+            *pp = ent->next;
+            ent->next = cache->basics;
+            cache->basics = ent;
+        }
+    }
+    else {
+        char *slash = strrchr(u.path, '/');
+
+        ent = ne_calloc(sizeof *ent);
+        ent->server = ne_strdup(server);
+        ent->path = ne_strndup(u.path, slash ? slash - u.path + 1 : 0);
+        ent->realm = ne_strdup(sess->realm);
+        ent->next = cache->basics;
+        cache->basics = ent;
+    }
+
+    ent->token = ne_strdup(sess->basic);
+    strcpy(ent->username, sess->username);
+
+    /* Drop the least recently saved entry if the cache is full;
+     * configured prefixes are never dropped. */
+    for (n = 0, pp = &cache->basics; (ent = *pp) != NULL; pp = &ent->next) {
+        if (!ent->configured && ++n > PSPACE_MAX) {
+            *pp = ent->next;
+            free_basic(ent);
+            break;
+        }
+    }
+
+    CACHE_UNLOCK(cache);
+
+    NE_DEBUG(NE_DBG_HTTPAUTH, "auth: Saved Basic credentials for '%s' "
+             "at %s%s.\n", sess->realm, server, u.path);
+
+    ne_uri_free(&u);
+}
+
+/* If the auth cache holds Basic credentials for a prefix of
+ * Request-URI 'uri', set up the session to send them without waiting
+ * for a challenge.  For a configured prefix with no credentials yet,
+ * they are requested from the handler. */
+static void load_basic(auth_session *sess, ne_auth_cache *cache,
+                       const char *uri)
+{
+    struct auth_handler *hdl;
+    struct auth_basic *ent;
+    char *realm = NULL, *token = NULL, username[NE_ABUFSIZ];
+    const char *server;
+    ne_uri u;
+
+    /* Only use the cache if Basic auth is enabled. */
+    for (hdl = sess->handlers; hdl; hdl = hdl->next)
+        if (hdl->protomask & NE_AUTH_BASIC)
+            break;
+    if (hdl == NULL)
+        return;
+
+    if (strcmp(uri, "*") == 0 || ne_uri_parse(uri, &u) != 0) {
+        return;
+    }
+
+    server = server_key(sess);
+
+    CACHE_LOCK(cache);
+
+    for (ent = cache->basics; ent; ent = ent->next) {
+        if (basic_covers(ent, server, u.path))
+            break;
+    }
+
+    if (ent) {
+        realm = ne_strdup(ent->realm);
+        if (ent->token) {
+            token = ne_strdup(ent->token);
+            strcpy(username, ent->username);
+        }
+    }
+
+    CACHE_UNLOCK(cache);
+
+    ne_uri_free(&u);
+
+    if (realm == NULL) return;
+
+    clean_session(sess);
+    sess->realm = realm;
+
+    if (token) {
+        NE_DEBUG(NE_DBG_HTTPAUTH, "auth: Using cached Basic credentials "
+                 "for %s.\n", uri);
+        sess->basic = token;
+        strcpy(sess->username, username);
+        sess->basic_cached = 1;
+        memset(username, 0, sizeof username);
+    }
+    else {
+        char *tmp, password[NE_ABUFSIZ];
+
+        /* The callback is invoked outside the lock, so sessions in
+         * other threads may race to obtain the credentials; the
+         * first to be accepted are kept. */
+        if (hdl->creds(hdl->userdata, realm, hdl->attempt,
+                       sess->username, password)) {
+            clean_session(sess);
+            return;
+        }
+        hdl->attempt++;
+
+        tmp = ne_concat(sess->username, ":", password, NULL);
+        sess->basic = ne_base64((unsigned char *)tmp, strlen(tmp));
+        ne_free(tmp);
+        memset(password, 0, sizeof password);
+        sess->pspace_dirty = 1;
+    }
+
+    sess->protocol = basic_protocol();
+}
+
 /* Insert a new auth challenge for protocol 'proto' in list of
  * challenges 'list'.  The challenge list is kept in sorted order of
  * strength, with highest strength first. */
@@ -1281,6 +1842,42 @@ static struct auth_challenge *insert_challenge(struct auth_challenge **list,
     return ret;
 }
 
+/* Returns the preference order of a challenge; for Digest, stronger
+ * algorithms are preferred. */
+static int challenge_rank(const struct auth_challenge *chall)
+{
+    int rank = chall->protocol->strength * 16;
+
+    if (chall->protocol->id == NE_AUTH_DIGEST 
+        && chall->alg != auth_alg_unknown) {
+        rank += chall->alg + 1;
+    }
+
+    return rank;
+}
+
+/* Re-sort the challenge list once all parameters are known, keeping
+ * the server's order for challenges of equal rank. */
+static struct auth_challenge *sort_challenges(struct auth_challenge *list)
+{
+    struct auth_challenge *ret = NULL, *chall, **pp;
+
+    while (list) {
+        chall = list;
+        list = list->next;
+
+        for (pp = &ret; *pp; pp = &(*pp)->next) {
+            if (challenge_rank(chall) > challenge_rank(*pp))
+                break;
+        }
+
+        chall->next = *pp;
+        *pp = chall;
+    }
+
+    return ret;
+}
+
 static void challenge_error(ne_buffer **errbuf, const char *fmt, ...)
 {
     char err[128];
@@ -1374,13 +1971,15 @@ static int auth_challenge(auth_session *sess, int attempt,
 	    /* Truth value */
 	    chall->stale = (ne_strcasecmp(val, "true") == 0);
 	} else if (ne_strcasecmp(key, "algorithm") == 0) {
-	    if (ne_strcasecmp(val, "md5") == 0) {
-		chall->alg = auth_alg_md5;
-	    } else if (ne_strcasecmp(val, "md5-sess") == 0) {
-		chall->alg = auth_alg_md5_sess;
-	    } else {
-		chall->alg = auth_alg_unknown;
-	    }
+            unsigned int n;
+
+            for (n = 0; n < auth_alg_unknown; n++) {
+                if (ne_strcasecmp(val, digest_algs[n].name) == 0)
+                    break;
+            }
+            chall->alg = n;
+	} else if (ne_strcasecmp(key, "userhash") == 0) {
+	    chall->userhash = ne_strcasecmp(val, "true") == 0;
 	} else if (ne_strcasecmp(key, "qop") == 0) {
             /* iterate over each token in the value */
             do {
@@ -1400,6 +1999,8 @@ static int auth_challenge(auth_session *sess, int attempt,
     
     sess->protocol = NULL;
 
+    challenges = sort_challenges(challenges);
+
     /* Iterate through the challenge list (which is sorted from
      * strongest to weakest) attempting to accept each one. */
     for (chall = challenges; chall != NULL; chall = chall->next) {
@@ -1464,6 +2065,13 @@ static void ah_pre_send(ne_request *r, void *cookie, ne_buffer *request)
 {
     auth_session *sess = cookie;
     struct auth_request *req = ne_get_request_private(r, sess->spec->id);
+    ne_auth_cache *cache;
+
+    if (!sess->protocol && req && (cache = get_cache(sess)) != NULL) {
+        load_pspace(sess, cache, req->uri);
+        if (!sess->protocol)
+            load_basic(sess, cache, req->uri);
+    }
 
     if (sess->protocol && req) {
 	char *value;
@@ -1557,6 +2165,21 @@ static int ah_post_send(ne_request *req, void *cookie, const ne_status *status)
     }
 #endif
 
+    /* Once Digest or Basic credentials have been accepted, save the
+     * state to the auth cache for use by other sessions. */
+    if (ret == NE_OK && sess->pspace_dirty && sess->protocol
+        && status->code != sess->spec->status_code) {
+        ne_auth_cache *cache = get_cache(sess);
+
+        if (cache && sess->protocol->id == NE_AUTH_DIGEST) {
+            save_pspace(sess, cache);
+        }
+        else if (cache && sess->protocol->id == NE_AUTH_BASIC) {
+            save_basic(sess, cache, areq->uri);
+        }
+        sess->pspace_dirty = 0;
+    }
+
     return ret;
 }
 
@@ -1588,6 +2211,7 @@ static void free_auth(void *cookie)
     }
 
     clean_session(sess);
+    if (sess->server) ne_free(sess->server);
     ne_free(sess);
 }
 
@@ -1701,3 +2325,75 @@ void ne_forget_auth(ne_session *sess)
 	clean_session(as);
 }
 
+ne_auth_cache *ne_auth_cache_create(void)
+{
+    ne_auth_cache *cache = ne_calloc(sizeof *cache);
+
+#ifdef HAVE_PTHREAD_MUTEX_LOCK
+    pthread_mutex_init(&cache->lock, NULL);
+#endif
+
+    return cache;
+}
+
+void ne_set_auth_cache(ne_session *sess, ne_auth_cache *cache)
+{
+    ne_set_session_private(sess, HOOK_CACHE_ID, cache);
+}
+
+int ne_auth_cache_add_basic(ne_auth_cache *cache, const char *uri,
+                            const char *realm)
+{
+    struct auth_basic *ent;
+    ne_uri u;
+
+    if (ne_uri_parse(uri, &u) || u.scheme == NULL || u.host == NULL) {
+        ne_uri_free(&u);
+        return -1;
+    }
+
+    ent = ne_calloc(sizeof *ent);
+    ent->path = u.path;
+    ent->realm = ne_strdup(realm);
+    ent->configured = 1;
+
+    /* Key on the server alone, as for a session. */
+    u.path = "/";
+    if (u.userinfo) ne_free(u.userinfo);
+    if (u.query) ne_free(u.query);
+    if (u.fragment) ne_free(u.fragment);
+    u.userinfo = u.query = u.fragment = NULL;
+    ent->server = ne_uri_unparse(&u);
+    u.path = NULL;
+    ne_uri_free(&u);
+
+    CACHE_LOCK(cache);
+    ent->next = cache->basics;
+    cache->basics = ent;
+    CACHE_UNLOCK(cache);
+
+    return 0;
+}
+
+void ne_auth_cache_destroy(ne_auth_cache *cache)
+{
+    struct auth_pspace *ps, *next;
+    struct auth_basic *ent, *enext;
+
+    for (ps = cache->spaces; ps; ps = next) {
+        next = ps->next;
+        clear_pspace(ps);
+        ne_free(ps);
+    }
+
+    for (ent = cache->basics; ent; ent = enext) {
+        enext = ent->next;
+        free_basic(ent);
+    }
+
+#ifdef HAVE_PTHREAD_MUTEX_LOCK
+    pthread_mutex_destroy(&cache->lock);
+#endif
+
+    ne_free(cache);
+}
@@ -127,6 +127,47 @@ void ne_add_proxy_auth(ne_session *sess, unsigned protocol,
  * session. */
 void ne_forget_auth(ne_session *sess);
 
+/* An auth cache holds the state of successful Digest authentication
+ * for each protection space (server, realm and domain list), so it
+ * can be shared between sessions.  A session using the cache sends
+ * Digest credentials with its first request to a URI inside a known
+ * protection space, rather than waiting for a 401 challenge; the
+ * nonce-count is shared between those sessions.  If the nonce has
+ * gone stale, the server's challenge is handled as usual.
+ *
+ * Accepted Basic credentials are also held in the cache, and are
+ * used to answer a Basic challenge for the same realm without
+ * invoking the credentials callback.  They are sent preemptively
+ * with any request for a URI beneath the collection for which they
+ * were accepted, or beneath a prefix given to
+ * ne_auth_cache_add_basic().  Rejected credentials are replaced
+ * using the callback as usual.  Sessions
+ * sharing a cache must be authenticating as the same user.  If neon
+ * is built with thread-safety support, the cache may be shared by
+ * sessions in different threads. */
+typedef struct ne_auth_cache_s ne_auth_cache;
+
+/* Create an auth cache. */
+ne_auth_cache *ne_auth_cache_create(void);
+
+/* Use the given auth cache for server authentication in session
+ * 'sess'.  The cache must outlive the session. */
+void ne_set_auth_cache(ne_session *sess, ne_auth_cache *cache);
+
+/* Send Basic credentials for realm 'realm' preemptively with any
+ * request for a URI beneath 'uri', which must be an absolute URI,
+ * e.g. "https://example.com/dav/"; a path without a trailing slash
+ * covers only complete path segments, so "https://example.com/dav"
+ * covers "/dav/x" but not "/davx".  If no credentials are yet cached
+ * for the prefix, the credentials callback of the first session to
+ * make such a request is invoked before the request is sent.
+ * Returns non-zero if 'uri' could not be parsed. */
+int ne_auth_cache_add_basic(ne_auth_cache *cache, const char *uri,
+                            const char *realm);
+
+/* Destroy an auth cache. */
+void ne_auth_cache_destroy(ne_auth_cache *cache);
+
 NE_END_DECLS
 
 #endif /* NE_AUTH_H */
@@ -41,6 +41,7 @@
 #include "ne_utils.h"
 #include "ne_basic.h"
 #include "ne_207.h"
+#include "ne_compress.h"
 
 #ifdef NE_HAVE_DAV
 #include "ne_uri.h"
@@ -233,6 +234,165 @@ int ne_get(ne_session *sess, const char *uri, int fd)
     return ret;
 }
 
+/* Maximum number of times ne_get2 will try to resume a transfer. */
+#define GET_RESUME_ATTEMPTS (5)
+
+/* State for an ne_get2 operation, preserved across resume attempts. */
+struct get_ctx {
+    ne_session *sess;
+    int fd;
+    ne_off_t written; /* number of entity bytes written to fd */
+    char *validator; /* strong validator used for If-Range, or NULL */
+    unsigned int encoded:1; /* non-zero if entity was content-coded */
+    unsigned int streaming:1; /* non-zero if body is being written */
+    unsigned int write_failed:1; /* non-zero if write to fd failed */
+};
+
+/* Acceptance callback for ne_get2: accepts a 2xx response to the
+ * initial request, or a 206 response with a Content-Range matching
+ * the requested resume offset. */
+static int get_accept(void *userdata, ne_request *req, const ne_status *st)
+{
+    struct get_ctx *ctx = userdata;
+
+    ctx->streaming = 0;
+
+    if (ctx->written) {
+        const char *value = ne_get_response_header(req, "Content-Range");
+        char expect[64];
+        size_t elen;
+
+        elen = ne_snprintf(expect, sizeof expect, "bytes %" FMT_NE_OFF_T "-",
+                           ctx->written);
+
+        if (st->code != 206 || value == NULL
+            || strncmp(value, expect, elen) != 0) {
+            return 0;
+        }
+    }
+    else {
+        const char *etag = ne_get_response_header(req, "ETag");
+        const char *lastmod = ne_get_response_header(req, "Last-Modified");
+
+        if (st->klass != 2) {
+            return 0;
+        }
+
+        ctx->encoded = ne_get_response_header(req, "Content-Encoding") != NULL;
+
+        /* Only a strong validator may be used with If-Range. */
+        if (ctx->validator) ne_free(ctx->validator);
+        if (etag && strncmp(etag, "W/", 2) != 0) {
+            ctx->validator = ne_strdup(etag);
+        }
+        else if (lastmod) {
+            ctx->validator = ne_strdup(lastmod);
+        }
+        else {
+            ctx->validator = NULL;
+        }
+    }
+
+    ctx->streaming = 1;
+    return 1;
+}
+
+/* Block reader for ne_get2: writes (possibly decompressed) entity
+ * body to the file descriptor. */
+static int get_writer(void *userdata, const char *block, size_t len)
+{
+    struct get_ctx *ctx = userdata;
+
+    while (len > 0) {
+        ssize_t ret = write(ctx->fd, block, len);
+
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        else if (ret < 0) {
+            char err[200];
+
+            ne_strerror(errno, err, sizeof err);
+            ne_set_error(ctx->sess, _("Could not write to file: %s"), err);
+            ctx->write_failed = 1;
+            return -1;
+        }
+
+        len -= ret;
+        block += ret;
+        ctx->written += ret;
+    }
+
+    return 0;
+}
+
+/* Run a single attempt of an ne_get2 operation.  Returns NE_* error
+ * code. */
+static int get_attempt(struct get_ctx *ctx, const char *uri,
+                       unsigned int flags)
+{
+    ne_request *req = ne_request_create(ctx->sess, "GET", uri);
+    ne_decompress *dc = NULL;
+    const ne_status *st = ne_get_status(req);
+    int ret;
+
+    if (ctx->written) {
+        ne_print_request_header(req, "Range", "bytes=%" FMT_NE_OFF_T "-",
+                                ctx->written);
+        ne_add_request_header(req, "If-Range", ctx->validator);
+        ne_add_response_body_reader(req, get_accept, get_writer, ctx);
+    }
+    else if (flags & NE_GETFLAG_DECOMPRESS) {
+        dc = ne_decompress_reader(req, get_accept, get_writer, ctx);
+    }
+    else {
+        ne_add_response_body_reader(req, get_accept, get_writer, ctx);
+    }
+
+    ret = ne_request_dispatch(req);
+
+    if (ret == NE_OK && ctx->written && st->klass == 2 && !ctx->streaming) {
+        ne_set_error(ctx->sess, _("Resource changed while resuming download"));
+        ret = NE_ERROR;
+    }
+    else if (ret == NE_OK && st->klass != 2) {
+        ret = NE_ERROR;
+    }
+
+    if (dc) ne_decompress_destroy(dc);
+    ne_request_destroy(req);
+
+    return ret;
+}
+
+int ne_get2(ne_session *sess, const char *uri, int fd, unsigned int flags)
+{
+    struct get_ctx ctx = {0};
+    int ret, attempt = 0;
+
+    ctx.sess = sess;
+    ctx.fd = fd;
+
+    ret = get_attempt(&ctx, uri, flags);
+
+    /* A response body which was interrupted part-way can be resumed
+     * iff it was not content-coded (the byte offset written would not
+     * then match the entity offset), and a strong validator is
+     * available to guarantee the entity has not changed. */
+    while (ret != NE_OK && (flags & NE_GETFLAG_RESUME)
+           && ctx.streaming && !ctx.write_failed && !ctx.encoded
+           && ctx.written > 0 && ctx.validator
+           && attempt++ < GET_RESUME_ATTEMPTS) {
+        NE_DEBUG(NE_DBG_HTTP, "get: Resuming from %" FMT_NE_OFF_T
+                 " (attempt %d): %s\n", ctx.written, attempt,
+                 ne_get_error(sess));
+        ret = get_attempt(&ctx, uri, flags);
+    }
+
+    if (ctx.validator) ne_free(ctx.validator);
+
+    return ret;
+}
 
 /* Get to given fd */
 int ne_post(ne_session *sess, const char *uri, int fd, const char *buffer)
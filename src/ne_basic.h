@@ -32,6 +32,31 @@ NE_BEGIN_DECLS
  * body which is returned to 'fd'. */
 int ne_get(ne_session *sess, const char *path, int fd);
 
+/* Flags for ne_get2: */
+#define NE_GETFLAG_DECOMPRESS (0x01) /* Negotiate a compressed response
+                                      * and decompress it on the fly. */
+#define NE_GETFLAG_RESUME (0x02) /* Resume an interrupted transfer. */
+
+/* Extended GET interface: perform a GET request on the resource at
+ * 'path', writing the entity body to 'fd'.  'flags' is a bitmask of
+ * NE_GETFLAG_* constants.
+ *
+ * If NE_GETFLAG_DECOMPRESS is given, the response entity is requested
+ * using the gzip content-coding, and the decoded entity is written to
+ * 'fd'.
+ *
+ * If NE_GETFLAG_RESUME is given and the transfer fails part-way
+ * through the response body, the transfer is resumed from the number
+ * of bytes already written using a ranged GET, conditional (via
+ * If-Range) on the strong validator of the original response.
+ * Resuming is retried a limited number of times.  A content-coded
+ * response, or a response without a strong validator, cannot be
+ * resumed.
+ *
+ * Returns NE_* error code; NE_ERROR is returned for a non-2xx
+ * response. */
+int ne_get2(ne_session *sess, const char *path, int fd, unsigned int flags);
+
 /* Perform a PUT request on resource at 'path', reading the entity
  * body to submit from 'fd'. */
 int ne_put(ne_session *sess, const char *path, int fd);
@@ -33,6 +33,8 @@
 #include "ne_utils.h"
 #include "ne_internal.h"
 
+#include "ne_private.h"
+
 #ifdef NE_HAVE_ZLIB
 
 #include <zlib.h>
@@ -193,6 +195,8 @@ static int do_inflate(ne_decompress *ctx, const char *buf, size_t len)
     ctx->zstr.avail_in = len;
     ctx->zstr.next_in = (unsigned char *)buf;
     ctx->zstr.total_in = 0;
+
+    NE_STAT_BYTES(ctx->session, compressed, len);
     
     do {
 	ctx->zstr.avail_out = sizeof ctx->outbuf;
@@ -213,6 +217,7 @@ static int do_inflate(ne_decompress *ctx, const char *buf, size_t len)
 	/* update checksum. */
 	ctx->checksum = crc32(ctx->checksum, (unsigned char *)ctx->outbuf, 
 			      ctx->zstr.total_out);
+	NE_STAT_BYTES(ctx->session, decompressed, ctx->zstr.total_out);
 
 	/* pass on the inflated data, if any */
         if (ctx->zstr.total_out > 0) {
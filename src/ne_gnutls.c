@@ -901,6 +901,7 @@ static int check_certificate(ne_session *sess, gnutls_session sock,
 
     if (failures == 0) {
         ret = NE_OK;
+        ne__ssl_cache_verify_store(sess, chain);
     } else {
         ne__ssl_set_verify_err(sess, failures);
         ret = NE_ERROR;
@@ -912,6 +913,31 @@ static int check_certificate(ne_session *sess, gnutls_session sock,
     return ret;
 }
 
+#if defined(HAVE_GNUTLS_SESSION_GET_DATA2)
+#define CACHE_LEN(c) ((c).size)
+#else
+#define CACHE_LEN(c) ((c).len)
+#endif
+
+/* Replace the context's client session data with that held in the
+ * session's shared session cache, if any. */
+static void load_cached_session(ne_session *sess, ne_ssl_context *ctx)
+{
+    unsigned char *data;
+    size_t len;
+
+    if (ctx->cache.client.data) {
+        ne_free(ctx->cache.client.data);
+        ctx->cache.client.data = NULL;
+    }
+
+    data = ne__ssl_cache_fetch(sess, &len);
+    if (data) {
+        ctx->cache.client.data = data;
+        CACHE_LEN(ctx->cache.client) = len;
+    }
+}
+
 /* Negotiate an SSL connection. */
 int ne__negotiate_ssl(ne_session *sess)
 {
@@ -925,7 +951,12 @@ int ne__negotiate_ssl(ne_session *sess)
     ctx->hostname = 
         sess->flags[NE_SESSFLAG_TLS_SNI] ? sess->server.hostname : NULL;
 
+    if (sess->ssl_scache) {
+        load_cached_session(sess, ctx);
+    }
+
     if (ne_sock_connect_ssl(sess->socket, ctx, sess)) {
+        ne__ssl_cache_remove(sess);
         if (sess->ssl_cc_requested) {
             ne_set_error(sess, _("SSL handshake failed, "
                                  "client certificate was requested: %s"),
@@ -940,6 +971,21 @@ int ne__negotiate_ssl(ne_session *sess)
 
     sock = ne__sock_sslsock(sess->socket);
 
+    NE_STAT_ADD(sess, ssl_handshakes, 1);
+    if (gnutls_session_is_resumed(sock)) {
+        NE_STAT_ADD(sess, ssl_resumed, 1);
+    }
+
+    if (sess->ssl_scache) {
+        int resumed = gnutls_session_is_resumed(sock);
+
+        ne__ssl_cache_result(sess, resumed);
+        if (!resumed && ctx->cache.client.data) {
+            ne__ssl_cache_store(sess, ctx->cache.client.data,
+                                CACHE_LEN(ctx->cache.client));
+        }
+    }
+
     chain = make_peers_chain(sock, ctx->cred);
     if (chain == NULL) {
         ne_set_error(sess, _("Server did not send certificate chain"));
@@ -954,8 +1000,12 @@ int ne__negotiate_ssl(ne_session *sess)
         return NE_OK;
     }
 
-    if (check_certificate(sess, sock, chain)) {
+    if (ne__ssl_cache_verified(sess, chain)) {
+        NE_DEBUG(NE_DBG_SSL, "ssl: Certificate chain already verified.\n");
+    }
+    else if (check_certificate(sess, sock, chain)) {
         ne_ssl_cert_free(chain);
+        ne__ssl_cache_remove(sess);
         return NE_ERROR;
     }
 
@@ -997,6 +1047,8 @@ void ne_ssl_trust_default_ca(ne_session *sess)
                                            NE_SSL_CA_BUNDLE,
                                            GNUTLS_X509_FMT_PEM);
 #endif
+
+    ne__ssl_trust_update(sess, "default-ca", "", 0);
 }
 
 /* Read the contents of file FILENAME into *DATUM. */
@@ -0,0 +1,423 @@
+/*
+   Message digest interface
+   Copyright (C) 2026, the neon contributors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+   MA 02111-1307, USA
+
+*/
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <string.h>
+
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+#include "ne_hash.h"
+#include "ne_md5.h"
+#include "ne_alloc.h"
+#include "ne_string.h" /* for NE_HEX2ASC */
+
+/* Use the OpenSSL EVP interface for the SHA-2 algorithms where it
+ * provides SHA-512/256. */
+#if defined(HAVE_OPENSSL) && OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define NE_HASH_EVP
+#endif
+
+#if SIZEOF_INT == 4
+typedef unsigned int sha_u32;
+#elif SIZEOF_LONG == 4
+typedef unsigned long sha_u32;
+#else
+# error "Cannot determine unsigned 32-bit data type."
+#endif
+
+#if SIZEOF_LONG == 8
+typedef unsigned long sha_u64;
+#elif SIZEOF_LONG_LONG == 8
+typedef unsigned long long sha_u64;
+#else
+# error "Cannot determine unsigned 64-bit data type."
+#endif
+
+/* Builds a 64-bit constant from two 32-bit halves. */
+#define U64(hi, lo) (((sha_u64)(hi) << 32) | (sha_u64)(lo))
+
+/* State of the built-in SHA-2 implementations. */
+struct sha_state {
+    union {
+        sha_u32 w32[8];
+        sha_u64 w64[8];
+    } h;
+    sha_u64 count; /* total bytes processed */
+    unsigned char buf[128];
+    size_t buflen, blocksize;
+    void (*block)(struct sha_state *st, const unsigned char *p);
+};
+
+struct ne_hash_ctx_s {
+    unsigned int alg;
+    struct ne_md5_ctx *md5;
+#ifdef NE_HASH_EVP
+    EVP_MD_CTX *evp;
+#endif
+    struct sha_state sha;
+};
+
+static const sha_u32 k256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const sha_u64 k512[80] = {
+    U64(0x428a2f98, 0xd728ae22), U64(0x71374491, 0x23ef65cd),
+    U64(0xb5c0fbcf, 0xec4d3b2f), U64(0xe9b5dba5, 0x8189dbbc),
+    U64(0x3956c25b, 0xf348b538), U64(0x59f111f1, 0xb605d019),
+    U64(0x923f82a4, 0xaf194f9b), U64(0xab1c5ed5, 0xda6d8118),
+    U64(0xd807aa98, 0xa3030242), U64(0x12835b01, 0x45706fbe),
+    U64(0x243185be, 0x4ee4b28c), U64(0x550c7dc3, 0xd5ffb4e2),
+    U64(0x72be5d74, 0xf27b896f), U64(0x80deb1fe, 0x3b1696b1),
+    U64(0x9bdc06a7, 0x25c71235), U64(0xc19bf174, 0xcf692694),
+    U64(0xe49b69c1, 0x9ef14ad2), U64(0xefbe4786, 0x384f25e3),
+    U64(0x0fc19dc6, 0x8b8cd5b5), U64(0x240ca1cc, 0x77ac9c65),
+    U64(0x2de92c6f, 0x592b0275), U64(0x4a7484aa, 0x6ea6e483),
+    U64(0x5cb0a9dc, 0xbd41fbd4), U64(0x76f988da, 0x831153b5),
+    U64(0x983e5152, 0xee66dfab), U64(0xa831c66d, 0x2db43210),
+    U64(0xb00327c8, 0x98fb213f), U64(0xbf597fc7, 0xbeef0ee4),
+    U64(0xc6e00bf3, 0x3da88fc2), U64(0xd5a79147, 0x930aa725),
+    U64(0x06ca6351, 0xe003826f), U64(0x14292967, 0x0a0e6e70),
+    U64(0x27b70a85, 0x46d22ffc), U64(0x2e1b2138, 0x5c26c926),
+    U64(0x4d2c6dfc, 0x5ac42aed), U64(0x53380d13, 0x9d95b3df),
+    U64(0x650a7354, 0x8baf63de), U64(0x766a0abb, 0x3c77b2a8),
+    U64(0x81c2c92e, 0x47edaee6), U64(0x92722c85, 0x1482353b),
+    U64(0xa2bfe8a1, 0x4cf10364), U64(0xa81a664b, 0xbc423001),
+    U64(0xc24b8b70, 0xd0f89791), U64(0xc76c51a3, 0x0654be30),
+    U64(0xd192e819, 0xd6ef5218), U64(0xd6990624, 0x5565a910),
+    U64(0xf40e3585, 0x5771202a), U64(0x106aa070, 0x32bbd1b8),
+    U64(0x19a4c116, 0xb8d2d0c8), U64(0x1e376c08, 0x5141ab53),
+    U64(0x2748774c, 0xdf8eeb99), U64(0x34b0bcb5, 0xe19b48a8),
+    U64(0x391c0cb3, 0xc5c95a63), U64(0x4ed8aa4a, 0xe3418acb),
+    U64(0x5b9cca4f, 0x7763e373), U64(0x682e6ff3, 0xd6b2b8a3),
+    U64(0x748f82ee, 0x5defb2fc), U64(0x78a5636f, 0x43172f60),
+    U64(0x84c87814, 0xa1f0ab72), U64(0x8cc70208, 0x1a6439ec),
+    U64(0x90befffa, 0x23631e28), U64(0xa4506ceb, 0xde82bde9),
+    U64(0xbef9a3f7, 0xb2c67915), U64(0xc67178f2, 0xe372532b),
+    U64(0xca273ece, 0xea26619c), U64(0xd186b8c7, 0x21c0c207),
+    U64(0xeada7dd6, 0xcde0eb1e), U64(0xf57d4f7f, 0xee6ed178),
+    U64(0x06f067aa, 0x72176fba), U64(0x0a637dc5, 0xa2c898a6),
+    U64(0x113f9804, 0xbef90dae), U64(0x1b710b35, 0x131c471b),
+    U64(0x28db77f5, 0x23047d84), U64(0x32caab7b, 0x40c72493),
+    U64(0x3c9ebe0a, 0x15c9bebc), U64(0x431d67c4, 0x9c100d4c),
+    U64(0x4cc5d4be, 0xcb3e42b6), U64(0x597f299c, 0xfc657e2a),
+    U64(0x5fcb6fab, 0x3ad6faec), U64(0x6c44198c, 0x4a475817)
+};
+
+/* Rotate right, for 32-bit and 64-bit words. */
+#define ROR32(x, n) ((((x) >> (n)) | ((x) << (32 - (n)))) & 0xffffffff)
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+/* Process one 64-byte block for SHA-256. */
+static void sha256_block(struct sha_state *st, const unsigned char *p)
+{
+    sha_u32 w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int n;
+
+    for (n = 0; n < 16; n++, p += 4) {
+        w[n] = ((sha_u32)p[0] << 24) | ((sha_u32)p[1] << 16)
+            | ((sha_u32)p[2] << 8) | (sha_u32)p[3];
+    }
+
+    for (n = 16; n < 64; n++) {
+        sha_u32 s0 = ROR32(w[n-15], 7) ^ ROR32(w[n-15], 18) ^ (w[n-15] >> 3);
+        sha_u32 s1 = ROR32(w[n-2], 17) ^ ROR32(w[n-2], 19) ^ (w[n-2] >> 10);
+
+        w[n] = (w[n-16] + s0 + w[n-7] + s1) & 0xffffffff;
+    }
+
+    a = st->h.w32[0]; b = st->h.w32[1]; c = st->h.w32[2]; d = st->h.w32[3];
+    e = st->h.w32[4]; f = st->h.w32[5]; g = st->h.w32[6]; h = st->h.w32[7];
+
+    for (n = 0; n < 64; n++) {
+        t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25))
+            + CH(e, f, g) + k256[n] + w[n];
+        t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + MAJ(a, b, c);
+        h = g; g = f; f = e;
+        e = (d + t1) & 0xffffffff;
+        d = c; c = b; b = a;
+        a = (t1 + t2) & 0xffffffff;
+    }
+
+    st->h.w32[0] = (st->h.w32[0] + a) & 0xffffffff;
+    st->h.w32[1] = (st->h.w32[1] + b) & 0xffffffff;
+    st->h.w32[2] = (st->h.w32[2] + c) & 0xffffffff;
+    st->h.w32[3] = (st->h.w32[3] + d) & 0xffffffff;
+    st->h.w32[4] = (st->h.w32[4] + e) & 0xffffffff;
+    st->h.w32[5] = (st->h.w32[5] + f) & 0xffffffff;
+    st->h.w32[6] = (st->h.w32[6] + g) & 0xffffffff;
+    st->h.w32[7] = (st->h.w32[7] + h) & 0xffffffff;
+}
+
+/* Process one 128-byte block for SHA-512. */
+static void sha512_block(struct sha_state *st, const unsigned char *p)
+{
+    sha_u64 w[80], a, b, c, d, e, f, g, h, t1, t2;
+    int n, m;
+
+    for (n = 0; n < 16; n++) {
+        w[n] = 0;
+        for (m = 0; m < 8; m++)
+            w[n] = (w[n] << 8) | *p++;
+    }
+
+    for (n = 16; n < 80; n++) {
+        sha_u64 s0 = ROR64(w[n-15], 1) ^ ROR64(w[n-15], 8) ^ (w[n-15] >> 7);
+        sha_u64 s1 = ROR64(w[n-2], 19) ^ ROR64(w[n-2], 61) ^ (w[n-2] >> 6);
+
+        w[n] = w[n-16] + s0 + w[n-7] + s1;
+    }
+
+    a = st->h.w64[0]; b = st->h.w64[1]; c = st->h.w64[2]; d = st->h.w64[3];
+    e = st->h.w64[4]; f = st->h.w64[5]; g = st->h.w64[6]; h = st->h.w64[7];
+
+    for (n = 0; n < 80; n++) {
+        t1 = h + (ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41))
+            + CH(e, f, g) + k512[n] + w[n];
+        t2 = (ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39)) + MAJ(a, b, c);
+        h = g; g = f; f = e;
+        e = d + t1;
+        d = c; c = b; b = a;
+        a = t1 + t2;
+    }
+
+    st->h.w64[0] += a; st->h.w64[1] += b; st->h.w64[2] += c;
+    st->h.w64[3] += d; st->h.w64[4] += e; st->h.w64[5] += f;
+    st->h.w64[6] += g; st->h.w64[7] += h;
+}
+
+static void sha_init(struct sha_state *st, unsigned int alg)
+{
+    static const sha_u32 iv256[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    /* The SHA-512/256 IV, from FIPS 180-4 section 5.3.6.2. */
+    static const sha_u64 iv512_256[8] = {
+        U64(0x22312194, 0xfc2bf72c), U64(0x9f555fa3, 0xc84c64c2),
+        U64(0x2393b86b, 0x6f53b151), U64(0x96387719, 0x5940eabd),
+        U64(0x96283ee2, 0xa88effe3), U64(0xbe5e1e25, 0x53863992),
+        U64(0x2b0199fc, 0x2c85b8aa), U64(0x0eb72ddc, 0x81c52ca2)
+    };
+
+    memset(st, 0, sizeof *st);
+
+    if (alg == NE_HASH_SHA256) {
+        memcpy(st->h.w32, iv256, sizeof iv256);
+        st->blocksize = 64;
+        st->block = sha256_block;
+    }
+    else {
+        memcpy(st->h.w64, iv512_256, sizeof iv512_256);
+        st->blocksize = 128;
+        st->block = sha512_block;
+    }
+}
+
+static void sha_update(struct sha_state *st, const unsigned char *p,
+                       size_t len)
+{
+    st->count += len;
+
+    if (st->buflen) {
+        size_t n = st->blocksize - st->buflen;
+
+        if (n > len) n = len;
+        memcpy(st->buf + st->buflen, p, n);
+        st->buflen += n;
+        p += n;
+        len -= n;
+
+        if (st->buflen < st->blocksize)
+            return;
+
+        st->block(st, st->buf);
+        st->buflen = 0;
+    }
+
+    while (len >= st->blocksize) {
+        st->block(st, p);
+        p += st->blocksize;
+        len -= st->blocksize;
+    }
+
+    memcpy(st->buf, p, len);
+    st->buflen = len;
+}
+
+/* Finish the hash, writing the 32-byte result to 'out'. */
+static void sha_finish(struct sha_state *st, unsigned char *out)
+{
+    /* The length field is 8 bytes for SHA-256, 16 for SHA-512. */
+    size_t lenfield = st->blocksize / 8, n;
+    sha_u64 bits = st->count << 3;
+
+    st->buf[st->buflen++] = 0x80;
+    if (st->buflen > st->blocksize - lenfield) {
+        memset(st->buf + st->buflen, 0, st->blocksize - st->buflen);
+        st->block(st, st->buf);
+        st->buflen = 0;
+    }
+    memset(st->buf + st->buflen, 0, st->blocksize - st->buflen);
+
+    /* The upper bits of the SHA-512 length are taken from the
+     * overflow of the byte count. */
+    if (lenfield == 16)
+        st->buf[st->blocksize - 9] = (unsigned char)(st->count >> 61);
+    for (n = 0; n < 8; n++)
+        st->buf[st->blocksize - 1 - n] = (unsigned char)(bits >> (8 * n));
+    st->block(st, st->buf);
+
+    if (st->blocksize == 64) {
+        for (n = 0; n < 32; n++)
+            out[n] = (unsigned char)(st->h.w32[n / 4] >> (24 - 8 * (n % 4)));
+    }
+    else {
+        /* SHA-512/256 is the leftmost 256 bits of the result. */
+        for (n = 0; n < 32; n++)
+            out[n] = (unsigned char)(st->h.w64[n / 8] >> (56 - 8 * (n % 8)));
+    }
+}
+
+ne_hash_ctx *ne_hash_create(unsigned int alg)
+{
+    ne_hash_ctx *ctx;
+
+    if (alg != NE_HASH_MD5 && alg != NE_HASH_SHA256
+        && alg != NE_HASH_SHA512_256) {
+        return NULL;
+    }
+
+    ctx = ne_calloc(sizeof *ctx);
+    ctx->alg = alg;
+
+    if (alg == NE_HASH_MD5) {
+        ctx->md5 = ne_md5_create_ctx();
+        return ctx;
+    }
+
+#ifdef NE_HASH_EVP
+    ctx->evp = EVP_MD_CTX_new();
+    if (ctx->evp
+        && EVP_DigestInit_ex(ctx->evp, alg == NE_HASH_SHA256
+                             ? EVP_sha256() : EVP_sha512_256(), NULL) == 1) {
+        return ctx;
+    }
+    /* Fall back on the built-in implementation, e.g. where the
+     * algorithm is disabled in the OpenSSL configuration. */
+    if (ctx->evp) EVP_MD_CTX_free(ctx->evp);
+    ctx->evp = NULL;
+#endif
+
+    sha_init(&ctx->sha, alg);
+
+    return ctx;
+}
+
+void ne_hash_update(ne_hash_ctx *ctx, const void *data, size_t len)
+{
+    if (ctx->md5) {
+        ne_md5_process_bytes(data, len, ctx->md5);
+    }
+#ifdef NE_HASH_EVP
+    else if (ctx->evp) {
+        EVP_DigestUpdate(ctx->evp, data, len);
+    }
+#endif
+    else {
+        sha_update(&ctx->sha, data, len);
+    }
+}
+
+ne_hash_ctx *ne_hash_dup(const ne_hash_ctx *ctx)
+{
+    ne_hash_ctx *ret = ne_malloc(sizeof *ret);
+
+    memcpy(ret, ctx, sizeof *ret);
+
+    if (ctx->md5) {
+        ret->md5 = ne_md5_dup_ctx(ctx->md5);
+    }
+#ifdef NE_HASH_EVP
+    else if (ctx->evp) {
+        ret->evp = EVP_MD_CTX_new();
+        EVP_MD_CTX_copy_ex(ret->evp, ctx->evp);
+    }
+#endif
+
+    return ret;
+}
+
+char *ne_hash_finish_ascii(ne_hash_ctx *ctx, char *buffer)
+{
+    unsigned char raw[32];
+    size_t n, len = 32;
+
+    if (ctx->md5) {
+        return ne_md5_finish_ascii(ctx->md5, buffer);
+    }
+#ifdef NE_HASH_EVP
+    else if (ctx->evp) {
+        unsigned int rlen = sizeof raw;
+
+        EVP_DigestFinal_ex(ctx->evp, raw, &rlen);
+        len = rlen;
+    }
+#endif
+    else {
+        sha_finish(&ctx->sha, raw);
+    }
+
+    for (n = 0; n < len; n++) {
+        buffer[n*2] = NE_HEX2ASC(raw[n] >> 4);
+        buffer[n*2+1] = NE_HEX2ASC(raw[n] & 0x0f);
+    }
+    buffer[len*2] = '\0';
+
+    return buffer;
+}
+
+void ne_hash_destroy(ne_hash_ctx *ctx)
+{
+    if (ctx->md5) ne_md5_destroy_ctx(ctx->md5);
+#ifdef NE_HASH_EVP
+    if (ctx->evp) EVP_MD_CTX_free(ctx->evp);
+#endif
+    ne_free(ctx);
+}
@@ -0,0 +1,66 @@
+/*
+   Message digest interface
+   Copyright (C) 2026, the neon contributors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+   MA 02111-1307, USA
+
+*/
+
+#ifndef NE_HASH_H
+#define NE_HASH_H
+
+#include <sys/types.h>
+
+#include "ne_defs.h"
+
+NE_BEGIN_DECLS
+
+/* Hash algorithms: */
+#define NE_HASH_MD5 (1) /* MD5, RFC 1321 */
+#define NE_HASH_SHA256 (2) /* SHA-256, FIPS 180-4 */
+#define NE_HASH_SHA512_256 (3) /* SHA-512/256, FIPS 180-4 */
+
+/* Maximum length of a hash value in ASCII hex, excluding the NUL
+ * terminator. */
+#define NE_HASH_MAXHEX (64)
+
+typedef struct ne_hash_ctx_s ne_hash_ctx;
+
+/* Create a hash context for algorithm 'alg' (one of the NE_HASH_*
+ * constants).  Returns NULL if the algorithm is not supported.  Where
+ * neon is built with OpenSSL, its implementations of the SHA-2
+ * algorithms are used, otherwise built-in implementations. */
+ne_hash_ctx *ne_hash_create(unsigned int alg);
+
+/* Process 'len' bytes of 'data'. */
+void ne_hash_update(ne_hash_ctx *ctx, const void *data, size_t len);
+
+/* Returns a copy of the context, including the state of the hash
+ * computation so far. */
+ne_hash_ctx *ne_hash_dup(const ne_hash_ctx *ctx);
+
+/* Write the hash of the data processed so far as a NUL-terminated
+ * lowercase ASCII hex string to 'buffer', which must be at least
+ * NE_HASH_MAXHEX + 1 bytes long.  The context must not be updated
+ * afterwards, only destroyed.  Returns 'buffer'. */
+char *ne_hash_finish_ascii(ne_hash_ctx *ctx, char *buffer);
+
+/* Destroy a hash context. */
+void ne_hash_destroy(ne_hash_ctx *ctx);
+
+NE_END_DECLS
+
+#endif /* NE_HASH_H */
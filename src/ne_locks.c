@@ -34,6 +34,7 @@
 #endif
 
 #include <ctype.h> /* for isdigit() */
+#include <time.h>
 
 #include "ne_alloc.h"
 
@@ -53,16 +54,58 @@
 struct lock_list {
     struct ne_lock *lock;
     struct lock_list *next, *prev;
+    /* In a lock store, 'node' is the index node for the lock's path,
+     * and nnext/nprev link the locks at that node.  In a request's
+     * submit list, nnext links locks with the same token hash. */
+    struct lock_node *node;
+    struct lock_list *nnext, *nprev;
+    /* In a lock store: time at which the lock expires, and position
+     * in the refresh heap plus one, or zero if not in the heap. */
+    time_t deadline;
+    unsigned int heappos;
+};
+
+/* The locks in a store are indexed by server and path: each server
+ * has a tree with a node per path segment, so the locks which apply
+ * to a path are found in time proportional to the depth of the path,
+ * rather than the number of locks stored.  As with ne_path_compare,
+ * segments are compared case-insensitively and trailing slashes are
+ * ignored. */
+struct lock_node {
+    char *segment; /* case-folded path segment; NULL for the root */
+    unsigned int hash; /* hash of segment */
+    struct lock_node *parent, *children, *sibling, *sprev;
+    struct lock_node *hnext; /* next in store's hash chain */
+    struct lock_list *locks; /* locks on exactly this path */
+};
+
+struct lock_server {
+    char *scheme, *host;
+    unsigned int port;
+    struct lock_node root;
+    struct lock_server *next;
 };
 
 struct ne_lock_store_s {
     struct lock_list *locks;
     struct lock_list *cursor; /* current position in 'locks' */
+    struct lock_server *servers;
+    /* Hash table of non-root index nodes, keyed on parent node and
+     * segment. */
+    struct lock_node **nodes;
+    unsigned int nodemask, numnodes;
+    /* Binary min-heap of locks with a finite timeout, ordered by
+     * deadline. */
+    struct lock_list **heap;
+    unsigned int heapcount, heapalloc;
 };
 
+#define SUBMIT_HASHSIZE (32)
+
 struct lh_req_cookie {
     const ne_lock_store *store;
     struct lock_list *submit;
+    struct lock_list *tokens[SUBMIT_HASHSIZE]; /* submit by token hash */
 };
 
 /* Context for PROPFIND/lockdiscovery callbacks */
@@ -71,6 +114,7 @@ struct discover_ctx {
     ne_lock_result results;
     void *userdata;
     ne_buffer *cdata;
+    ne_xml_idtable *ids; /* compiled form of element_map */
 };
 
 /* Context for handling LOCK response */
@@ -81,6 +125,7 @@ struct lock_ctx {
     char *token; /* the token we're after. */
     int found;
     ne_buffer *cdata;
+    ne_xml_idtable *ids; /* compiled form of element_map */
 };
 
 /* use the "application" state space. */
@@ -120,9 +165,8 @@ static const ne_propname lock_props[] = {
 static void lk_create(ne_request *req, void *session, 
 		       const char *method, const char *uri)
 {
-    struct lh_req_cookie *lrc = ne_malloc(sizeof *lrc);
+    struct lh_req_cookie *lrc = ne_calloc(sizeof *lrc);
     lrc->store = session;
-    lrc->submit = NULL;
     ne_set_request_private(req, HOOK_ID, lrc);
 }
 
@@ -145,10 +189,11 @@ static void lk_pre_send(ne_request *r, void *userdata, ne_buffer *req)
     }
 }
 
-/* Insert 'lock' into lock list *list. */
-static void insert_lock(struct lock_list **list, struct ne_lock *lock)
+/* Insert 'lock' into lock list *list; returns the new list item. */
+static struct lock_list *insert_lock(struct lock_list **list, 
+                                     struct ne_lock *lock)
 {
-    struct lock_list *item = ne_malloc(sizeof *item);
+    struct lock_list *item = ne_calloc(sizeof *item);
     if (*list != NULL) {
 	(*list)->prev = item;
     }
@@ -156,6 +201,7 @@ static void insert_lock(struct lock_list **list, struct ne_lock *lock)
     item->next = *list;
     item->lock = lock;
     *list = item;
+    return item;
 }
 
 static void free_list(struct lock_list *list, int destroy)
@@ -180,7 +226,30 @@ static void lk_destroy(ne_request *req, void *userdata)
 
 void ne_lockstore_destroy(ne_lock_store *store)
 {
+    struct lock_server *srv, *next_srv;
+    unsigned int n;
+
     free_list(store->locks, 1);
+
+    for (n = 0; store->nodes && n <= store->nodemask; n++) {
+        struct lock_node *node, *next;
+
+        for (node = store->nodes[n]; node; node = next) {
+            next = node->hnext;
+            ne_free(node->segment);
+            ne_free(node);
+        }
+    }
+    if (store->nodes) ne_free(store->nodes);
+    if (store->heap) ne_free(store->heap);
+
+    for (srv = store->servers; srv; srv = next_srv) {
+        next_srv = srv->next;
+        ne_free(srv->scheme);
+        ne_free(srv->host);
+        ne_free(srv);
+    }
+
     ne_free(store);
 }
 
@@ -211,26 +280,256 @@ void ne_lockstore_register(ne_lock_store *store, ne_session *sess)
     ne_hook_destroy_request(sess, lk_destroy, store);
 }
 
+/* Returns the case-folded hash of the 'len' bytes at 'str'. */
+static unsigned int hash_casefold(const char *str, size_t len)
+{
+    unsigned int h = 0;
+    size_t n;
+
+    for (n = 0; n < len; n++)
+        h = h * 33 + ne_tolower(str[n]);
+
+    return h;
+}
+
 /* Submit the given lock for the given URI */
 static void submit_lock(struct lh_req_cookie *lrc, struct ne_lock *lock)
 {
+    unsigned int hash = hash_casefold(lock->token, strlen(lock->token))
+        % SUBMIT_HASHSIZE;
     struct lock_list *item;
 
     /* Check for dups */
-    for (item = lrc->submit; item != NULL; item = item->next) {
+    for (item = lrc->tokens[hash]; item != NULL; item = item->nnext) {
 	if (ne_strcasecmp(item->lock->token, lock->token) == 0)
 	    return;
     }
 
-    insert_lock(&lrc->submit, lock);
+    item = insert_lock(&lrc->submit, lock);
+    item->nnext = lrc->tokens[hash];
+    lrc->tokens[hash] = item;
+}
+
+/* Returns the next segment of 'path', skipping any leading slashes,
+ * placing its length in *len; or NULL if there are no more
+ * segments. */
+static const char *next_segment(const char *path, size_t *len)
+{
+    while (*path == '/') path++;
+    *len = strcspn(path, "/");
+    return *len ? path : NULL;
+}
+
+#define NODE_BUCKET(s, p, h) \
+    (((h) ^ (unsigned int)((unsigned long)(p) >> 4)) & (s)->nodemask)
+
+/* Returns the child of 'parent' with the given segment, or NULL. */
+static struct lock_node *find_child(const ne_lock_store *store,
+                                    const struct lock_node *parent,
+                                    const char *seg, size_t len)
+{
+    unsigned int hash = hash_casefold(seg, len);
+    struct lock_node *node;
+
+    if (store->nodes == NULL) return NULL;
+
+    for (node = store->nodes[NODE_BUCKET(store, parent, hash)]; 
+         node; node = node->hnext) {
+        if (node->parent == parent && node->hash == hash
+            && ne_strncasecmp(node->segment, seg, len) == 0
+            && node->segment[len] == '\0')
+            return node;
+    }
+
+    return NULL;
+}
+
+/* Doubles the size of the node hash table. */
+static void grow_nodes(ne_lock_store *store)
+{
+    struct lock_node **old = store->nodes;
+    unsigned int n, oldsize = old ? store->nodemask + 1 : 0;
+
+    store->nodemask = oldsize ? oldsize * 2 - 1 : 63;
+    store->nodes = ne_calloc((store->nodemask + 1) * sizeof *store->nodes);
+
+    for (n = 0; n < oldsize; n++) {
+        struct lock_node *node, *next;
+
+        for (node = old[n]; node; node = next) {
+            unsigned int b = NODE_BUCKET(store, node->parent, node->hash);
+            next = node->hnext;
+            node->hnext = store->nodes[b];
+            store->nodes[b] = node;
+        }
+    }
+
+    if (old) ne_free(old);
+}
+
+/* Returns the child of 'parent' with the given segment, creating it
+ * if necessary. */
+static struct lock_node *make_child(ne_lock_store *store,
+                                    struct lock_node *parent,
+                                    const char *seg, size_t len)
+{
+    struct lock_node *node = find_child(store, parent, seg, len);
+    unsigned int b;
+    size_t n;
+
+    if (node) return node;
+
+    if (store->numnodes >= (store->nodes ? store->nodemask + 1 : 0))
+        grow_nodes(store);
+
+    node = ne_calloc(sizeof *node);
+    node->segment = ne_malloc(len + 1);
+    for (n = 0; n < len; n++)
+        node->segment[n] = ne_tolower(seg[n]);
+    node->segment[len] = '\0';
+    node->hash = hash_casefold(seg, len);
+    node->parent = parent;
+
+    node->sibling = parent->children;
+    if (parent->children) parent->children->sprev = node;
+    parent->children = node;
+
+    b = NODE_BUCKET(store, parent, node->hash);
+    node->hnext = store->nodes[b];
+    store->nodes[b] = node;
+    store->numnodes++;
+
+    return node;
+}
+
+/* Frees 'node' and any ancestors which hold no locks and have no
+ * children. */
+static void prune_node(ne_lock_store *store, struct lock_node *node)
+{
+    while (node->segment && node->locks == NULL && node->children == NULL) {
+        struct lock_node *parent = node->parent, **ptr;
+
+        if (node->sprev)
+            node->sprev->sibling = node->sibling;
+        else
+            parent->children = node->sibling;
+        if (node->sibling)
+            node->sibling->sprev = node->sprev;
+
+        for (ptr = &store->nodes[NODE_BUCKET(store, parent, node->hash)];
+             *ptr != node; ptr = &(*ptr)->hnext)
+            /* nothing */;
+        *ptr = node->hnext;
+        store->numnodes--;
+
+        ne_free(node->segment);
+        ne_free(node);
+        node = parent;
+    }
+}
+
+/* Returns the index tree for the given server, or NULL. */
+static struct lock_server *find_server(const ne_lock_store *store,
+                                       const ne_uri *uri)
+{
+    struct lock_server *srv;
+    unsigned int port = uri->port ? uri->port 
+        : ne_uri_defaultport(uri->scheme ? uri->scheme : "");
+
+    for (srv = store->servers; srv; srv = srv->next) {
+        if (srv->port == port
+            && ne_strcasecmp(srv->host, uri->host ? uri->host : "") == 0
+            && ne_strcasecmp(srv->scheme, uri->scheme ? uri->scheme : "") == 0)
+            return srv;
+    }
+
+    return NULL;
+}
+
+/* Returns the index node for the given path of server 'srv', or
+ * NULL. */
+static struct lock_node *find_node(const ne_lock_store *store,
+                                   struct lock_server *srv,
+                                   const char *path)
+{
+    struct lock_node *node = &srv->root;
+    const char *seg;
+    size_t len;
+
+    for (seg = next_segment(path, &len); seg && node;
+         seg = next_segment(seg + len, &len)) {
+        node = find_child(store, node, seg, len);
+    }
+
+    return node;
+}
+
+/* Submits all the locks at and below 'node'. */
+static void submit_subtree(struct lh_req_cookie *lrc, struct lock_node *node)
+{
+    struct lock_list *item;
+    struct lock_node *child;
+
+    for (item = node->locks; item; item = item->nnext) {
+        NE_DEBUG(NE_DBG_LOCKS, "Has child: %s\n", item->lock->token);
+        submit_lock(lrc, item->lock);
+    }
+
+    for (child = node->children; child; child = child->sibling)
+        submit_subtree(lrc, child);
+}
+
+/* Returns the index node for 'path' on the session's server, or NULL;
+ * any infinite depth locks on proper ancestors of the path are
+ * submitted on the way down. */
+static struct lock_node *walk_path(struct lh_req_cookie *lrc,
+                                   ne_session *sess, const char *path)
+{
+    ne_uri u = {0};
+    struct lock_server *srv;
+    struct lock_node *node;
+    struct lock_list *item;
+    const char *seg;
+    size_t len;
+
+    ne_fill_server_uri(sess, &u);
+    srv = find_server(lrc->store, &u);
+    ne_uri_free(&u);
+
+    if (srv == NULL) return NULL;
+
+    for (node = &srv->root, seg = next_segment(path, &len); 
+         node && seg; seg = next_segment(seg + len, &len)) {
+        /* This is a proper ancestor: any infinite depth locks here
+         * cover the path. */
+        for (item = node->locks; item; item = item->nnext) {
+            if (item->lock->depth == NE_DEPTH_INFINITE) {
+                NE_DEBUG(NE_DBG_LOCKS, "Is child of: %s\n", 
+                         item->lock->token);
+                submit_lock(lrc, item->lock);
+            }
+        }
+        node = find_child(lrc->store, node, seg, len);
+    }
+
+    return node;
 }
 
 struct ne_lock *ne_lockstore_findbyuri(ne_lock_store *store,
 				       const ne_uri *uri)
 {
+    struct lock_server *srv = find_server(store, uri);
+    struct lock_node *node;
     struct lock_list *cur;
 
-    for (cur = store->locks; cur != NULL; cur = cur->next) {
+    if (srv == NULL || uri->path == NULL)
+        return NULL;
+
+    node = find_node(store, srv, uri->path);
+    if (node == NULL)
+        return NULL;
+
+    for (cur = node->locks; cur != NULL; cur = cur->nnext) {
 	if (ne_uri_cmp(&cur->lock->uri, uri) == 0) {
 	    return cur->lock;
 	}
@@ -242,7 +541,7 @@ struct ne_lock *ne_lockstore_findbyuri(ne_lock_store *store,
 void ne_lock_using_parent(ne_request *req, const char *path)
 {
     struct lh_req_cookie *lrc = ne_get_request_private(req, HOOK_ID);
-    ne_uri u = {0};
+    struct lock_node *node;
     struct lock_list *item;
     char *parent;
 
@@ -253,85 +552,232 @@ void ne_lock_using_parent(ne_request *req, const char *path)
     if (parent == NULL)
 	return;
     
-    ne_fill_server_uri(ne_get_session(req), &u);
-
-    for (item = lrc->store->locks; item != NULL; item = item->next) {
-
-	/* Only care about locks which are on this server. */
-	u.path = item->lock->uri.path;
-	if (ne_uri_cmp(&u, &item->lock->uri))
-	    continue;
-	
-	/* This lock is needed if it is an infinite depth lock which
-	 * covers the parent, or a lock on the parent itself. */
-	if ((item->lock->depth == NE_DEPTH_INFINITE && 
-	     ne_path_childof(item->lock->uri.path, parent)) ||
-	    ne_path_compare(item->lock->uri.path, parent) == 0) {
+    /* A lock is needed if it is an infinite depth lock which covers
+     * the parent, or a lock on the parent itself. */
+    node = walk_path(lrc, ne_get_session(req), parent);
+    if (node) {
+        for (item = node->locks; item; item = item->nnext) {
 	    NE_DEBUG(NE_DBG_LOCKS, "Locked parent, %s on %s\n",
 		     item->lock->token, item->lock->uri.path);
 	    submit_lock(lrc, item->lock);
-	}
+        }
     }
 
-    u.path = parent; /* handy: makes u.path valid and ne_free(parent). */
-    ne_uri_free(&u);
+    ne_free(parent);
 }
 
 void ne_lock_using_resource(ne_request *req, const char *uri, int depth)
 {
     struct lh_req_cookie *lrc = ne_get_request_private(req, HOOK_ID);
+    struct lock_node *node, *child;
     struct lock_list *item;
-    int match;
 
     if (lrc == NULL)
 	return;	
 
-    /* Iterate over the list of stored locks to see if any of them
-     * apply to this resource */
-    for (item = lrc->store->locks; item != NULL; item = item->next) {
-	
-	match = 0;
-	
-	if (depth == NE_DEPTH_INFINITE &&
-	    ne_path_childof(uri, item->lock->uri.path)) {
-	    /* Case 1: this is a depth-infinity request which will 
-	     * modify a lock somewhere inside the collection. */
-	    NE_DEBUG(NE_DBG_LOCKS, "Has child: %s\n", item->lock->token);
-	    match = 1;
-	} 
-	else if (ne_path_compare(uri, item->lock->uri.path) == 0) {
-	    /* Case 2: this request is directly on a locked resource */
-	    NE_DEBUG(NE_DBG_LOCKS, "Has direct lock: %s\n", item->lock->token);
-	    match = 1;
-	}
-	else if (item->lock->depth == NE_DEPTH_INFINITE && 
-		 ne_path_childof(item->lock->uri.path, uri)) {
-	    /* Case 3: there is a higher-up infinite-depth lock which
-	     * covers the resource that this request will modify. */
-	    NE_DEBUG(NE_DBG_LOCKS, "Is child of: %s\n", item->lock->token);
-	    match = 1;
-	}
-	
-	if (match) {
-	    submit_lock(lrc, item->lock);
-	}
+    /* Any higher-up infinite-depth lock covers the resource which
+     * this request will modify; walk_path submits these. */
+    node = walk_path(lrc, ne_get_session(req), uri);
+    if (node == NULL)
+        return;
+
+    /* This request is directly on a locked resource. */
+    for (item = node->locks; item; item = item->nnext) {
+        NE_DEBUG(NE_DBG_LOCKS, "Has direct lock: %s\n", item->lock->token);
+        submit_lock(lrc, item->lock);
     }
 
+    /* A depth-infinity request will modify any locked resource
+     * inside the collection. */
+    if (depth == NE_DEPTH_INFINITE) {
+        for (child = node->children; child; child = child->sibling)
+            submit_subtree(lrc, child);
+    }
+}
+
+/* Places heap entry 'item' at index 'n'. */
+#define HEAP_SET(store, n, item) \
+    do { (store)->heap[(n)] = (item); (item)->heappos = (n) + 1; } while (0)
+
+/* Moves the heap entry at index 'n' up or down to restore the heap
+ * ordering. */
+static void heap_fix(ne_lock_store *store, unsigned int n)
+{
+    struct lock_list *item = store->heap[n];
+
+    while (n > 0 && store->heap[(n - 1) / 2]->deadline > item->deadline) {
+        HEAP_SET(store, n, store->heap[(n - 1) / 2]);
+        n = (n - 1) / 2;
+    }
+
+    for (;;) {
+        unsigned int child = 2 * n + 1;
+
+        if (child >= store->heapcount) break;
+        if (child + 1 < store->heapcount
+            && store->heap[child + 1]->deadline < store->heap[child]->deadline)
+            child++;
+        if (store->heap[child]->deadline >= item->deadline) break;
+        HEAP_SET(store, n, store->heap[child]);
+        n = child;
+    }
+
+    HEAP_SET(store, n, item);
+}
+
+/* Adds 'item' to the refresh heap, using its current deadline. */
+static void heap_insert(ne_lock_store *store, struct lock_list *item)
+{
+    if (store->heapcount == store->heapalloc) {
+        store->heapalloc = store->heapalloc ? store->heapalloc * 2 : 16;
+        store->heap = ne_realloc(store->heap, 
+                                 store->heapalloc * sizeof *store->heap);
+    }
+
+    HEAP_SET(store, store->heapcount, item);
+    heap_fix(store, store->heapcount++);
+}
+
+/* Schedules 'item' for refresh based on its lock's timeout, from time
+ * 'now'. */
+static void heap_schedule(ne_lock_store *store, struct lock_list *item,
+                          time_t now)
+{
+    if (item->lock->timeout > 0) {
+        item->deadline = now + item->lock->timeout;
+        heap_insert(store, item);
+    }
+}
+
+/* Removes 'item' from the refresh heap, if present. */
+static void heap_remove(ne_lock_store *store, struct lock_list *item)
+{
+    unsigned int n = item->heappos;
+
+    if (n == 0) return;
+    
+    item->heappos = 0;
+    if (--n != --store->heapcount) {
+        HEAP_SET(store, n, store->heap[store->heapcount]);
+        heap_fix(store, n);
+    }
+}
+
+long ne_lockstore_next_refresh(ne_lock_store *store, long margin)
+{
+    time_t now;
+
+    if (store->heapcount == 0)
+        return -1;
+
+    now = time(NULL);
+    if (store->heap[0]->deadline - margin <= now)
+        return 0;
+    else
+        return (long)(store->heap[0]->deadline - margin - now);
+}
+
+int ne_lockstore_refresh(ne_lock_store *store, ne_session *sess, 
+                         long margin, ne_lock_refresh_failed failed,
+                         void *userdata)
+{
+    struct lock_list **due;
+    unsigned int n, count = 0;
+    time_t now = time(NULL);
+    ne_uri u = {0};
+    int success = 0;
+
+    /* Take all the due locks off the heap, so that a refresh which
+     * extends the deadline cannot be revisited in this pass. */
+    due = ne_malloc((store->heapcount + 1) * sizeof *due);
+    while (store->heapcount > 0 && store->heap[0]->deadline - margin <= now) {
+        due[count++] = store->heap[0];
+        heap_remove(store, store->heap[0]);
+    }
+
+    ne_fill_server_uri(sess, &u);
+
+    for (n = 0; n < count; n++) {
+        struct lock_list *item = due[n];
+        int ret;
+
+        u.path = item->lock->uri.path;
+        if (ne_uri_cmp(&u, &item->lock->uri)) {
+            /* Lock for another server; reschedule unchanged. */
+            heap_insert(store, item);
+            continue;
+        }
+
+        NE_DEBUG(NE_DBG_LOCKS, "Refreshing lock %s on %s\n",
+                 item->lock->token, item->lock->uri.path);
+        
+        ret = ne_lock_refresh(sess, item->lock);
+        if (ret == NE_OK) {
+            success++;
+            heap_schedule(store, item, time(NULL));
+        }
+        else if (failed) {
+            failed(userdata, item->lock, ret);
+        }
+    }
+
+    u.path = NULL;
+    ne_uri_free(&u);
+    ne_free(due);
+
+    return success;
 }
 
 void ne_lockstore_add(ne_lock_store *store, struct ne_lock *lock)
 {
-    insert_lock(&store->locks, lock);
+    struct lock_list *item = insert_lock(&store->locks, lock);
+    struct lock_server *srv = find_server(store, &lock->uri);
+    struct lock_node *node;
+    const char *seg;
+    size_t len;
+
+    if (srv == NULL) {
+        srv = ne_calloc(sizeof *srv);
+        srv->scheme = ne_strdup(lock->uri.scheme ? lock->uri.scheme : "");
+        srv->host = ne_strdup(lock->uri.host ? lock->uri.host : "");
+        srv->port = lock->uri.port ? lock->uri.port
+            : ne_uri_defaultport(srv->scheme);
+        srv->next = store->servers;
+        store->servers = srv;
+    }
+
+    node = &srv->root;
+    for (seg = next_segment(lock->uri.path, &len); seg;
+         seg = next_segment(seg + len, &len)) {
+        node = make_child(store, node, seg, len);
+    }
+
+    item->node = node;
+    item->nnext = node->locks;
+    if (node->locks) node->locks->nprev = item;
+    node->locks = item;
+
+    heap_schedule(store, item, time(NULL));
 }
 
 void ne_lockstore_remove(ne_lock_store *store, struct ne_lock *lock)
 {
-    struct lock_list *item;
-
-    /* Find the lock */
-    for (item = store->locks; item != NULL; item = item->next)
-	if (item->lock == lock)
-	    break;
+    struct lock_server *srv = find_server(store, &lock->uri);
+    struct lock_node *node = srv ? find_node(store, srv, lock->uri.path) : NULL;
+    struct lock_list *item = NULL;
+
+    /* Find the lock; fall back on a search of the whole store in
+     * case the lock's URI has been modified since it was added. */
+    if (node) {
+        for (item = node->locks; item != NULL; item = item->nnext)
+            if (item->lock == lock)
+                break;
+    }
+    if (item == NULL) {
+        for (item = store->locks; item != NULL; item = item->next)
+            if (item->lock == lock)
+                break;
+    }
     
     if (item->prev != NULL) {
 	item->prev->next = item->next;
@@ -341,6 +787,20 @@ void ne_lockstore_remove(ne_lock_store *store, struct ne_lock *lock)
     if (item->next != NULL) {
 	item->next->prev = item->prev;
     }
+
+    heap_remove(store, item);
+
+    node = item->node;
+    if (item->nprev != NULL) {
+        item->nprev->nnext = item->nnext;
+    } else {
+        node->locks = item->nnext;
+    }
+    if (item->nnext != NULL) {
+        item->nnext->nprev = item->nprev;
+    }
+    prune_node(store, node);
+
     ne_free(item);
 }
 
@@ -526,8 +986,7 @@ static int ld_startelm(void *userdata, int parent,
 		       const char **atts)
 {
     struct discover_ctx *ctx = userdata;
-    int id = ne_xml_mapid(element_map, NE_XML_MAPLEN(element_map),
-                          nspace, name);
+    int id = ne_xml_idtable_lookup(ctx->ids, nspace, name);
     
     ne_buffer_clear(ctx->cdata);
     
@@ -568,7 +1027,7 @@ static int lk_startelm(void *userdata, int parent,
     struct lock_ctx *ctx = userdata;
     int id;
 
-    id = ne_xml_mapid(element_map, NE_XML_MAPLEN(element_map), nspace, name);
+    id = ne_xml_idtable_lookup(ctx->ids, nspace, name);
 
     NE_DEBUG(NE_DBG_LOCKS, "lk_startelm: %s => %d\n", name, id);
     
@@ -658,17 +1117,20 @@ int ne_lock_discover(ne_session *sess, const char *uri,
     ctx.results = callback;
     ctx.userdata = userdata;
     ctx.cdata = ne_buffer_create();
+    ctx.ids = ne_xml_idtable_create(element_map, NE_XML_MAPLEN(element_map));
     ctx.phandler = handler = ne_propfind_create(sess, uri, NE_DEPTH_ZERO);
 
     ne_propfind_set_private(handler, ld_create, ld_destroy, &ctx);
     
     ne_xml_push_handler(ne_propfind_get_parser(handler), 
                         ld_startelm, ld_cdata, end_element_ldisc, &ctx);
+    ne_xml_handler_accepts(ne_propfind_get_parser(handler), ctx.ids);
     
     ret = ne_propfind_named(handler, lock_props, discover_results, &ctx);
     
     ne_buffer_destroy(ctx.cdata);
     ne_propfind_destroy(handler);
+    ne_xml_idtable_destroy(ctx.ids);
 
     return ret;
 }
@@ -700,7 +1162,10 @@ int ne_lock(ne_session *sess, struct ne_lock *lock)
     /* LOCK is not idempotent. */
     ne_set_request_flag(req, NE_REQFLAG_IDEMPOTENT, 0);
 
+    ctx.ids = ne_xml_idtable_create(element_map, NE_XML_MAPLEN(element_map));
     ne_xml_push_handler(parser, lk_startelm, lk_cdata, lk_endelm, &ctx);
+    ne_xml_handler_accepts(parser, ctx.ids);
+    ne_xml_coalesce_cdata(parser, MAX_CDATA);
     
     /* Create the body */
     ne_buffer_concat(body, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
@@ -767,6 +1232,7 @@ int ne_lock(ne_session *sess, struct ne_lock *lock)
     if (ctx.token) ne_free(ctx.token);
     ne_request_destroy(req);
     ne_xml_destroy(parser);
+    ne_xml_idtable_destroy(ctx.ids);
 
     return ret;
 }
@@ -785,7 +1251,10 @@ int ne_lock_refresh(ne_session *sess, struct ne_lock *lock)
     ctx.parser = parser;
 
     /* Handle the response and update *lock appropriately. */
+    ctx.ids = ne_xml_idtable_create(element_map, NE_XML_MAPLEN(element_map));
     ne_xml_push_handler(parser, lk_startelm, lk_cdata, lk_endelm, &ctx);
+    ne_xml_handler_accepts(parser, ctx.ids);
+    ne_xml_coalesce_cdata(parser, MAX_CDATA);
     
     /* For a lock refresh, submitting only this lock token must be
      * sufficient. */
@@ -811,6 +1280,7 @@ int ne_lock_refresh(ne_session *sess, struct ne_lock *lock)
     ne_buffer_destroy(ctx.cdata);
     ne_request_destroy(req);
     ne_xml_destroy(parser);
+    ne_xml_idtable_destroy(ctx.ids);
 
     return ret;
 }
@@ -117,6 +117,30 @@ struct ne_lock *ne_lockstore_next(ne_lock_store *store);
 struct ne_lock *ne_lockstore_findbyuri(ne_lock_store *store, 
 				       const ne_uri *uri);
 
+/* Callback invoked by ne_lockstore_refresh when refreshing 'lock'
+ * fails; 'result' is the NE_* return value of ne_lock_refresh, and
+ * the session error string describes the failure.  The lock is no
+ * longer scheduled for refresh; the callback may remove 'lock' from
+ * the store (but no other lock). */
+typedef void (*ne_lock_refresh_failed)(void *userdata, struct ne_lock *lock,
+                                       int result);
+
+/* Refresh each lock in the store for the server of session 'sess'
+ * which will expire within 'margin' seconds, in order of expiry,
+ * using ne_lock_refresh.  A lock's expiry is tracked from the time it
+ * is added to the store or last refreshed, using its timeout; locks
+ * with an infinite or unknown timeout are never refreshed.  'failed'
+ * (if non-NULL) is called for each refresh which fails.  Returns the
+ * number of locks refreshed successfully. */
+int ne_lockstore_refresh(ne_lock_store *store, ne_session *sess, 
+                         long margin, ne_lock_refresh_failed failed,
+                         void *userdata);
+
+/* Returns the number of seconds until ne_lockstore_refresh should
+ * next be called with the given 'margin' (zero if a refresh is already
+ * due), or -1 if no lock in the store needs refreshing. */
+long ne_lockstore_next_refresh(ne_lock_store *store, long margin);
+
 /* Issue a LOCK request for the given lock.  Requires that the uri,
  * depth, type, scope, and timeout members of 'lock' are filled in.
  * owner and token must be malloc-allocated if not NULL; and may be
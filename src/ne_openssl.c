@@ -36,7 +36,14 @@
 #include <openssl/rand.h>
 #include <openssl/opensslv.h>
 
-#ifdef NE_HAVE_TS_SSL
+/* OpenSSL 1.1.0 and later do their own locking using native thread
+ * primitives, and ignore the locking callbacks; they are only
+ * needed for older releases. */
+#if defined(NE_HAVE_TS_SSL) && OPENSSL_VERSION_NUMBER < 0x10100000L
+#define NE_SSL_LOCK_CALLBACKS
+#endif
+
+#ifdef NE_SSL_LOCK_CALLBACKS
 #include <stdlib.h> /* for abort() */
 #include <pthread.h>
 #endif
@@ -57,6 +64,13 @@
 #define OBJ_cmp(a,b) OBJ_cmp((ASN1_OBJECT *)(a), (ASN1_OBJECT *)(b))
 #endif
 
+/* Reference count functions were added in 1.1.0, when the structures
+ * became opaque. */
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define X509_up_ref(x) CRYPTO_add(&(x)->references, 1, CRYPTO_LOCK_X509)
+#define EVP_PKEY_up_ref(k) CRYPTO_add(&(k)->references, 1, CRYPTO_LOCK_EVP_PKEY)
+#endif
+
 /* Second argument for d2i_X509() changed type in 0.9.8. */
 #if OPENSSL_VERSION_NUMBER < 0x0090800fL
 typedef unsigned char ne_d2i_uchar;
@@ -149,15 +163,16 @@ char *ne_ssl_readable_dname(const ne_ssl_dname *name)
 
     for (n = X509_NAME_entry_count(name->dn); n > 0; n--) {
 	X509_NAME_ENTRY *ent = X509_NAME_get_entry(name->dn, n-1);
-	
+	const ASN1_OBJECT *obj = X509_NAME_ENTRY_get_object(ent);
+
         /* Skip commonName or emailAddress except if there is no other
          * attribute in dname. */
-	if ((OBJ_cmp(ent->object, cname) && OBJ_cmp(ent->object, email)) ||
+	if ((OBJ_cmp(obj, cname) && OBJ_cmp(obj, email)) ||
             (!flag && n == 1)) {
  	    if (flag++)
 		ne_buffer_append(dump, ", ", 2);
 
-            if (append_dirstring(dump, ent->value))
+            if (append_dirstring(dump, X509_NAME_ENTRY_get_data(ent)))
                 ne_buffer_czappend(dump, "???");
 	}
     }
@@ -458,6 +473,15 @@ static int check_certificate(ne_session *sess, SSL *ssl, ne_ssl_certificate *cha
         return NE_ERROR;
     }
 
+    /* The verify callback is not invoked when a session is resumed,
+     * but the session retains the result of verifying the chain when
+     * it was negotiated.  The individual errors are lost, so treat
+     * any failure as untrusted. */
+    if (SSL_session_reused(ssl) && SSL_get_verify_result(ssl) != X509_V_OK) {
+        NE_DEBUG(NE_DBG_SSL, "ssl: Resumed session failed verification.\n");
+        failures |= NE_SSL_UNTRUSTED;
+    }
+
     /* Check certificate was issued to this server; pass URI of
      * server. */
     memset(&server, 0, sizeof server);
@@ -473,6 +497,7 @@ static int check_certificate(ne_session *sess, SSL *ssl, ne_ssl_certificate *cha
     if (failures == 0) {
         /* verified OK! */
         ret = NE_OK;
+        ne__ssl_cache_verify_store(sess, chain);
     } else {
         /* Set up the error string. */
         ne__ssl_set_verify_err(sess, failures);
@@ -498,8 +523,8 @@ static ne_ssl_client_cert *dup_client_cert(const ne_ssl_client_cert *cc)
 
     populate_cert(&newcc->cert, cc->cert.subject);
 
-    cc->cert.subject->references++;
-    cc->pkey->references++;
+    X509_up_ref(cc->cert.subject);
+    EVP_PKEY_up_ref(cc->pkey);
     return newcc;
 }
 
@@ -537,8 +562,8 @@ static int provide_client_cert(SSL *ssl, X509 **cert, EVP_PKEY **pkey)
     if (sess->client_cert) {
         ne_ssl_client_cert *const cc = sess->client_cert;
 	NE_DEBUG(NE_DBG_SSL, "Supplying client certificate.\n");
-	cc->pkey->references++;
-	cc->cert.subject->references++;
+	EVP_PKEY_up_ref(cc->pkey);
+	X509_up_ref(cc->cert.subject);
 	*cert = cc->cert.subject;
 	*pkey = cc->pkey;
 	return 1;
@@ -549,6 +574,29 @@ static int provide_client_cert(SSL *ssl, X509 **cert, EVP_PKEY **pkey)
     }
 }
 
+/* Callback invoked when a new client session is established; for
+ * TLS 1.3 this happens when a session ticket arrives, possibly after
+ * the handshake completes. */
+static int new_session(SSL *ssl, SSL_SESSION *sslsess)
+{
+    ne_session *const sess = SSL_get_app_data(ssl);
+    unsigned char *data, *p;
+    int len;
+
+    if (sess == NULL || sess->ssl_scache == NULL) return 0;
+
+    len = i2d_SSL_SESSION(sslsess, NULL);
+    if (len <= 0) return 0;
+
+    p = data = ne_malloc(len);
+    if (i2d_SSL_SESSION(sslsess, &p) == len) {
+        ne__ssl_cache_store(sess, data, len);
+    }
+    ne_free(data);
+
+    return 0; /* no reference to the session is kept */
+}
+
 void ne_ssl_set_clicert(ne_session *sess, const ne_ssl_client_cert *cc)
 {
     sess->client_cert = dup_client_cert(cc);
@@ -565,11 +613,25 @@ ne_ssl_context *ne_ssl_context_create(int mode)
         /* enable workarounds for buggy SSL server implementations */
         SSL_CTX_set_options(ctx->ctx, SSL_OP_ALL);
         SSL_CTX_set_verify(ctx->ctx, SSL_VERIFY_PEER, verify_callback);
+        /* pass new sessions to any shared session cache. */
+        SSL_CTX_set_session_cache_mode(ctx->ctx, SSL_SESS_CACHE_CLIENT
+                                       | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx->ctx, new_session);
     } else if (mode == NE_SSL_CTX_SERVER) {
         ctx->ctx = SSL_CTX_new(SSLv23_server_method());
         SSL_CTX_set_session_cache_mode(ctx->ctx, SSL_SESS_CACHE_CLIENT);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+        /* Treat EOF from the client as a close, as before 3.0,
+         * rather than sending it a fatal alert. */
+        SSL_CTX_set_options(ctx->ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
     } else {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L && !defined(OPENSSL_NO_SSL2)
         ctx->ctx = SSL_CTX_new(SSLv2_server_method());
+#else
+        /* SSLv2 is not available in this OpenSSL build. */
+        ctx->ctx = SSL_CTX_new(SSLv23_server_method());
+#endif
         SSL_CTX_set_session_cache_mode(ctx->ctx, SSL_SESS_CACHE_CLIENT);
     }
     return ctx;
@@ -642,8 +704,11 @@ void ne_ssl_context_destroy(ne_ssl_context *ctx)
  * sufficient. */
 static int SSL_SESSION_cmp(SSL_SESSION *a, SSL_SESSION *b)
 {
-    return a->session_id_length == b->session_id_length
-        && memcmp(a->session_id, b->session_id, a->session_id_length) == 0;
+    unsigned int alen, blen;
+    const unsigned char *aid = SSL_SESSION_get_id(a, &alen),
+        *bid = SSL_SESSION_get_id(b, &blen);
+
+    return alen == blen && memcmp(aid, bid, alen) == 0;
 }
 #endif
 
@@ -654,6 +719,7 @@ int ne__negotiate_ssl(ne_session *sess)
     SSL *ssl;
     STACK_OF(X509) *chain;
     int freechain = 0; /* non-zero if chain should be free'd. */
+    int ret;
 
     NE_DEBUG(NE_DBG_SSL, "Doing SSL negotiation.\n");
     
@@ -664,7 +730,35 @@ int ne__negotiate_ssl(ne_session *sess)
     sess->ssl_cc_requested = 0;
     ctx->failures = 0;
 
-    if (ne_sock_connect_ssl(sess->socket, ctx, sess)) {
+    if (sess->ssl_scache) {
+        /* Use the shared cache in preference to the context's
+         * session. */
+        size_t len;
+        unsigned char *data = ne__ssl_cache_fetch(sess, &len);
+
+        if (ctx->sess) {
+            SSL_SESSION_free(ctx->sess);
+            ctx->sess = NULL;
+        }
+
+        if (data) {
+            const unsigned char *p = data;
+            ctx->sess = d2i_SSL_SESSION(NULL, &p, len);
+            ne_free(data);
+        }
+    }
+
+    if (sess->early_data) {
+        ctx->early_data = sess->early_data->data;
+        ctx->early_len = ne_buffer_size(sess->early_data);
+    }
+
+    ret = ne_sock_connect_ssl(sess->socket, ctx, sess);
+    ctx->early_data = NULL;
+    sess->early_accepted = ctx->early_accepted;
+
+    if (ret) {
+        ne__ssl_cache_remove(sess);
 	if (ctx->sess) {
 	    /* remove cached session. */
 	    SSL_SESSION_free(ctx->sess);
@@ -684,6 +778,11 @@ int ne__negotiate_ssl(ne_session *sess)
     
     ssl = ne__sock_sslsock(sess->socket);
 
+    NE_STAT_ADD(sess, ssl_handshakes, 1);
+    if (SSL_session_reused(ssl)) {
+        NE_STAT_ADD(sess, ssl_resumed, 1);
+    }
+
     chain = SSL_get_peer_cert_chain(ssl);
     /* For an SSLv2 connection, the cert chain will always be NULL. */
     if (chain == NULL) {
@@ -717,17 +816,25 @@ int ne__negotiate_ssl(ne_session *sess)
 
         if (freechain) sk_X509_free(chain); /* no longer need the chain */
 
-	if (check_certificate(sess, ssl, cert)) {
+	if (ne__ssl_cache_verified(sess, cert)) {
+            NE_DEBUG(NE_DBG_SSL, "SSL certificate chain already verified.\n");
+        }
+        else if (check_certificate(sess, ssl, cert)) {
 	    NE_DEBUG(NE_DBG_SSL, "SSL certificate checks failed: %s\n",
 		     sess->error);
 	    ne_ssl_cert_free(cert);
+            ne__ssl_cache_remove(sess);
 	    return NE_ERROR;
 	}
 	/* remember the chain. */
         sess->server_cert = cert;
     }
     
-    if (ctx->sess) {
+    if (sess->ssl_scache) {
+        /* New sessions are stored by the new_session callback. */
+        ne__ssl_cache_result(sess, SSL_session_reused(ssl));
+    }
+    else if (ctx->sess) {
         SSL_SESSION *newsess = SSL_get0_session(ssl);
         /* Replace the session if it has changed. */ 
         if (newsess != ctx->sess || SSL_SESSION_cmp(ctx->sess, newsess)) {
@@ -778,6 +885,8 @@ void ne_ssl_trust_default_ca(ne_session *sess)
 #else
     X509_STORE_set_default_paths(store);
 #endif
+
+    ne__ssl_trust_update(sess, "default-ca", "", 0);
 }
 
 /* Find a friendly name in a PKCS12 structure the hard way, without
@@ -1079,7 +1188,7 @@ int ne_ssl_cert_digest(const ne_ssl_certificate *cert, char *digest)
     return 0;
 }
 
-#ifdef NE_HAVE_TS_SSL
+#ifdef NE_SSL_LOCK_CALLBACKS
 /* Implementation of locking callbacks to make OpenSSL thread-safe.
  * If the OpenSSL API was better designed, this wouldn't be necessary.
  * In OpenSSL releases without CRYPTO_set_idptr_callback, it's not
@@ -1117,8 +1226,6 @@ static void thread_lock_neon(int mode, int n, const char *file, int line)
     }
 }
 
-#endif
-
 /* ID_CALLBACK_IS_{NEON,OTHER} evaluate as true if the currently
  * registered OpenSSL ID callback is the neon function (_NEON), or has
  * been overwritten by some other app (_OTHER). */
@@ -1130,14 +1237,26 @@ static void thread_lock_neon(int mode, int n, const char *file, int line)
 #define ID_CALLBACK_IS_NEON (CRYPTO_get_id_callback() == thread_id_neon)
 #endif
 
+#endif /* NE_SSL_LOCK_CALLBACKS */
+
 int ne__ssl_init(void)
 {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    /* Initialization is thread-safe, and the library cleans up
+     * automatically at exit. */
+    if (OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS
+                         | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, NULL) != 1) {
+        NE_DEBUG(NE_DBG_SOCKET, "ssl: OpenSSL initialization failed.\n");
+        return -1;
+    }
+#else
     CRYPTO_malloc_init();
     SSL_load_error_strings();
     SSL_library_init();
     OpenSSL_add_all_algorithms();
+#endif
 
-#ifdef NE_HAVE_TS_SSL
+#ifdef NE_SSL_LOCK_CALLBACKS
     /* If some other library has already come along and set up the
      * thread-safety callbacks, then it must be presumed that the
      * other library will have a longer lifetime in the process than
@@ -1179,7 +1298,7 @@ void ne__ssl_exit(void)
     /* Cannot call ERR_free_strings() etc here in case any other code
      * in the process using OpenSSL. */
 
-#ifdef NE_HAVE_TS_SSL
+#ifdef NE_SSL_LOCK_CALLBACKS
     /* Only unregister the callbacks if some *other* library has not
      * come along in the mean-time and trampled over the callbacks
      * installed by neon. */
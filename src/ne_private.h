@@ -25,9 +25,12 @@
 #ifndef NE_PRIVATE_H
 #define NE_PRIVATE_H
 
+#include <stddef.h>
+
 #include "ne_request.h"
 #include "ne_socket.h"
 #include "ne_ssl.h"
+#include "ne_hash.h"
 
 struct host_info {
     /* Type of host represented: */
@@ -93,6 +96,9 @@ struct ne_session_s {
     /* Settings */
     int use_ssl; /* whether a secure connection is required */
     int in_connect; /* doing a proxy CONNECT */
+    ne_request *timing_req; /* request timing connection setup */
+    const ne_buffer *early_data; /* request to send as TLS early data */
+    int early_accepted; /* non-zero if early data was accepted */
     int any_proxy_http; /* whether any configured proxy is an HTTP proxy */
     
     enum ne_sock_sversion socks_ver;
@@ -121,6 +127,9 @@ struct ne_session_s {
     int ssl_cc_requested; /* set to non-zero if a client cert was
                            * requested during initial handshake, but
                            * none could be provided. */
+    ne_ssl_session_cache *ssl_scache; /* shared session cache, or NULL */
+    /* Hash identifying the trust configuration of the session. */
+    char ssl_trust[NE_HASH_MAXHEX + 1];
 #endif
 
     /* Server cert verification callback: */
@@ -132,10 +141,30 @@ struct ne_session_s {
 
     ne_session_status_info status;
 
+    ne_session_stats stats;
+
     /* Error string */
     char error[512];
 };
 
+/* Add 'n' to the process-wide statistics counter, or byte count,
+ * at offset 'offset' within ne_session_stats. */
+NE_PRIVATE void ne__stat_count(size_t offset, unsigned long n);
+NE_PRIVATE void ne__stat_bytes(size_t offset, ne_off_t n);
+
+/* Add 'n' to the statistics counter 'field' of session 'sess' and of
+ * the process. */
+#define NE_STAT_ADD(sess, field, n) do { \
+    (sess)->stats.field += (n); \
+    ne__stat_count(offsetof(ne_session_stats, field), (n)); \
+} while (0)
+
+/* As NE_STAT_ADD, for the byte count 'field'. */
+#define NE_STAT_BYTES(sess, field, n) do { \
+    (sess)->stats.field += (n); \
+    ne__stat_bytes(offsetof(ne_session_stats, field), (n)); \
+} while (0)
+
 /* Pushes block of 'count' bytes at 'buf'. Returns non-zero on
  * error. */
 typedef int (*ne_push_fn)(void *userdata, const char *buf, size_t count);
@@ -146,6 +175,44 @@ NE_PRIVATE int ne__negotiate_ssl(ne_session *sess);
 /* Set the session error appropriate for SSL verification failures. */
 NE_PRIVATE void ne__ssl_set_verify_err(ne_session *sess, int failures);
 
+/* Shared SSL session cache interface used by the SSL backends, which
+ * store sessions in serialized form.  Each function has no effect if
+ * the session has no shared cache. */
+
+/* Returns a copy of the serialized SSL session cached for the
+ * session's server, setting *len to its length; or NULL if none is
+ * cached. */
+NE_PRIVATE unsigned char *ne__ssl_cache_fetch(ne_session *sess, size_t *len);
+
+/* Store 'len' bytes of serialized SSL session 'data' for the
+ * session's server, replacing any existing entry. */
+NE_PRIVATE void ne__ssl_cache_store(ne_session *sess,
+                                    const unsigned char *data, size_t len);
+
+/* Remove any cached SSL session for the session's server. */
+NE_PRIVATE void ne__ssl_cache_remove(ne_session *sess);
+
+/* Record the result of a handshake: 'resumed' is non-zero if a cached
+ * session was resumed. */
+NE_PRIVATE void ne__ssl_cache_result(ne_session *sess, int resumed);
+
+/* Update the hash identifying the session's trust configuration with
+ * 'len' bytes of 'data' labelled 'what'. */
+NE_PRIVATE void ne__ssl_trust_update(ne_session *sess, const char *what,
+                                     const void *data, size_t len);
+
+/* Returns non-zero if the certificate chain presented by the
+ * session's server was previously verified by a session with the
+ * same trust configuration, and has not since expired. */
+NE_PRIVATE int ne__ssl_cache_verified(ne_session *sess,
+                                      const ne_ssl_certificate *chain);
+
+/* Record that the certificate chain presented by the session's server
+ * was verified successfully, without recourse to the verification
+ * callback. */
+NE_PRIVATE void ne__ssl_cache_verify_store(ne_session *sess,
+                                           const ne_ssl_certificate *chain);
+
 /* Return non-zero if hostname from certificate (cn) matches hostname
  * used for session (hostname); follows RFC2818 logic. */
 NE_PRIVATE int ne__ssl_match_hostname(const char *cn, size_t cnlen, 
@@ -41,6 +41,10 @@ struct ne_ssl_context_s {
     SSL_SESSION *sess;
     const char *hostname; /* for SNI */
     int failures; /* bitmask of exposed failure bits. */
+    /* Data to send as TLS early data, and whether it was accepted. */
+    const char *early_data;
+    size_t early_len;
+    int early_accepted;
 };
 
 typedef SSL *ne_ssl_socket;
@@ -35,7 +35,7 @@
 #include "ne_locks.h"
 #include "ne_internal.h"
 
-/* don't store flat props with a value > 10K */
+/* by default, don't store flat props with a value > 100K */
 #define MAX_FLATPROP_LEN (102400)
 
 struct ne_propfind_handler_s {
@@ -59,12 +59,45 @@ struct ne_propfind_handler_s {
 
     ne_buffer *value; /* current flat property value */
     int depth; /* nesting depth within a flat property */
+    size_t maxvalue; /* maximum length of a flat property value */
 
     ne_props_result callback;
     void *userdata;
+
+    /* For a sync-collection REPORT: non-zero if removed members are
+     * reported to the callback, non-zero if the server truncated the
+     * set of changes, and the sync-token received. */
+    int report_removed;
+    int truncated;
+    ne_buffer *sync_token;
+
+    /* Result sets which have been cleared and can be reused. */
+    ne_prop_result_set *spare;
+
+    /* Result cache in use, if any; the request path and depth used
+     * to build the cache key; and the cache entry being filled from
+     * the response. */
+    ne_propfind_cache *cache;
+    char *path;
+    int reqdepth;
+    struct pfcache_entry *recording;
+
+    /* State for the pull interface: */
+    enum {
+        pull_none = 0, /* pull interface not in use */
+        pull_reading, /* reading the response body */
+        pull_done /* response complete */
+    } pull;
+    /* Queue of completed result sets not yet returned by
+     * ne_propfind_next. */
+    ne_prop_result_set *queue, **queue_tail;
+    /* Result set last returned by ne_propfind_next. */
+    ne_prop_result_set *returned;
+    char block[NE_BUFSIZ];
 };
 
 #define ELM_flatprop (NE_207_STATE_TOP - 1)
+#define ELM_synctoken (NE_207_STATE_TOP - 2)
 
 /* We build up the results of one 'response' element in memory. */
 struct prop {
@@ -72,38 +105,63 @@ struct prop {
     /* Store a ne_propname here too, for convienience.  pname.name =
      * name, pname.nspace = nspace, but they are const'ed in pname. */
     ne_propname pname;
+    unsigned int hash; /* hash of {nspace, name} */
+    /* Non-zero for a DAV:resourcetype property including the
+     * DAV:collection element. */
+    unsigned int collection:1;
 };
 
 #define NSPACE(x) ((x) ? (x) : "")
 
+/* An entry in the property index of a results set. */
+struct propref {
+    struct prop *prop;
+    struct propstat *pstat;
+};
+
 struct propstat {
     struct prop *props;
-    int numprops;
+    int numprops, allocprops;
     ne_status status;
 };
 
-/* Results set. */
+/* Results set.  The pstats and props arrays are retained when a set
+ * is cleared, so that the storage can be reused for the next
+ * resource. */
 struct ne_prop_result_set_s {
     struct propstat *pstats;
-    int numpstats, counter;
+    int numpstats, allocpstats, counter;
+    /* Hash index of the properties, built once the set is complete
+     * if it holds at least PROPINDEX_MIN properties; indexmask is
+     * zero if no index is present. */
+    struct propref *index;
+    unsigned int indexmask, allocindex;
     void *private;
     ne_uri uri;
+    ne_prop_result_set *next; /* for the handler's queue/spare lists */
 };
 
 #define MAX_PROP_COUNTER (1024)
 
+#define PROPINDEX_MIN (8)
+
 static int 
 startelm(void *userdata, int state, const char *name, const char *nspace,
 	 const char **atts);
 static int 
 endelm(void *userdata, int state, const char *name, const char *nspace);
+static void recycle_propset(ne_propfind_handler *handler,
+                            ne_prop_result_set *set);
+static void record_propset(ne_propfind_handler *handler,
+                           const ne_prop_result_set *set);
+static int cached_propfind(ne_propfind_handler *handler);
 
 /* Handle character data; flat property value. */
 static int chardata(void *userdata, int state, const char *data, size_t len)
 {
     ne_propfind_handler *hdl = userdata;
 
-    if (state == ELM_flatprop && hdl->value->length < MAX_FLATPROP_LEN)
+    if (state == ELM_flatprop && hdl->value->used < hdl->maxvalue)
         ne_buffer_append(hdl->value, data, len);
 
     return 0;
@@ -119,19 +177,15 @@ ne_request *ne_propfind_get_request(ne_propfind_handler *handler)
     return handler->request;
 }
 
-static int propfind(ne_propfind_handler *handler, 
-		    ne_props_result results, void *userdata)
+/* Prepare the PROPFIND request for dispatch. */
+static void setup_request(ne_propfind_handler *handler)
 {
-    int ret;
     ne_request *req = handler->request;
 
     /* Register the flat property handler to catch any properties 
      * which the user isn't handling as 'complex'. */
     ne_xml_push_handler(handler->parser, startelm, chardata, endelm, handler);
 
-    handler->callback = results;
-    handler->userdata = userdata;
-
     ne_set_request_body_buffer(req, handler->body->data,
 			       ne_buffer_size(handler->body));
 
@@ -139,6 +193,15 @@ static int propfind(ne_propfind_handler *handler,
     
     ne_add_response_body_reader(req, ne_accept_207, ne_xml_parse_v, 
 				  handler->parser);
+}
+
+/* Dispatch the PROPFIND request, passing results to the callback. */
+static int dispatch_propfind(ne_propfind_handler *handler)
+{
+    int ret;
+    ne_request *req = handler->request;
+
+    setup_request(handler);
 
     ret = ne_request_dispatch(req);
 
@@ -152,6 +215,19 @@ static int propfind(ne_propfind_handler *handler,
     return ret;
 }
 
+static int propfind(ne_propfind_handler *handler, 
+		    ne_props_result results, void *userdata)
+{
+    handler->callback = results;
+    handler->userdata = userdata;
+
+    /* Complex properties cannot be replayed from the cache. */
+    if (handler->cache && handler->creator == NULL)
+        return cached_propfind(handler);
+    else
+        return dispatch_propfind(handler);
+}
+
 static void set_body(ne_propfind_handler *hdl, const ne_propname *names)
 {
     ne_buffer *body = hdl->body;
@@ -184,6 +260,112 @@ int ne_propfind_named(ne_propfind_handler *handler, const ne_propname *props,
     return propfind(handler, results, userdata);
 }
 
+void ne_propfind_set_value_limit(ne_propfind_handler *handler, size_t limit)
+{
+    handler->maxvalue = limit;
+}
+
+int ne_propfind_start(ne_propfind_handler *handler, const ne_propname *props)
+{
+    int ret;
+
+    if (props) {
+        set_body(handler, props);
+        ne_buffer_czappend(handler->body, "</prop></propfind>\n");
+    }
+    else {
+        ne_buffer_czappend(handler->body, "<allprop/></propfind>\n");
+    }
+
+    setup_request(handler);
+
+    handler->pull = pull_reading;
+
+    ret = ne_begin_request(handler->request);
+    if (ret != NE_OK) {
+        handler->pull = pull_done;
+    }
+
+    return ret;
+}
+
+int ne_propfind_next(ne_propfind_handler *handler,
+                     const ne_prop_result_set **results)
+{
+    ne_request *req = handler->request;
+
+    *results = NULL;
+
+    /* Recycle the storage of the last set returned. */
+    if (handler->returned) {
+        recycle_propset(handler, handler->returned);
+        handler->returned = NULL;
+    }
+
+    while (handler->queue == NULL && handler->pull == pull_reading) {
+        ssize_t len;
+        int ret;
+
+        len = ne_read_response_block(req, handler->block, 
+                                     sizeof handler->block);
+        if (len < 0) {
+            handler->pull = pull_done;
+            if (ne_xml_failed(handler->parser))
+                ne_set_error(handler->sess, "%s",
+                             ne_xml_get_error(handler->parser));
+            return NE_ERROR;
+        }
+        else if (len > 0) {
+            continue;
+        }
+
+        handler->pull = pull_done;
+
+        ret = ne_end_request(req);
+        if (ret == NE_RETRY) {
+            /* e.g. authentication retry: resend the request and
+             * continue reading the new response. */
+            ret = ne_begin_request(req);
+            if (ret == NE_OK) {
+                handler->pull = pull_reading;
+            }
+        }
+
+        if (ret != NE_OK) {
+            return ret;
+        }
+        else if (handler->pull == pull_done) {
+            if (ne_get_status(req)->klass != 2) {
+                return NE_ERROR;
+            }
+            else if (ne_xml_failed(handler->parser)) {
+                ne_set_error(handler->sess, "%s",
+                             ne_xml_get_error(handler->parser));
+                return NE_ERROR;
+            }
+        }
+    }
+
+    if (handler->queue) {
+        ne_prop_result_set *set = handler->queue;
+
+        handler->queue = set->next;
+        if (handler->queue == NULL)
+            handler->queue_tail = &handler->queue;
+        set->next = NULL;
+
+        handler->returned = set;
+        *results = set;
+    }
+
+    return NE_OK;
+}
+
+const ne_uri *ne_propset_uri(const ne_prop_result_set *set)
+{
+    return &set->uri;
+}
+
 
 /* The easy one... PROPPATCH */
 int ne_proppatch(ne_session *sess, const char *uri, 
@@ -234,6 +416,21 @@ int ne_proppatch(ne_session *sess, const char *uri,
     return ret;
 }
 
+/* Returns a hash of property name {nspace, name}; a NULL namespace
+ * hashes as the empty string. */
+static unsigned int hash_pname(const char *nspace, const char *name)
+{
+    unsigned int h = 0;
+
+    for (nspace = NSPACE(nspace); *nspace; nspace++)
+        h = h * 33 + (unsigned char)*nspace;
+    h = h * 33;
+    while (*name)
+        h = h * 33 + (unsigned char)*name++;
+
+    return h ^ (h >> 16);
+}
+
 /* Compare two property names. */
 static int pnamecmp(const ne_propname *pn1, const ne_propname *pn2)
 {
@@ -258,6 +455,24 @@ static int findprop(const ne_prop_result_set *set, const ne_propname *pname,
     
     int ps, p;
 
+    if (set->indexmask) {
+        unsigned int n = hash_pname(pname->nspace, pname->name);
+        const struct propref *ref;
+
+        for (n &= set->indexmask; (ref = &set->index[n])->prop != NULL;
+             n = (n + 1) & set->indexmask) {
+            if (pnamecmp(&ref->prop->pname, pname) == 0) {
+                if (pstat_ret != NULL)
+                    *pstat_ret = ref->pstat;
+                if (prop_ret != NULL)
+                    *prop_ret = ref->prop;
+                return 0;
+            }
+        }
+
+        return -1;
+    }
+
     for (ps = 0; ps < set->numpstats; ps++) {
 	for (p = 0; p < set->pstats[ps].numprops; p++) {
 	    struct prop *prop = &set->pstats[ps].props[p];
@@ -287,6 +502,26 @@ const char *ne_propset_value(const ne_prop_result_set *set,
     }
 }
 
+int ne_propset_values(const ne_prop_result_set *set,
+                      const ne_propname *pnames, const char **values)
+{
+    int n, found = 0;
+    
+    for (n = 0; pnames[n].name != NULL; n++) {
+        struct prop *prop;
+
+        if (findprop(set, &pnames[n], NULL, &prop) == 0 && prop->value) {
+            values[n] = prop->value;
+            found++;
+        }
+        else {
+            values[n] = NULL;
+        }
+    }
+
+    return found;
+}
+
 const char *ne_propset_lang(const ne_prop_result_set *set,
 			     const ne_propname *pname)
 {
@@ -346,8 +581,17 @@ const ne_status *ne_propset_status(const ne_prop_result_set *set,
 
 static void *start_response(void *userdata, const ne_uri *uri)
 {
-    ne_prop_result_set *set = ne_calloc(sizeof(*set));
     ne_propfind_handler *hdl = userdata;
+    ne_prop_result_set *set;
+
+    if (hdl->spare) {
+        set = hdl->spare;
+        hdl->spare = set->next;
+        set->next = NULL;
+    }
+    else {
+        set = ne_calloc(sizeof(*set));
+    }
 
     ne_uri_copy(&set->uri, uri);
 
@@ -372,12 +616,18 @@ static void *start_propstat(void *userdata, void *response)
         return NULL;
     }
     
-    n = set->numpstats;
-    set->pstats = ne_realloc(set->pstats, sizeof(struct propstat) * (n+1));
-    set->numpstats = n+1;
+    n = set->numpstats++;
+    if (n == set->allocpstats) {
+        set->allocpstats = set->allocpstats ? set->allocpstats * 2 : 2;
+        set->pstats = ne_realloc(set->pstats, 
+                                 sizeof(struct propstat) * set->allocpstats);
+        memset(&set->pstats[n], 0, 
+               sizeof(struct propstat) * (set->allocpstats - n));
+    }
 
     pstat = &set->pstats[n];
-    memset(pstat, 0, sizeof(*pstat));
+    pstat->numprops = 0;
+    memset(&pstat->status, 0, sizeof pstat->status);
     
     /* And return this as the new pstat. */
     return &set->pstats[n];
@@ -399,13 +649,21 @@ static int startelm(void *userdata, int parent,
 
     if (parent == ELM_flatprop) {
         /* collecting the flatprop value. */
+        if (hdl->depth == 0 && strcmp(name, "collection") == 0
+            && strcmp(nspace, "DAV:") == 0) {
+            prop = &pstat->props[pstat->numprops - 1];
+            if (prop->nspace && strcmp(prop->nspace, "DAV:") == 0
+                && strcmp(prop->name, "resourcetype") == 0)
+                prop->collection = 1;
+        }
+
         hdl->depth++;
-        if (hdl->value->used < MAX_FLATPROP_LEN) {
+        if (hdl->value->used < hdl->maxvalue) {
             const char **a = atts;
 
             ne_buffer_concat(hdl->value, "<", nspace, name, NULL);
             
-            while (a[0] && hdl->value->used < MAX_FLATPROP_LEN) {
+            while (a[0] && hdl->value->used < hdl->maxvalue) {
                 const char *nsep = strchr(a[0], ':'), *pfx;
 
                 /* Resolve the attribute namespace prefix, if any.
@@ -437,10 +695,13 @@ static int startelm(void *userdata, int parent,
     }
 
     /* Add a property to this propstat */
-    n = pstat->numprops;
+    n = pstat->numprops++;
 
-    pstat->props = ne_realloc(pstat->props, sizeof(struct prop) * (n + 1));
-    pstat->numprops = n+1;
+    if (n == pstat->allocprops) {
+        pstat->allocprops = pstat->allocprops ? pstat->allocprops * 2 : 4;
+        pstat->props = ne_realloc(pstat->props, 
+                                  sizeof(struct prop) * pstat->allocprops);
+    }
 
     /* Fill in the new property. */
     prop = &pstat->props[n];
@@ -452,6 +713,8 @@ static int startelm(void *userdata, int parent,
 	prop->pname.nspace = prop->nspace = ne_strdup(nspace);
     }
     prop->value = NULL;
+    prop->hash = hash_pname(prop->nspace, prop->name);
+    prop->collection = 0;
 
     NE_DEBUG(NE_DBG_XML, "Got property #%d: {%s}%s.\n", n, 
 	     NSPACE(prop->nspace), prop->name);
@@ -483,7 +746,7 @@ static int endelm(void *userdata, int state,
 
     if (hdl->depth > 0) {
         /* nested. */
-        if (hdl->value->used < MAX_FLATPROP_LEN)
+        if (hdl->value->used < hdl->maxvalue)
             ne_buffer_concat(hdl->value, "</", nspace, name, ">", NULL);
         hdl->depth--;
     } else {
@@ -530,15 +793,18 @@ static void end_propstat(void *userdata, void *pstat_v,
     pstat->status.reason_phrase = ne_strdup(status->reason_phrase);
 }
 
-/* Frees up a results set */
-static void free_propset(ne_propfind_handler *handler,
-                         ne_prop_result_set *set)
+/* Clears the contents of a results set, retaining the allocated
+ * pstats and props arrays for reuse.  'handler' may be NULL for a
+ * set held in the result cache. */
+static void clear_propset(ne_propfind_handler *handler,
+                          ne_prop_result_set *set)
 {
     int n;
     
-    if (handler->destructor && set->private) {
+    if (handler && handler->destructor && set->private) {
         handler->destructor(handler->cd_userdata, set->private);
     }
+    set->private = NULL;
 
     for (n = 0; n < set->numpstats; n++) {
 	int m;
@@ -552,19 +818,99 @@ static void free_propset(ne_propfind_handler *handler,
             p->props[m].nspace = p->props[m].lang = 
                 p->props[m].value = NULL;
 	}
+        p->numprops = 0;
 
 	if (p->status.reason_phrase)
 	    ne_free(p->status.reason_phrase);
-	if (p->props)
-	    ne_free(p->props);
+        p->status.reason_phrase = NULL;
+    }
+
+    set->numpstats = set->counter = 0;
+    set->indexmask = 0;
+    ne_uri_free(&set->uri);
+}
+
+/* Frees up a results set */
+static void free_propset(ne_propfind_handler *handler,
+                         ne_prop_result_set *set)
+{
+    int n;
+
+    clear_propset(handler, set);
+
+    for (n = 0; n < set->allocpstats; n++) {
+        if (set->pstats[n].props)
+            ne_free(set->pstats[n].props);
     }
 
     if (set->pstats)
 	ne_free(set->pstats);
-    ne_uri_free(&set->uri);
+    if (set->index)
+        ne_free(set->index);
     ne_free(set);
 }
 
+/* Clears a results set and places it on the spare list for reuse. */
+static void recycle_propset(ne_propfind_handler *handler,
+                            ne_prop_result_set *set)
+{
+    clear_propset(handler, set);
+    set->next = handler->spare;
+    handler->spare = set;
+}
+
+/* Frees a list of results sets. */
+static void free_propset_list(ne_propfind_handler *handler,
+                              ne_prop_result_set *set)
+{
+    while (set) {
+        ne_prop_result_set *next = set->next;
+        free_propset(handler, set);
+        set = next;
+    }
+}
+
+/* Builds the property index for a completed results set, if it is
+ * large enough to warrant one.  Where a property appears more than
+ * once, the first instance is indexed, as found by a linear search. */
+static void index_propset(ne_prop_result_set *set)
+{
+    unsigned int size = 16;
+    int ps, p;
+
+    if (set->counter < PROPINDEX_MIN) return;
+    
+    /* Keep the table at most half full. */
+    while (size < (unsigned int)set->counter * 2)
+        size <<= 1;
+
+    if (size > set->allocindex) {
+        if (set->index) ne_free(set->index);
+        set->index = ne_malloc(size * sizeof *set->index);
+        set->allocindex = size;
+    }
+    memset(set->index, 0, size * sizeof *set->index);
+    set->indexmask = size - 1;
+
+    for (ps = 0; ps < set->numpstats; ps++) {
+        for (p = 0; p < set->pstats[ps].numprops; p++) {
+            struct prop *prop = &set->pstats[ps].props[p];
+            unsigned int n;
+
+            for (n = prop->hash & set->indexmask; set->index[n].prop;
+                 n = (n + 1) & set->indexmask) {
+                if (pnamecmp(&set->index[n].prop->pname, &prop->pname) == 0)
+                    break;
+            }
+
+            if (set->index[n].prop == NULL) {
+                set->index[n].prop = prop;
+                set->index[n].pstat = &set->pstats[ps];
+            }
+        }
+    }
+}
+
 static void end_response(void *userdata, void *resource,
 			 const ne_status *status,
 			 const char *description)
@@ -572,17 +918,41 @@ static void end_response(void *userdata, void *resource,
     ne_propfind_handler *handler = userdata;
     ne_prop_result_set *set = resource;
 
+    handler->current = NULL;
+
+    index_propset(set);
+
+    if (handler->pull != pull_none && set->numpstats > 0) {
+        /* Queue the results for ne_propfind_next. */
+        *handler->queue_tail = set;
+        handler->queue_tail = &set->next;
+        return;
+    }
+
+    if (handler->recording && set->numpstats > 0)
+        record_propset(handler, set);
+
     /* Pass back the results for this resource. */
     if (handler->callback && set->numpstats > 0)
 	handler->callback(handler->userdata, &set->uri, set);
+    else if (handler->report_removed && status && status->code == 507
+             && ne_path_compare(set->uri.path, handler->path) == 0)
+        /* A 507 for the request-URI marks a truncated set of
+         * changes (RFC 6578, section 3.6). */
+        handler->truncated = 1;
+    else if (handler->callback && handler->report_removed
+             && status && status->code == 404)
+        handler->callback(handler->userdata, &set->uri, NULL);
 
     /* Clean up the propset tree we've just built. */
-    free_propset(handler, set);
-    handler->current = NULL;
+    recycle_propset(handler, set);
 }
 
-ne_propfind_handler *
-ne_propfind_create(ne_session *sess, const char *uri, int depth)
+/* Create a handler for a request with the given method, the response
+ * to which is a multistatus of properties. */
+static ne_propfind_handler *
+create_handler(ne_session *sess, const char *method, const char *uri, 
+               int depth)
 {
     ne_propfind_handler *ret = ne_calloc(sizeof(ne_propfind_handler));
     ne_uri base = {0};
@@ -594,8 +964,12 @@ ne_propfind_create(ne_session *sess, const char *uri, int depth)
     ret->parser207 = ne_207_create(ret->parser, &base, ret);
     ret->sess = sess;
     ret->body = ne_buffer_create();
-    ret->request = ne_request_create(sess, "PROPFIND", uri);
+    ret->request = ne_request_create(sess, method, uri);
     ret->value = ne_buffer_create();
+    ret->maxvalue = MAX_FLATPROP_LEN;
+    ret->queue_tail = &ret->queue;
+    ret->path = ne_strdup(uri);
+    ret->reqdepth = depth;
 
     ne_add_depth_header(ret->request, depth);
 
@@ -605,29 +979,411 @@ ne_propfind_create(ne_session *sess, const char *uri, int depth)
     ne_207_set_propstat_handlers(ret->parser207, start_propstat,
 				  end_propstat);
 
+    ne_uri_free(&base);
+
+    return ret;
+}
+
+ne_propfind_handler *
+ne_propfind_create(ne_session *sess, const char *uri, int depth)
+{
+    ne_propfind_handler *ret = create_handler(sess, "PROPFIND", uri, depth);
+
     /* The start of the request body is fixed: */
     ne_buffer_czappend(ret->body, 
                        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n" 
                        "<propfind xmlns=\"DAV:\">");
 
-    ne_uri_free(&base);
-
     return ret;
 }
 
 /* Destroy a propfind handler */
 void ne_propfind_destroy(ne_propfind_handler *handler)
 {
+    /* If the response body has not been read completely the
+     * connection cannot be reused. */
+    if (handler->pull == pull_reading)
+        ne_close_connection(handler->sess);
+
     ne_buffer_destroy(handler->value);
     if (handler->current)
         free_propset(handler, handler->current);
+    if (handler->returned)
+        free_propset(handler, handler->returned);
+    free_propset_list(handler, handler->queue);
+    free_propset_list(handler, handler->spare);
     ne_207_destroy(handler->parser207);
     ne_xml_destroy(handler->parser);
     ne_buffer_destroy(handler->body);
     ne_request_destroy(handler->request);
+    ne_free(handler->path);
     ne_free(handler);    
 }
 
+/* PROPFIND result cache.  Entries are keyed on the server, request
+ * path, depth and request body, and hold copies of the result sets
+ * along with the validator of the resource at the request path: its
+ * DAV:sync-token if available, or else its ETag. */
+
+#define PFCACHE_HASHSIZE (64)
+
+struct pfcache_entry {
+    char *key;
+    unsigned int hash;
+    char *validator;
+    ne_prop_result_set *sets, **sets_tail;
+    size_t size; /* approximate memory used by the entry */
+    struct pfcache_entry *hnext; /* hash chain */
+    struct pfcache_entry *prev, *next; /* LRU list */
+};
+
+struct ne_propfind_cache_s {
+    struct pfcache_entry *hash[PFCACHE_HASHSIZE];
+    /* LRU list; head is the most recently used entry. */
+    struct pfcache_entry *head, *tail;
+    size_t size, maxsize;
+};
+
+ne_propfind_cache *ne_propfind_cache_create(size_t maxsize)
+{
+    ne_propfind_cache *cache = ne_calloc(sizeof *cache);
+
+    cache->maxsize = maxsize;
+    
+    return cache;
+}
+
+static void free_entry(struct pfcache_entry *entry)
+{
+    free_propset_list(NULL, entry->sets);
+    if (entry->validator) ne_free(entry->validator);
+    ne_free(entry->key);
+    ne_free(entry);
+}
+
+/* Remove an entry from the cache's hash table and LRU list. */
+static void unlink_entry(ne_propfind_cache *cache, struct pfcache_entry *entry)
+{
+    struct pfcache_entry **pe = &cache->hash[entry->hash % PFCACHE_HASHSIZE];
+
+    while (*pe != entry)
+        pe = &(*pe)->hnext;
+    *pe = entry->hnext;
+
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+
+    cache->size -= entry->size;
+}
+
+/* Move an entry to the head of the LRU list. */
+static void touch_entry(ne_propfind_cache *cache, struct pfcache_entry *entry)
+{
+    if (cache->head == entry) return;
+
+    entry->prev->next = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = cache->head;
+    cache->head->prev = entry;
+    cache->head = entry;
+}
+
+/* Insert an entry, evicting least recently used entries as necessary
+ * to keep within the size limit.  An entry which alone exceeds the
+ * limit is not cached. */
+static void insert_entry(ne_propfind_cache *cache, struct pfcache_entry *entry)
+{
+    struct pfcache_entry **bucket = &cache->hash[entry->hash % PFCACHE_HASHSIZE];
+
+    if (entry->size > cache->maxsize) {
+        free_entry(entry);
+        return;
+    }
+
+    while (cache->tail && cache->size + entry->size > cache->maxsize) {
+        struct pfcache_entry *victim = cache->tail;
+
+        NE_DEBUG(NE_DBG_HTTP, "props: Evicting cache entry %s.\n", 
+                 victim->key);
+        unlink_entry(cache, victim);
+        free_entry(victim);
+    }
+
+    entry->hnext = *bucket;
+    *bucket = entry;
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+    cache->head = entry;
+
+    cache->size += entry->size;
+}
+
+static struct pfcache_entry *lookup_entry(ne_propfind_cache *cache,
+                                          const char *key, unsigned int hash)
+{
+    struct pfcache_entry *entry;
+
+    for (entry = cache->hash[hash % PFCACHE_HASHSIZE]; entry;
+         entry = entry->hnext) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0)
+            break;
+    }
+
+    return entry;
+}
+
+void ne_propfind_cache_destroy(ne_propfind_cache *cache)
+{
+    while (cache->head) {
+        struct pfcache_entry *entry = cache->head;
+
+        cache->head = entry->next;
+        free_entry(entry);
+    }
+
+    ne_free(cache);
+}
+
+void ne_propfind_set_cache(ne_propfind_handler *handler, 
+                           ne_propfind_cache *cache)
+{
+    handler->cache = cache;
+}
+
+#define SIZE_STR(s) ((s) ? strlen(s) + 1 : 0)
+
+static char *set_validator(const ne_prop_result_set *set, char kind);
+
+/* Append a copy of the completed results set 'set' to the cache entry
+ * being recorded by 'handler'.  If the entry has no validator yet and
+ * 'set' describes the resource at the request path, take the
+ * validator from 'set'. */
+static void record_propset(ne_propfind_handler *handler,
+                           const ne_prop_result_set *set)
+{
+    struct pfcache_entry *entry = handler->recording;
+    ne_prop_result_set *copy = ne_calloc(sizeof *copy);
+    size_t size = sizeof *copy;
+    int ps, p;
+
+    copy->pstats = ne_calloc(set->numpstats * sizeof *copy->pstats);
+    copy->numpstats = copy->allocpstats = set->numpstats;
+    copy->counter = set->counter;
+    size += set->numpstats * sizeof *copy->pstats;
+
+    for (ps = 0; ps < set->numpstats; ps++) {
+        const struct propstat *from = &set->pstats[ps];
+        struct propstat *to = &copy->pstats[ps];
+
+        to->status = from->status;
+        if (from->status.reason_phrase) {
+            to->status.reason_phrase = ne_strdup(from->status.reason_phrase);
+            size += SIZE_STR(from->status.reason_phrase);
+        }
+
+        to->numprops = to->allocprops = from->numprops;
+        if (from->numprops == 0) continue;
+
+        to->props = ne_malloc(from->numprops * sizeof *to->props);
+        size += from->numprops * sizeof *to->props;
+
+        for (p = 0; p < from->numprops; p++) {
+            const struct prop *fp = &from->props[p];
+            struct prop *tp = &to->props[p];
+
+            tp->pname.name = tp->name = ne_strdup(fp->name);
+            tp->pname.nspace = tp->nspace = 
+                fp->nspace ? ne_strdup(fp->nspace) : NULL;
+            tp->value = fp->value ? ne_strdup(fp->value) : NULL;
+            tp->lang = fp->lang ? ne_strdup(fp->lang) : NULL;
+            tp->hash = fp->hash;
+            tp->collection = fp->collection;
+            size += SIZE_STR(fp->name) + SIZE_STR(fp->nspace)
+                + SIZE_STR(fp->value) + SIZE_STR(fp->lang);
+        }
+    }
+
+    ne_uri_copy(&copy->uri, &set->uri);
+    size += SIZE_STR(set->uri.path);
+    
+    index_propset(copy);
+    size += copy->allocindex * sizeof *copy->index;
+
+    *entry->sets_tail = copy;
+    entry->sets_tail = &copy->next;
+    entry->size += size;
+
+    if (entry->validator == NULL && set->uri.path
+        && ne_path_compare(set->uri.path, handler->path) == 0) {
+        entry->validator = set_validator(set, 0);
+        entry->size += SIZE_STR(entry->validator);
+    }
+}
+
+static const ne_propname validator_props[] = {
+    { "DAV:", "sync-token" },
+    { "DAV:", "getetag" },
+    { NULL }
+};
+
+/* Returns the validator of the resource described by 'set' as a
+ * malloc-allocated string: its sync-token prefixed with "T", or its
+ * ETag prefixed with "E", so the two never compare equal.  If 'kind'
+ * is non-zero, only a validator with that prefix is returned;
+ * otherwise the sync-token is preferred.  Returns NULL if no
+ * validator is available. */
+static char *set_validator(const ne_prop_result_set *set, char kind)
+{
+    const char *values[2], *value;
+    char *copy, *shaved, *ret = NULL;
+
+    if (ne_propset_values(set, validator_props, values) == 0)
+        return NULL;
+
+    if (kind == 'T' || (kind == 0 && values[0])) {
+        value = values[0];
+        kind = 'T';
+    }
+    else {
+        value = values[1];
+        kind = 'E';
+    }
+
+    if (value == NULL)
+        return NULL;
+
+    copy = ne_strdup(value);
+    shaved = ne_shave(copy, " \r\n\t");
+    if (*shaved)
+        ret = ne_concat(kind == 'T' ? "T" : "E", shaved, NULL);
+    ne_free(copy);
+
+    return ret;
+}
+
+struct validator_ctx {
+    char kind;
+    char *validator;
+};
+
+/* Results callback for the validator PROPFIND. */
+static void validator_result(void *userdata, const ne_uri *uri,
+                             const ne_prop_result_set *set)
+{
+    struct validator_ctx *ctx = userdata;
+
+    if (ctx->validator == NULL)
+        ctx->validator = set_validator(set, ctx->kind);
+}
+
+/* Retrieve the validator of kind 'kind' (as for set_validator) for
+ * the resource at the request path of 'handler' with a Depth: 0
+ * PROPFIND.  Returns a malloc-allocated string, or NULL if no
+ * validator was available. */
+static char *fetch_validator(ne_propfind_handler *handler, char kind)
+{
+    ne_propfind_handler *vh;
+    struct validator_ctx ctx;
+
+    ctx.kind = kind;
+    ctx.validator = NULL;
+
+    vh = ne_propfind_create(handler->sess, handler->path, NE_DEPTH_ZERO);
+    if (ne_propfind_named(vh, validator_props, validator_result,
+                          &ctx) != NE_OK && ctx.validator) {
+        ne_free(ctx.validator);
+        ctx.validator = NULL;
+    }
+    ne_propfind_destroy(vh);
+
+    return ctx.validator;
+}
+
+/* Run the PROPFIND for 'handler' using its result cache. */
+static int cached_propfind(ne_propfind_handler *handler)
+{
+    ne_propfind_cache *cache = handler->cache;
+    struct pfcache_entry *entry;
+    ne_buffer *key = ne_buffer_create();
+    unsigned int hash = 0;
+    char *validator;
+    const char *p;
+    ne_uri server = {0};
+    int ret;
+
+    ne_fill_server_uri(handler->sess, &server);
+    ne_buffer_concat(key, server.scheme, "://", server.host, NULL);
+    ne_buffer_snprintf(key, 32, ":%u %d ", server.port, handler->reqdepth);
+    ne_buffer_concat(key, handler->path, "\n", handler->body->data, NULL);
+    ne_uri_free(&server);
+    
+    for (p = key->data; *p; p++)
+        hash = hash * 33 + (unsigned char)*p;
+    
+    /* The resource is only validated if results are cached; on a
+     * miss, the validator is taken from the PROPFIND results. */
+    entry = lookup_entry(cache, key->data, hash);
+    if (entry) {
+        validator = fetch_validator(handler, entry->validator[0]);
+
+        if (validator && strcmp(entry->validator, validator) == 0) {
+            ne_prop_result_set *set;
+
+            NE_DEBUG(NE_DBG_HTTP, "props: Using cached results for %s.\n",
+                     handler->path);
+
+            touch_entry(cache, entry);
+            ne_buffer_destroy(key);
+            ne_free(validator);
+
+            for (set = entry->sets; set; set = set->next)
+                handler->callback(handler->userdata, &set->uri, set);
+
+            return NE_OK;
+        }
+
+        unlink_entry(cache, entry);
+        free_entry(entry);
+    }
+    else {
+        validator = NULL;
+    }
+
+    entry = ne_calloc(sizeof *entry);
+    entry->key = ne_buffer_finish(key);
+    entry->hash = hash;
+    entry->validator = validator;
+    entry->sets_tail = &entry->sets;
+    entry->size = sizeof *entry + strlen(entry->key) + 1
+        + SIZE_STR(validator);
+    handler->recording = entry;
+    
+    ret = dispatch_propfind(handler);
+
+    handler->recording = NULL;
+    if (ret == NE_OK && entry->validator)
+        insert_entry(cache, entry);
+    else
+        free_entry(entry);
+
+    return ret;
+}
+
 int ne_simple_propfind(ne_session *sess, const char *href, int depth,
 			const ne_propname *props,
 			ne_props_result results, void *userdata)
@@ -673,3 +1429,387 @@ void ne_propfind_set_private(ne_propfind_handler *hdl,
     hdl->destructor = destructor;
     hdl->cd_userdata = userdata;
 }
+
+/* Recursive collection walker. */
+
+/* A resource which has been seen, or a collection queued to be
+ * visited. */
+struct walk_entry {
+    char *path; /* path as given; queue entries only */
+    char *key; /* case-folded path without trailing slash */
+    unsigned int hash;
+    struct walk_entry *next;
+};
+
+struct walk_state {
+    struct walk_entry **seen; /* hash table of seen resources */
+    unsigned int seenmask, numseen;
+    struct walk_entry *queue, **queue_tail; /* collections to visit */
+};
+
+static const ne_propname resourcetype_prop = { "DAV:", "resourcetype" };
+
+/* Fills in the key and hash of 'ent' for 'path', following the
+ * semantics of ne_path_compare. */
+static void walk_key(struct walk_entry *ent, const char *path)
+{
+    size_t n, len = strlen(path);
+
+    while (len > 0 && path[len - 1] == '/')
+        len--;
+
+    ent->key = ne_malloc(len + 1);
+    ent->hash = 0;
+    for (n = 0; n < len; n++) {
+        ent->key[n] = ne_tolower(path[n]);
+        ent->hash = ent->hash * 33 + (unsigned char)ent->key[n];
+    }
+    ent->key[len] = '\0';
+}
+
+/* Marks 'path' as seen; returns non-zero if it had already been
+ * seen. */
+static int walk_seen(struct walk_state *ws, const char *path)
+{
+    struct walk_entry *ent = ne_calloc(sizeof *ent), *cur;
+
+    walk_key(ent, path);
+
+    for (cur = ws->seen[ent->hash & ws->seenmask]; cur; cur = cur->next) {
+        if (cur->hash == ent->hash && strcmp(cur->key, ent->key) == 0) {
+            ne_free(ent->key);
+            ne_free(ent);
+            return 1;
+        }
+    }
+
+    if (ws->numseen > ws->seenmask) {
+        /* Double the size of the table, at a load factor of one. */
+        unsigned int n, oldsize = ws->seenmask + 1;
+        struct walk_entry **old = ws->seen;
+
+        ws->seenmask = oldsize * 2 - 1;
+        ws->seen = ne_calloc((ws->seenmask + 1) * sizeof *ws->seen);
+
+        for (n = 0; n < oldsize; n++) {
+            struct walk_entry *next;
+
+            for (cur = old[n]; cur; cur = next) {
+                next = cur->next;
+                cur->next = ws->seen[cur->hash & ws->seenmask];
+                ws->seen[cur->hash & ws->seenmask] = cur;
+            }
+        }
+        ne_free(old);
+    }
+
+    ent->next = ws->seen[ent->hash & ws->seenmask];
+    ws->seen[ent->hash & ws->seenmask] = ent;
+    ws->numseen++;
+
+    return 0;
+}
+
+static void walk_enqueue(struct walk_state *ws, const char *path)
+{
+    struct walk_entry *ent = ne_calloc(sizeof *ent);
+
+    ent->path = ne_strdup(path);
+    walk_key(ent, path);
+    *ws->queue_tail = ent;
+    ws->queue_tail = &ent->next;
+}
+
+static void walk_free_entry(struct walk_entry *ent)
+{
+    if (ent->path) ne_free(ent->path);
+    ne_free(ent->key);
+    ne_free(ent);
+}
+
+/* Returns non-zero if 'set' describes a collection: if its
+ * DAV:resourcetype property includes the DAV:collection element. */
+static int walk_is_collection(const ne_prop_result_set *set)
+{
+    struct prop *prop;
+
+    return findprop(set, &resourcetype_prop, NULL, &prop) == 0
+        && prop->value != NULL && prop->collection;
+}
+
+/* Reads the remaining results from 'hdl', a Depth: 1 PROPFIND of the
+ * collection 'coll'.  Returns NE_*; if the result callback returns
+ * non-zero, stops and sets *aborted to that value. */
+static int walk_drain(struct walk_state *ws, ne_propfind_handler *hdl,
+                      struct walk_entry *coll, 
+                      ne_tree_walk_result result, void *userdata,
+                      int *aborted)
+{
+    const ne_prop_result_set *set;
+    int ret;
+
+    while ((ret = ne_propfind_next(hdl, &set)) == NE_OK && set != NULL) {
+        const ne_uri *uri = ne_propset_uri(set);
+        int collection;
+
+        if (uri->path == NULL || walk_seen(ws, uri->path))
+            continue;
+
+        collection = walk_is_collection(set);
+
+        *aborted = result(userdata, uri, set, collection);
+        if (*aborted)
+            break;
+
+        if (collection) {
+            struct walk_entry ent;
+            
+            /* Don't revisit the collection being listed. */
+            walk_key(&ent, uri->path);
+            if (ent.hash != coll->hash || strcmp(ent.key, coll->key))
+                walk_enqueue(ws, uri->path);
+            ne_free(ent.key);
+        }
+    }
+
+    return ret;
+}
+
+/* Reports the failure of the PROPFIND of collection 'coll' on session
+ * 'sess' to the result callback, returning its return value.  The
+ * session's connection is closed. */
+static int walk_failed(ne_session *sess, struct walk_entry *coll,
+                       ne_tree_walk_result result, void *userdata)
+{
+    ne_uri uri = {0};
+    int ret;
+
+    NE_DEBUG(NE_DBG_HTTP, "walk: Listing %s failed: %s\n", coll->path,
+             ne_get_error(sess));
+
+    /* The response may not have been read in full. */
+    ne_close_connection(sess);
+
+    ne_fill_server_uri(sess, &uri);
+    uri.path = ne_strdup(coll->path);
+    ret = result(userdata, &uri, NULL, 1);
+    ne_uri_free(&uri);
+
+    return ret;
+}
+
+int ne_tree_walk(ne_session *const sessions[], int nworkers,
+                 const char *root, const ne_propname *props,
+                 ne_tree_walk_result result, void *userdata)
+{
+    struct walk_state ws = {0};
+    ne_propfind_handler **hdl = ne_calloc(nworkers * sizeof *hdl);
+    struct walk_entry **coll = ne_calloc(nworkers * sizeof *coll);
+    ne_propname *names = NULL;
+    struct walk_entry *rootent;
+    int n, active = 0, cursor = 0, ret = NE_OK, aborted = 0;
+
+    /* The resourcetype property is needed to find collections. */
+    if (props) {
+        for (n = 0; props[n].name; n++)
+            if (pnamecmp(&props[n], &resourcetype_prop) == 0)
+                break;
+
+        if (props[n].name == NULL) {
+            names = ne_malloc((n + 2) * sizeof *names);
+            memcpy(names, props, n * sizeof *names);
+            names[n] = resourcetype_prop;
+            names[n + 1].nspace = names[n + 1].name = NULL;
+            props = names;
+        }
+    }
+
+    ws.seenmask = 63;
+    ws.seen = ne_calloc((ws.seenmask + 1) * sizeof *ws.seen);
+    ws.queue_tail = &ws.queue;
+    walk_enqueue(&ws, root);
+    rootent = ws.queue;
+
+    for (;;) {
+        /* Start a PROPFIND on each idle worker, whilst collections
+         * remain to be visited.  Each worker has its own connection,
+         * so the responses are produced by the server concurrently
+         * whilst earlier ones are read. */
+        for (n = 0; n < nworkers && ws.queue && ret == NE_OK && !aborted;
+             n++) {
+            if (hdl[n]) continue;
+
+            coll[n] = ws.queue;
+            ws.queue = ws.queue->next;
+            if (ws.queue == NULL) ws.queue_tail = &ws.queue;
+
+            NE_DEBUG(NE_DBG_HTTP, "walk: Listing %s on worker %d.\n", 
+                     coll[n]->path, n);
+            hdl[n] = ne_propfind_create(sessions[n], coll[n]->path, 
+                                        NE_DEPTH_ONE);
+            active++;
+            ret = ne_propfind_start(hdl[n], props);
+
+            /* A failure to list a collection below the root is
+             * reported to the callback, and the walk continues. */
+            if (ret != NE_OK && coll[n] != rootent) {
+                aborted = walk_failed(sessions[n], coll[n], result, userdata);
+                ret = NE_OK;
+                ne_propfind_destroy(hdl[n]);
+                walk_free_entry(coll[n]);
+                hdl[n] = NULL;
+                active--;
+                n--; /* use this worker for the next collection */
+            }
+        }
+
+        if (ret != NE_OK || aborted || active == 0)
+            break;
+
+        /* Read the results from the next active worker in turn. */
+        while (hdl[cursor] == NULL)
+            cursor = (cursor + 1) % nworkers;
+
+        ret = walk_drain(&ws, hdl[cursor], coll[cursor], result, userdata,
+                         &aborted);
+        if (ret != NE_OK && !aborted && coll[cursor] != rootent) {
+            aborted = walk_failed(sessions[cursor], coll[cursor],
+                                  result, userdata);
+            ret = NE_OK;
+        }
+
+        if (coll[cursor] == rootent)
+            rootent = NULL; /* the root has been listed */
+        ne_propfind_destroy(hdl[cursor]);
+        walk_free_entry(coll[cursor]);
+        hdl[cursor] = NULL;
+        active--;
+
+        if (ret != NE_OK || aborted)
+            break;
+
+        cursor = (cursor + 1) % nworkers;
+    }
+
+    for (n = 0; n < nworkers; n++) {
+        if (hdl[n]) {
+            ne_propfind_destroy(hdl[n]);
+            walk_free_entry(coll[n]);
+        }
+    }
+
+    while (ws.queue) {
+        struct walk_entry *next = ws.queue->next;
+        walk_free_entry(ws.queue);
+        ws.queue = next;
+    }
+
+    for (n = 0; (unsigned int)n <= ws.seenmask; n++) {
+        struct walk_entry *ent, *next;
+
+        for (ent = ws.seen[n]; ent; ent = next) {
+            next = ent->next;
+            walk_free_entry(ent);
+        }
+    }
+
+    ne_free(ws.seen);
+    ne_free(hdl);
+    ne_free(coll);
+    if (names) ne_free(names);
+
+    return aborted ? aborted : ret;
+}
+
+/* sync-collection REPORT (RFC 6578) */
+
+static int sync_startelm(void *userdata, int parent,
+                         const char *nspace, const char *name, 
+                         const char **atts)
+{
+    if (parent == NE_207_STATE_PROP || parent == ELM_flatprop
+        || strcmp(nspace, "DAV:") || strcmp(name, "sync-token"))
+        return NE_XML_DECLINE;
+
+    return ELM_synctoken;
+}
+
+static int sync_cdata(void *userdata, int state, const char *cdata, 
+                      size_t len)
+{
+    ne_propfind_handler *hdl = userdata;
+
+    if (hdl->sync_token->used + len < 1024)
+        ne_buffer_append(hdl->sync_token, cdata, len);
+    
+    return 0;
+}
+
+/* Append 'str' to 'buf', escaped for use as XML character data. */
+static void append_escaped(ne_buffer *buf, const char *str)
+{
+    const char *end;
+
+    while ((end = strpbrk(str, "&<>")) != NULL) {
+        ne_buffer_append(buf, str, end - str);
+        ne_buffer_zappend(buf, 
+                          *end == '&' ? "&amp;" : *end == '<' ? "&lt;" : "&gt;");
+        str = end + 1;
+    }
+
+    ne_buffer_zappend(buf, str);
+}
+
+int ne_sync_collection(ne_session *sess, const char *uri, 
+                       const char *sync_token, const ne_propname *props,
+                       ne_props_result result, void *userdata,
+                       char **new_token, int *truncated)
+{
+    ne_propfind_handler *hdl = create_handler(sess, "REPORT", uri, 
+                                              NE_DEPTH_ZERO);
+    int ret;
+
+    *new_token = NULL;
+    *truncated = 0;
+
+    ne_buffer_czappend(hdl->body, 
+                       "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n" 
+                       "<sync-collection xmlns=\"DAV:\"><sync-token>");
+    if (sync_token) append_escaped(hdl->body, sync_token);
+    ne_buffer_czappend(hdl->body, "</sync-token>\n"
+                       "<sync-level>1</sync-level>\n");
+
+    if (props) {
+        set_body(hdl, props);
+        ne_buffer_czappend(hdl->body, "</prop>");
+    }
+    else {
+        ne_buffer_czappend(hdl->body, "<prop/>");
+    }
+    ne_buffer_czappend(hdl->body, "</sync-collection>\n");
+
+    hdl->report_removed = 1;
+    hdl->sync_token = ne_buffer_create();
+    ne_xml_push_handler(hdl->parser, sync_startelm, sync_cdata, NULL, hdl);
+
+    ret = propfind(hdl, result, userdata);
+
+    if (ret == NE_OK) {
+        const char *token = ne_shave(hdl->sync_token->data, " \r\n\t");
+
+        if (token[0] == '\0') {
+            ne_set_error(sess, _("sync-collection response missing "
+                                 "sync-token"));
+            ret = NE_ERROR;
+        }
+        else {
+            *new_token = ne_strdup(token);
+            *truncated = hdl->truncated;
+        }
+    }
+    
+    ne_buffer_destroy(hdl->sync_token);
+    ne_propfind_destroy(hdl);
+
+    return ret;
+}
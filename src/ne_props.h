@@ -65,6 +65,14 @@ typedef struct ne_prop_result_set_s ne_prop_result_set;
 const char *ne_propset_value(const ne_prop_result_set *set,
 			      const ne_propname *propname);
 
+/* Retrieve the values of several properties at once.  'pnames' is an
+ * array of property names terminated by an entry with a NULL name;
+ * 'values' must have an element for each property name, which is set
+ * to the property value as would be returned by ne_propset_value.
+ * Returns the number of non-NULL values retrieved. */
+int ne_propset_values(const ne_prop_result_set *set,
+                      const ne_propname *pnames, const char **values);
+
 /* Returns the status structure for fetching the given property on
  * this resource. This function will return NULL if the server did not
  * return the property (which is a server error). */
@@ -241,9 +249,126 @@ int ne_propfind_named(ne_propfind_handler *handler,
 		      const ne_propname *names,
 		      ne_props_result result, void *userdata);
 
+/* Set the maximum length of a flat property value which will be
+ * stored in a result set; the value of any property which exceeds
+ * this limit is truncated.  The default limit is 100K. */
+void ne_propfind_set_value_limit(ne_propfind_handler *handler, size_t limit);
+
+/* Pull-based alternative to ne_propfind_named/ne_propfind_allprop:
+ * rather than results being passed to a callback, the caller
+ * retrieves each result set in turn using ne_propfind_next, and the
+ * response is parsed incrementally as the results are consumed.
+ *
+ * ne_propfind_start sends the PROPFIND request, for the properties
+ * named in 'names' (terminated by a property with a NULL name field),
+ * or for all properties if 'names' is NULL.  Returns NE_*. */
+int ne_propfind_start(ne_propfind_handler *handler, const ne_propname *names);
+
+/* Retrieve the next result set from a PROPFIND started using
+ * ne_propfind_start.  On success, returns NE_OK and sets *results
+ * to the next result set, or to NULL if there are no more results.
+ * On error, returns an NE_* error code and sets the session error
+ * string.
+ *
+ * The result set is valid only until the next call to
+ * ne_propfind_next or ne_propfind_destroy for this handler; the
+ * storage used for a result set is reused for subsequent results.  */
+int ne_propfind_next(ne_propfind_handler *handler,
+                     const ne_prop_result_set **results);
+
+/* Returns the URI of the resource described by the result set. */
+const ne_uri *ne_propset_uri(const ne_prop_result_set *set);
+
 /* Destroy a propfind handler after use. */
 void ne_propfind_destroy(ne_propfind_handler *handler);
 
+/* A PROPFIND result cache, which can be shared between handlers and
+ * sessions.  Result sets are cached for each combination of server,
+ * path, depth and set of requested properties, but not by the
+ * credentials used: results fetched by one user can be passed to
+ * another whose validator request succeeds, even where a full
+ * PROPFIND would return different results for them.  Sessions
+ * sharing a cache must therefore be authenticating as the same user.
+ * The cache has no locking; it must not be used by handlers in
+ * different threads at the same time. */
+typedef struct ne_propfind_cache_s ne_propfind_cache;
+
+/* Create a result cache using at most (approximately) 'maxsize'
+ * bytes of memory; the least recently used results are discarded to
+ * stay within the limit. */
+ne_propfind_cache *ne_propfind_cache_create(size_t maxsize);
+
+/* Use the result cache 'cache' for the ne_propfind_named or
+ * ne_propfind_allprop call on 'handler'.  Results are stored with a
+ * validator for the resource at the request path: its DAV:sync-token
+ * property, or its DAV:getetag property if no sync-token is given.
+ * If no results are cached, the PROPFIND is sent, and the results are
+ * stored if they include a validator; so an ne_propfind_named
+ * request is only cached if DAV:getetag or DAV:sync-token is among
+ * the requested properties.  If results are cached, the validator is
+ * first fetched using a Depth: 0 PROPFIND; if it is unchanged, the
+ * cached results are passed to the results callback and the PROPFIND
+ * is not sent, otherwise the PROPFIND is sent and the results are
+ * stored.  The cache is not used if complex property handlers are
+ * installed with ne_propfind_set_private.  Note that a server may not
+ * change the ETag of a collection when its members change; caching a
+ * Depth: 1 PROPFIND is reliable only if the server supports
+ * sync-tokens. */
+void ne_propfind_set_cache(ne_propfind_handler *handler, 
+                           ne_propfind_cache *cache);
+
+/* Destroy a result cache; it must not be in use by any handler. */
+void ne_propfind_cache_destroy(ne_propfind_cache *cache);
+
+/* Retrieve the changes to the members of the collection at 'path'
+ * since the synchronization state identified by 'sync_token', using
+ * a sync-collection REPORT (RFC 6578); 'sync_token' may be NULL to
+ * retrieve all members for an initial synchronization.  The
+ * properties named in 'props' (terminated by a property with a NULL
+ * name field), which may be NULL, are fetched for each changed or
+ * new member, and passed to 'result'.  For each member which has been
+ * removed, 'result' is called with a NULL 'results' argument.
+ *
+ * On success, returns NE_OK and sets *new_token to the malloc-allocated
+ * token which identifies the new synchronization state, for use in
+ * the next call.  Returns NE_* on error; if the server rejects the
+ * sync-token, the caller should synchronize again with a NULL token.
+ * On success, *truncated is set to non-zero if the server truncated
+ * the set of changes (a 507 status for 'path'), in which case the
+ * caller should repeat the request with the returned token to
+ * retrieve the remaining changes; otherwise it is set to zero. */
+int ne_sync_collection(ne_session *sess, const char *path,
+                       const char *sync_token, const ne_propname *props,
+                       ne_props_result result, void *userdata,
+                       char **new_token, int *truncated);
+
+/* Callback for ne_tree_walk, invoked once for each resource found;
+ * 'collection' is non-zero if the resource is a collection, that is,
+ * if its DAV:resourcetype property includes the DAV:collection
+ * element.  If the members of a collection below the root cannot be
+ * listed, the callback is invoked again for that collection with a
+ * NULL 'results' argument, and the walk continues.  If the callback
+ * returns non-zero, the walk is aborted and ne_tree_walk returns that
+ * value. */
+typedef int (*ne_tree_walk_result)(void *userdata, const ne_uri *uri,
+                                   const ne_prop_result_set *results,
+                                   int collection);
+
+/* Walk the tree of resources below the collection at path 'root',
+ * fetching the properties named in 'props' (terminated by a property
+ * with a NULL name field), or all properties if 'props' is NULL.  The
+ * tree is walked breadth-first using Depth: 1 PROPFIND requests,
+ * issued over 'nworkers' sessions given in the 'sessions' array;
+ * these must all be connected to the same server, and each have a
+ * separate connection.  Results are passed to the 'result' callback
+ * as they are parsed.  Each resource is reported once, where paths
+ * are compared as by ne_path_compare.  Returns NE_OK on completion,
+ * even if some collections below the root could not be listed, or
+ * NE_* if the root collection could not be listed. */
+int ne_tree_walk(ne_session *const sessions[], int nworkers,
+                 const char *root, const ne_propname *props,
+                 ne_tree_walk_result result, void *userdata);
+
 NE_END_DECLS
 
 #endif /* NE_PROPS_H */
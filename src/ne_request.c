@@ -41,6 +41,10 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <time.h>
 
 #include "ne_internal.h"
 
@@ -153,15 +157,59 @@ struct ne_request_s {
     /*** Miscellaneous ***/
     unsigned int method_is_head;
     unsigned int can_persist;
+    unsigned int early_safe; /* may be sent as TLS early data */
 
     int flags[NE_REQFLAG_LAST];
 
     ne_session *session;
     ne_status status;
+
+    /* Timings: 'start' is the time at which ne_begin_request() was
+     * called. */
+    double start;
+    ne_request_timings timings;
 };
 
 static int open_connection(ne_session *sess);
 
+/* Returns the current time in seconds, using a monotonic clock if
+ * available. */
+static double time_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+#ifdef HAVE_SYS_TIME_H
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+    }
+#else
+    return (double)time(NULL);
+#endif
+}
+
+/* Record the time of 'event' for request 'req'. */
+#define TIME_REQ(req, event) \
+    ((req)->timings.event = time_now() - (req)->start)
+
+/* Record the time of connection setup 'event' for the request which
+ * is opening the session's connection, if any. */
+#define TIME_CONN(sess, event) do { \
+    if ((sess)->timing_req) TIME_REQ((sess)->timing_req, event); \
+} while (0)
+
+/* Count 'n' bytes sent or received (per 'field') for request 'req'. */
+#define COUNT_BYTES(req, field, n) do { \
+    (req)->timings.field += (n); \
+    NE_STAT_BYTES((req)->session, field, (n)); \
+} while (0)
+
 /* Returns hash value for header 'name', converting it to lower-case
  * in-place. */
 static inline unsigned int hash_and_lower(char *name)
@@ -357,6 +405,12 @@ static ssize_t body_fd_send(void *userdata, char *buffer, size_t count)
 ((((code) == NE_SOCK_CLOSED || (code) == NE_SOCK_RESET || \
  (code) == NE_SOCK_TRUNC) && retry) ? NE_RETRY : (acode))
 
+/* Size of the buffer used to send the request body.  Blocks from the
+ * body provider are coalesced up to this size, which is the maximum
+ * TLS record payload, so that an SSL connection sends full-sized
+ * records. */
+#define BODY_BUFSIZ (16384)
+
 /* Sends the request body; returns 0 on success or an NE_* error code.
  * If retry is non-zero; will return NE_RETRY on persistent connection
  * timeout.  On error, the session error string is set and the
@@ -364,7 +418,8 @@ static ssize_t body_fd_send(void *userdata, char *buffer, size_t count)
 static int send_request_body(ne_request *req, int retry)
 {
     ne_session *const sess = req->session;
-    char buffer[NE_BUFSIZ];
+    char buffer[BODY_BUFSIZ];
+    ne_off_t remain = req->body_length;
     ssize_t bytes;
 
     NE_DEBUG(NE_DBG_HTTP, "Sending request body:\n");
@@ -379,23 +434,39 @@ static int send_request_body(ne_request *req, int retry)
         return NE_ERROR;
     }
     
-    while ((bytes = req->body_cb(req->body_ud, buffer, sizeof buffer)) > 0) {
-	int ret = ne_sock_fullwrite(sess->socket, buffer, bytes);
+    do {
+        size_t used = 0, want = sizeof buffer;
+        int ret;
+
+        if ((ne_off_t)want > remain) want = remain;
+
+        /* Fill the buffer, until the provider returns EOF or fails;
+         * never send more than the declared body length. */
+        do {
+            bytes = req->body_cb(req->body_ud, buffer + used, want - used);
+            if (bytes > 0) used += bytes;
+        } while (bytes > 0 && used < want);
+
+        if (bytes < 0 || used == 0) break;
+
+	ret = ne_sock_fullwrite(sess->socket, buffer, used);
         if (ret < 0) {
             int aret = aborted(req, _("Could not send request body"), ret);
             return RETRY_RET(retry, ret, aret);
         }
+        COUNT_BYTES(req, bytes_sent, used);
 
 	NE_DEBUG(NE_DBG_HTTPBODY, 
-		 "Body block (%" NE_FMT_SSIZE_T " bytes):\n[%.*s]\n",
-		 bytes, (int)bytes, buffer);
+		 "Body block (%" NE_FMT_SIZE_T " bytes):\n[%.*s]\n",
+		 used, (int)used, buffer);
 
         /* invoke progress callback */
-        req->session->status.sr.progress += bytes;
+        req->session->status.sr.progress += used;
         notify_status(sess, ne_status_sending);
-    }
+        remain -= used;
+    } while (bytes > 0 && remain > 0);
 
-    if (bytes == 0) {
+    if (bytes >= 0) {
         return NE_OK;
     } else {
         NE_DEBUG(NE_DBG_HTTP, "Request body provider failed with "
@@ -470,6 +541,10 @@ ne_request *ne_request_create(ne_session *sess,
     /* Set the standard stuff */
     req->method = ne_strdup(method);
     req->method_is_head = (strcmp(method, "HEAD") == 0);
+    /* Only safe methods are sent as TLS early data, which an attacker
+     * can replay (RFC 8470). */
+    req->early_safe = req->method_is_head || strcmp(method, "GET") == 0
+        || strcmp(method, "OPTIONS") == 0 || strcmp(method, "PROPFIND") == 0;
 
     /* Only use an absoluteURI here when we might be using an HTTP
      * proxy, and SSL is in use: some servers can't parse them. */
@@ -529,7 +604,7 @@ void ne_set_request_body_fd(ne_request *req, int fd,
 
 void ne_set_request_flag(ne_request *req, ne_request_flag flag, int value)
 {
-    if (flag < NE_SESSFLAG_LAST) {
+    if (flag < NE_REQFLAG_LAST) {
         req->flags[flag] = value;
     }
 }
@@ -808,8 +883,12 @@ ssize_t ne_read_response_block(ne_request *req, char *buffer, size_t buflen)
 
     if (readlen) {
         req->session->status.sr.progress += readlen;
+        COUNT_BYTES(req, bytes_received, readlen);
         notify_status(req->session, ne_status_recving);
     }
+    else if (req->timings.body_done < 0) {
+        TIME_REQ(req, body_done);
+    }
 
     for (rdr = req->body_readers; rdr!=NULL; rdr=rdr->next) {
 	if (rdr->use && rdr->handler(rdr->userdata, buffer, readlen) != 0) {
@@ -896,6 +975,11 @@ static int read_status_line(ne_request *req, ne_status *status, int retry)
 	int aret = aborted(req, _("Could not read status line"), ret);
 	return RETRY_RET(retry, ret, aret);
     }
+
+    if (req->timings.first_byte < 0) {
+        TIME_REQ(req, first_byte);
+    }
+    COUNT_BYTES(req, bytes_received, ret);
     
     NE_DEBUG(NE_DBG_HTTP, "[status-line] < %s", buffer);
     strip_eol(buffer, &ret);
@@ -947,23 +1031,53 @@ static int send_request(ne_request *req, const ne_buffer *request)
     ne_status *const status = &req->status;
     int sentbody = 0; /* zero until body has been sent. */
     int ret, retry; /* retry non-zero whilst the request should be retried */
+    int early = 0; /* non-zero if sent as early data */
+    ne_request *const prev_timing = sess->timing_req;
     ssize_t sret;
 
+    /* A request using a safe method without a body may be sent as
+     * TLS early data when opening a new connection; it can be safely
+     * replayed by the network. */
+    if (!sess->connected && sess->use_ssl
+        && sess->flags[NE_SESSFLAG_TLS_EARLYDATA] && req->early_safe
+        && req->flags[NE_REQFLAG_IDEMPOTENT] && req->body_length == 0) {
+        sess->early_data = request;
+        sess->early_accepted = 0;
+        early = 1;
+    }
+
     /* Send the Request-Line and headers */
     NE_DEBUG(NE_DBG_HTTP, "Sending request-line and headers:\n");
-    /* Open the connection if necessary */
+    /* Open the connection if necessary, timing connection setup for
+     * this request. */
+    sess->timing_req = req;
     ret = open_connection(sess);
+    sess->timing_req = prev_timing;
+    if (early) {
+        sess->early_data = NULL;
+        early = sess->early_accepted;
+    }
     if (ret) return ret;
 
     /* Allow retry if a persistent connection has been used. */
     retry = sess->persisted;
+    req->timings.reused = sess->persisted;
+    if (sess->persisted) {
+        NE_STAT_ADD(sess, reused, 1);
+    }
     
-    sret = ne_sock_fullwrite(req->session->socket, request->data, 
-                             ne_buffer_size(request));
-    if (sret < 0) {
-	int aret = aborted(req, _("Could not send request"), sret);
-	return RETRY_RET(retry, sret, aret);
+    if (early) {
+        NE_DEBUG(NE_DBG_HTTP, "Request was sent as early data.\n");
+    }
+    else {
+        sret = ne_sock_fullwrite(req->session->socket, request->data, 
+                                 ne_buffer_size(request));
+        if (sret < 0) {
+            int aret = aborted(req, _("Could not send request"), sret);
+            return RETRY_RET(retry, sret, aret);
+        }
     }
+    COUNT_BYTES(req, bytes_sent, ne_buffer_size(request));
     
     if (!req->flags[NE_REQFLAG_EXPECT100] && req->body_length > 0) {
 	/* Send request body, if not using 100-continue. */
@@ -972,6 +1086,8 @@ static int send_request(ne_request *req, const ne_buffer *request)
             return ret;
 	}
     }
+
+    TIME_REQ(req, request_sent);
     
     NE_DEBUG(NE_DBG_HTTP, "Request sent; retry is %d.\n", retry);
 
@@ -989,9 +1105,22 @@ static int send_request(ne_request *req, const ne_buffer *request)
 	    /* Send the body after receiving the first 100 Continue */
 	    if ((ret = send_request_body(req, 0)) != NE_OK) break;	    
 	    sentbody = 1;
+            TIME_REQ(req, request_sent);
 	}
     }
 
+    if (ret == NE_OK && early && status->code == 425) {
+        /* 425 Too Early: the server will not process the request
+         * until the handshake is complete, so send it again without
+         * early data (RFC 8470). */
+        NE_DEBUG(NE_DBG_HTTP, "req: Early data rejected, resending.\n");
+        ne_close_connection(sess);
+        NE_STAT_ADD(sess, retries, 1);
+        req->early_safe = 0;
+        req->timings.bytes_sent = req->timings.bytes_received = 0;
+        return send_request(req, request);
+    }
+
     return ret;
 }
 
@@ -1011,6 +1140,7 @@ static int read_message_header(ne_request *req, char *buf, size_t buflen)
     if (n <= 0)
 	return aborted(req, _("Error reading response headers"), n);
     NE_DEBUG(NE_DBG_HTTP, "[hdr] %s", buf);
+    COUNT_BYTES(req, bytes_received, n);
 
     strip_eol(buf, &n);
 
@@ -1041,6 +1171,7 @@ static int read_message_header(ne_request *req, char *buf, size_t buflen)
 	}
 
 	NE_DEBUG(NE_DBG_HTTP, "[cont] %s", buf);
+        COUNT_BYTES(req, bytes_received, n);
 
 	strip_eol(buf, &n);
 	
@@ -1149,7 +1280,9 @@ static int lookup_host(ne_session *sess, struct host_info *info)
     NE_DEBUG(NE_DBG_HTTP, "Doing DNS lookup on %s...\n", info->hostname);
     sess->status.lu.hostname = info->hostname;
     notify_status(sess, ne_status_lookup);
+    TIME_CONN(sess, lookup_start);
     info->address = ne_addr_resolve(info->hostname, 0);
+    TIME_CONN(sess, lookup_end);
     if (ne_addr_result(info->address)) {
 	char buf[256];
 	ne_set_error(sess, _("Could not resolve hostname `%s': %s"), 
@@ -1172,6 +1305,18 @@ int ne_begin_request(ne_request *req)
     struct hook *hk;
     int ret, forced_closure = 0;
 
+    req->start = time_now();
+    req->timings.lookup_start = req->timings.lookup_end = -1;
+    req->timings.connect_start = req->timings.connect_end = -1;
+    req->timings.tunnel_start = req->timings.tunnel_end = -1;
+    req->timings.ssl_start = req->timings.ssl_end = -1;
+    req->timings.request_sent = req->timings.first_byte = -1;
+    req->timings.headers_done = req->timings.body_done = -1;
+    req->timings.bytes_sent = req->timings.bytes_received = 0;
+    req->timings.reused = 0;
+
+    NE_STAT_ADD(req->session, requests, 1);
+
     /* If a non-idempotent request is sent on a persisted connection,
      * then it is impossible to distinguish between a server failure
      * and a connection timeout if an EOF/RST is received.  So don't
@@ -1190,6 +1335,8 @@ int ne_begin_request(ne_request *req)
     /* Retry this once after a persistent connection timeout. */
     if (ret == NE_RETRY) {
 	NE_DEBUG(NE_DBG_HTTP, "Persistent connection timed out, retrying.\n");
+        NE_STAT_ADD(req->session, retries, 1);
+        req->timings.bytes_sent = req->timings.bytes_received = 0;
 	ret = send_request(req, data);
     }
     ne_buffer_destroy(data);
@@ -1211,6 +1358,14 @@ int ne_begin_request(ne_request *req)
     /* Read the headers */
     ret = read_response_headers(req);
     if (ret) return ret;
+    TIME_REQ(req, headers_done);
+
+    if (st->code == 401 || st->code == 407) {
+        NE_STAT_ADD(req->session, auth_challenges, 1);
+    }
+    else if (st->klass == 3 && ne_get_response_header(req, "Location")) {
+        NE_STAT_ADD(req->session, redirects, 1);
+    }
 
     /* check the Connection header */
     value = get_response_header_hv(req, HH_HV_CONNECTION, "connection");
@@ -1419,6 +1574,11 @@ ne_session *ne_get_session(const ne_request *req)
     return req->session;
 }
 
+void ne_get_request_timings(ne_request *req, ne_request_timings *timings)
+{
+    *timings = req->timings;
+}
+
 #ifdef NE_HAVE_SSL
 /* Create a CONNECT tunnel through the proxy server.
  * Returns HTTP_* */
@@ -1495,6 +1655,7 @@ static int do_connect(ne_session *sess, struct host_info *host)
 	host->current = resolve_first(host);
 
     sess->status.ci.hostname = host->hostname;
+    TIME_CONN(sess, connect_start);
 
     do {
         sess->status.ci.address = host->current;
@@ -1527,6 +1688,8 @@ static int do_connect(ne_session *sess, struct host_info *host)
     if (sess->rdtimeout)
 	ne_sock_read_timeout(sess->socket, sess->rdtimeout);
 
+    TIME_CONN(sess, connect_end);
+    NE_STAT_ADD(sess, connections, 1);
     notify_status(sess, ne_status_connected);
     sess->nexthop = host;
 
@@ -1643,11 +1806,16 @@ static int open_connection(ne_session *sess)
     /* Negotiate SSL layer if required. */
     if (sess->use_ssl && !sess->in_connect) {
         /* Set up CONNECT tunnel if using an HTTP proxy. */
-        if (sess->nexthop->proxy == PROXY_HTTP)
+        if (sess->nexthop->proxy == PROXY_HTTP) {
+            TIME_CONN(sess, tunnel_start);
             ret = proxy_tunnel(sess);
+            TIME_CONN(sess, tunnel_end);
+        }
         
         if (ret == NE_OK) {
+            TIME_CONN(sess, ssl_start);
             ret = ne__negotiate_ssl(sess);
+            TIME_CONN(sess, ssl_end);
             if (ret != NE_OK)
                 ne_close_connection(sess);
         }
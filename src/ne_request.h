@@ -173,6 +173,34 @@ const ne_status *ne_get_status(const ne_request *req) ne_attribute((const));
 /* Returns pointer to session associated with request. */
 ne_session *ne_get_session(const ne_request *req) ne_attribute((const));
 
+/* Timing and transfer information for a request.  Times are given in
+ * seconds since ne_begin_request() was called, measured using a
+ * monotonic clock where available; a time of -1 means the event did
+ * not happen, for example, no DNS lookup or TCP connection takes
+ * place when a persistent connection is reused.  If the request was
+ * retried, the times and byte counts are those of the last
+ * attempt. */
+typedef struct {
+    double lookup_start, lookup_end; /* DNS lookup */
+    double connect_start, connect_end; /* TCP connection */
+    double tunnel_start, tunnel_end; /* CONNECT tunnel via a proxy */
+    double ssl_start, ssl_end; /* SSL handshake */
+    double request_sent; /* request headers and body sent */
+    double first_byte; /* first line of response received */
+    double headers_done; /* response headers read */
+    double body_done; /* end of response body read */
+    /* Number of bytes of request headers and body sent, and of
+     * response status-line, headers and body received (excluding any
+     * chunked transfer-coding). */
+    ne_off_t bytes_sent, bytes_received;
+    int reused; /* non-zero if a persistent connection was reused */
+} ne_request_timings;
+
+/* Retrieve timing information for request 'req', which must have
+ * been started using ne_begin_request() (or ne_request_dispatch()),
+ * into *timings. */
+void ne_get_request_timings(ne_request *req, ne_request_timings *timings);
+
 /* Destroy memory associated with request pointer */
 void ne_request_destroy(ne_request *req);
 
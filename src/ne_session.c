@@ -30,17 +30,33 @@
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#include <stdio.h>
+#include <time.h>
 
 #ifdef HAVE_LIBPROXY
 #include <proxy.h>
 #endif
 
+#ifdef HAVE_PTHREAD_MUTEX_LOCK
+#include <pthread.h>
+#endif
+
 #include "ne_session.h"
 #include "ne_alloc.h"
 #include "ne_utils.h"
 #include "ne_internal.h"
 #include "ne_string.h"
 #include "ne_dates.h"
+#include "ne_hash.h"
 
 #include "ne_private.h"
 
@@ -374,6 +390,56 @@ int ne_get_session_flag(ne_session *sess, ne_session_flag flag)
     return -1;
 }
 
+/* Process-wide statistics, updated using relaxed atomic operations
+ * where the compiler supports them. */
+static ne_session_stats global_stats;
+
+#if defined(__ATOMIC_RELAXED) && defined(__GCC_ATOMIC_LLONG_LOCK_FREE) \
+    && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define ATOMIC_ADD(v, n) __atomic_fetch_add(&(v), (n), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(v) __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#else
+#define ATOMIC_ADD(v, n) ((v) += (n))
+#define ATOMIC_LOAD(v) (v)
+#endif
+
+void ne__stat_count(size_t offset, unsigned long n)
+{
+    unsigned long *counter = (unsigned long *)((char *)&global_stats + offset);
+
+    ATOMIC_ADD(*counter, n);
+}
+
+void ne__stat_bytes(size_t offset, ne_off_t n)
+{
+    ne_off_t *count = (ne_off_t *)((char *)&global_stats + offset);
+
+    ATOMIC_ADD(*count, n);
+}
+
+void ne_get_session_stats(ne_session *sess, ne_session_stats *stats)
+{
+    *stats = sess->stats;
+}
+
+void ne_get_global_stats(ne_session_stats *stats)
+{
+    ne_session_stats *const gs = &global_stats;
+
+    stats->requests = ATOMIC_LOAD(gs->requests);
+    stats->retries = ATOMIC_LOAD(gs->retries);
+    stats->connections = ATOMIC_LOAD(gs->connections);
+    stats->reused = ATOMIC_LOAD(gs->reused);
+    stats->auth_challenges = ATOMIC_LOAD(gs->auth_challenges);
+    stats->redirects = ATOMIC_LOAD(gs->redirects);
+    stats->ssl_handshakes = ATOMIC_LOAD(gs->ssl_handshakes);
+    stats->ssl_resumed = ATOMIC_LOAD(gs->ssl_resumed);
+    stats->bytes_sent = ATOMIC_LOAD(gs->bytes_sent);
+    stats->bytes_received = ATOMIC_LOAD(gs->bytes_received);
+    stats->compressed = ATOMIC_LOAD(gs->compressed);
+    stats->decompressed = ATOMIC_LOAD(gs->decompressed);
+}
+
 static void progress_notifier(void *userdata, ne_session_status status,
                               const ne_session_status_info *info)
 {
@@ -494,6 +560,10 @@ void ne_ssl_set_verify(ne_session *sess, ne_ssl_verify_fn fn, void *userdata)
 {
     sess->ssl_verify_fn = fn;
     sess->ssl_verify_ud = userdata;
+#ifdef NE_HAVE_SSL
+    ne__ssl_trust_update(sess, "verify", &fn, sizeof fn);
+    ne__ssl_trust_update(sess, "verify-ud", &userdata, sizeof userdata);
+#endif
 }
 
 void ne_ssl_provide_clicert(ne_session *sess, 
@@ -507,7 +577,311 @@ void ne_ssl_trust_cert(ne_session *sess, const ne_ssl_certificate *cert)
 {
 #ifdef NE_HAVE_SSL
     if (sess->ssl_context) {
+        char *der = ne_ssl_cert_export(cert);
+
         ne_ssl_context_trustcert(sess->ssl_context, cert);
+        ne__ssl_trust_update(sess, "trust", der, strlen(der));
+        ne_free(der);
+    }
+#endif
+}
+
+/* An SSL session cache entry. */
+struct scache_entry {
+    char *key; /* hostname:port/SNI name */
+    unsigned char *data; /* serialized session */
+    size_t len;
+    time_t stored; /* time at which the session was stored */
+    struct scache_entry *next;
+};
+
+/* A verified certificate chain cache entry. */
+struct vcache_entry {
+    char *key; /* chain digest, hostname and trust configuration */
+    time_t expires; /* earliest expiry time of a cert in the chain */
+    struct vcache_entry *next;
+};
+
+struct ne_ssl_session_cache_s {
+    struct scache_entry *entries; /* most recently stored first */
+    struct vcache_entry *verified; /* most recently stored first */
+    unsigned int size;
+    unsigned long hits, misses;
+#ifdef HAVE_PTHREAD_MUTEX_LOCK
+    pthread_mutex_t lock;
+#endif
+};
+
+#ifdef HAVE_PTHREAD_MUTEX_LOCK
+#define SCACHE_LOCK(c) pthread_mutex_lock(&(c)->lock)
+#define SCACHE_UNLOCK(c) pthread_mutex_unlock(&(c)->lock)
+#else
+#define SCACHE_LOCK(c)
+#define SCACHE_UNLOCK(c)
+#endif
+
+static void free_scache_entry(struct scache_entry *ent)
+{
+    ne_free(ent->key);
+    ne_free(ent->data);
+    ne_free(ent);
+}
+
+ne_ssl_session_cache *ne_ssl_session_cache_create(unsigned int size)
+{
+    ne_ssl_session_cache *cache = ne_calloc(sizeof *cache);
+
+    cache->size = size;
+#ifdef HAVE_PTHREAD_MUTEX_LOCK
+    pthread_mutex_init(&cache->lock, NULL);
+#endif
+
+    return cache;
+}
+
+void ne_ssl_session_cache_stats(ne_ssl_session_cache *cache,
+                                unsigned long *hits, unsigned long *misses)
+{
+    SCACHE_LOCK(cache);
+    *hits = cache->hits;
+    *misses = cache->misses;
+    SCACHE_UNLOCK(cache);
+}
+
+void ne_ssl_session_cache_destroy(ne_ssl_session_cache *cache)
+{
+    struct scache_entry *ent, *next;
+    struct vcache_entry *vent, *vnext;
+
+    for (ent = cache->entries; ent; ent = next) {
+        next = ent->next;
+        free_scache_entry(ent);
+    }
+
+    for (vent = cache->verified; vent; vent = vnext) {
+        vnext = vent->next;
+        ne_free(vent->key);
+        ne_free(vent);
+    }
+
+#ifdef HAVE_PTHREAD_MUTEX_LOCK
+    pthread_mutex_destroy(&cache->lock);
+#endif
+
+    ne_free(cache);
+}
+
+/* Session cache file format: a header line, then one line per entry
+ * giving the time it was stored, the key, and the base64-encoded
+ * session, most recently stored first, then a trailer giving the
+ * SHA-256 hash of everything preceding it. */
+#define SCACHE_HEADER "neon-ssl-sessions 1\n"
+#define SCACHE_TRAILER "sha256 "
+
+int ne_ssl_session_cache_save(ne_ssl_session_cache *cache,
+                              const char *filename)
+{
+    ne_buffer *buf = ne_buffer_create();
+    ne_hash_ctx *hash;
+    struct scache_entry *ent;
+    char hex[NE_HASH_MAXHEX + 1];
+    FILE *fp;
+    int ret;
+#ifndef WIN32
+    int fd;
+#endif
+
+    ne_buffer_zappend(buf, SCACHE_HEADER);
+
+    SCACHE_LOCK(cache);
+    for (ent = cache->entries; ent; ent = ent->next) {
+        char *b64 = ne_base64(ent->data, ent->len), stored[32];
+
+        ne_snprintf(stored, sizeof stored, "%ld", (long)ent->stored);
+        ne_buffer_concat(buf, stored, " ", ent->key, " ", b64, "\n", NULL);
+        ne_free(b64);
+    }
+    SCACHE_UNLOCK(cache);
+
+    hash = ne_hash_create(NE_HASH_SHA256);
+    ne_hash_update(hash, buf->data, ne_buffer_size(buf));
+    ne_hash_finish_ascii(hash, hex);
+    ne_hash_destroy(hash);
+    ne_buffer_concat(buf, SCACHE_TRAILER, hex, "\n", NULL);
+
+    /* The file contains session secrets, so is made readable only by
+     * the owner; the mode passed to open() is not applied to an
+     * existing file. */
+#ifdef WIN32
+    fp = fopen(filename, "w");
+#else
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0 && fchmod(fd, 0600)) {
+        close(fd);
+        fd = -1;
+    }
+    fp = fd < 0 ? NULL : fdopen(fd, "w");
+    if (fd >= 0 && fp == NULL) close(fd);
+#endif
+    if (fp == NULL) {
+        ne_buffer_destroy(buf);
+        return -1;
+    }
+
+    ret = fwrite(buf->data, ne_buffer_size(buf), 1, fp) != 1;
+    if (fclose(fp)) ret = -1;
+
+    ne_buffer_destroy(buf);
+
+    return ret ? -1 : 0;
+}
+
+/* Parse the session cache file contents 'data', appending entries
+ * which have not expired to *list in file order.  Returns non-zero
+ * if the contents are malformed. */
+static int parse_scache(char *data, long max_age,
+                        struct scache_entry **list)
+{
+    ne_hash_ctx *hash;
+    char hex[NE_HASH_MAXHEX + 1], *trailer, *expected, *line, *eol;
+    time_t now = time(NULL);
+    int mismatch;
+
+    if (strncmp(data, SCACHE_HEADER, strlen(SCACHE_HEADER)) != 0)
+        return -1;
+
+    trailer = strstr(data, "\n" SCACHE_TRAILER);
+    if (trailer == NULL) return -1;
+    trailer++;
+
+    hash = ne_hash_create(NE_HASH_SHA256);
+    ne_hash_update(hash, data, trailer - data);
+    ne_hash_finish_ascii(hash, hex);
+    ne_hash_destroy(hash);
+
+    expected = ne_concat(SCACHE_TRAILER, hex, "\n", NULL);
+    mismatch = strcmp(trailer, expected);
+    ne_free(expected);
+
+    if (mismatch) {
+        NE_DEBUG(NE_DBG_SSL, "ssl: Session cache file checksum mismatch.\n");
+        return -1;
+    }
+
+    for (line = data + strlen(SCACHE_HEADER); line < trailer; line = eol + 1) {
+        char *key, *b64, *end;
+        struct scache_entry *ent;
+        unsigned char *der;
+        size_t len;
+        long stored;
+
+        eol = strchr(line, '\n');
+        *eol = '\0';
+
+        key = strchr(line, ' ');
+        if (key == NULL) return -1;
+        *key++ = '\0';
+        b64 = strchr(key, ' ');
+        if (b64 == NULL) return -1;
+        *b64++ = '\0';
+
+        stored = strtol(line, &end, 10);
+        if (*end != '\0' || *key == '\0') return -1;
+
+        if (stored > now || now - stored > max_age) {
+            NE_DEBUG(NE_DBG_SSL, "ssl: Discarding expired session for %s.\n",
+                     key);
+            continue;
+        }
+
+        len = ne_unbase64(b64, &der);
+        if (len == 0) return -1;
+
+        ent = ne_malloc(sizeof *ent);
+        ent->key = ne_strdup(key);
+        ent->data = der;
+        ent->len = len;
+        ent->stored = (time_t)stored;
+        ent->next = NULL;
+        *list = ent;
+        list = &ent->next;
+    }
+
+    return 0;
+}
+
+int ne_ssl_session_cache_load(ne_ssl_session_cache *cache,
+                              const char *filename, long max_age)
+{
+    ne_buffer *buf;
+    struct scache_entry *list = NULL, *ent, *next, **pp;
+    char chunk[BUFSIZ];
+    unsigned int n;
+    size_t len;
+    FILE *fp;
+    int ret;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) return -1;
+
+    buf = ne_buffer_create();
+    while ((len = fread(chunk, 1, sizeof chunk, fp)) > 0) {
+        ne_buffer_append(buf, chunk, len);
+    }
+    ret = ferror(fp);
+    fclose(fp);
+
+    if (ret == 0) {
+        ret = parse_scache(buf->data, max_age, &list);
+    }
+    ne_buffer_destroy(buf);
+
+    if (ret) {
+        for (ent = list; ent; ent = next) {
+            next = ent->next;
+            free_scache_entry(ent);
+        }
+        return -1;
+    }
+
+    SCACHE_LOCK(cache);
+
+    /* Loaded entries are older than any already in the cache, so
+     * are added after them; those beyond the cache size are
+     * dropped. */
+    for (n = 0, pp = &cache->entries; *pp; pp = &(*pp)->next)
+        n++;
+
+    for (ent = list; ent; ent = next) {
+        struct scache_entry *cur;
+
+        next = ent->next;
+
+        for (cur = cache->entries; cur; cur = cur->next)
+            if (strcmp(cur->key, ent->key) == 0)
+                break;
+
+        if (cur || n >= cache->size) {
+            free_scache_entry(ent);
+        }
+        else {
+            ent->next = NULL;
+            *pp = ent;
+            pp = &ent->next;
+            n++;
+        }
+    }
+
+    SCACHE_UNLOCK(cache);
+
+    return 0;
+}
+
+void ne_ssl_set_session_cache(ne_session *sess, ne_ssl_session_cache *cache)
+{
+#ifdef NE_HAVE_SSL
+    if (sess->ssl_context) {
+        sess->ssl_scache = cache;
     }
 #endif
 }
@@ -572,6 +946,274 @@ void ne__ssl_set_verify_err(ne_session *sess, int failures)
     }
 }
 
+/* Returns the session cache key for the session's server, client
+ * certificate and trust configuration. */
+static char *scache_key(ne_session *sess)
+{
+    char port[20], ident[NE_SSL_DIGESTLEN] = "none";
+
+    ne_snprintf(port, sizeof port, ":%u/", sess->server.port);
+
+    /* A session resumed by a server treats the client as having the
+     * identity with which the session was authenticated, so sessions
+     * using different client certificates (or none) must not share
+     * cache entries. */
+    if (sess->client_cert
+        && ne_ssl_cert_digest(ne_ssl_clicert_owner(sess->client_cert),
+                              ident)) {
+        /* Never match another session's entries. */
+        ne_snprintf(ident, sizeof ident, "unknown-%p", (void *)sess);
+    }
+
+    /* The server certificate is not verified again when a session is
+     * resumed, so a session must only be resumed under the trust
+     * configuration which accepted it. */
+    return ne_concat(sess->server.hostname, port,
+                     sess->flags[NE_SESSFLAG_TLS_SNI]
+                     ? sess->server.hostname : "", "/", ident, "/",
+                     sess->ssl_trust[0] ? sess->ssl_trust : "none", NULL);
+}
+
+/* Unlink and return the entry for 'key' from the cache, or NULL.
+ * Must be called with the cache locked. */
+static struct scache_entry *scache_unlink(ne_ssl_session_cache *cache,
+                                          const char *key)
+{
+    struct scache_entry *ent, **pp;
+
+    for (pp = &cache->entries; (ent = *pp) != NULL; pp = &ent->next) {
+        if (strcmp(ent->key, key) == 0) {
+            *pp = ent->next;
+            break;
+        }
+    }
+
+    return ent;
+}
+
+unsigned char *ne__ssl_cache_fetch(ne_session *sess, size_t *len)
+{
+    ne_ssl_session_cache *cache = sess->ssl_scache;
+    struct scache_entry *ent;
+    unsigned char *ret = NULL;
+    char *key;
+
+    if (cache == NULL) return NULL;
+
+    key = scache_key(sess);
+
+    SCACHE_LOCK(cache);
+    for (ent = cache->entries; ent; ent = ent->next) {
+        if (strcmp(ent->key, key) == 0) {
+            ret = ne_malloc(ent->len);
+            memcpy(ret, ent->data, ent->len);
+            *len = ent->len;
+            break;
+        }
+    }
+    SCACHE_UNLOCK(cache);
+
+    NE_DEBUG(NE_DBG_SSL, "ssl: Session cache %s for %s.\n",
+             ret ? "entry found" : "has no entry", key);
+    ne_free(key);
+
+    return ret;
+}
+
+void ne__ssl_cache_store(ne_session *sess, const unsigned char *data,
+                         size_t len)
+{
+    ne_ssl_session_cache *cache = sess->ssl_scache;
+    struct scache_entry *ent, **pp;
+    unsigned int n;
+
+    if (cache == NULL || cache->size == 0) return;
+
+    ent = ne_malloc(sizeof *ent);
+    ent->key = scache_key(sess);
+    ent->data = ne_malloc(len);
+    memcpy(ent->data, data, len);
+    ent->len = len;
+    ent->stored = time(NULL);
+
+    NE_DEBUG(NE_DBG_SSL, "ssl: Storing %" NE_FMT_SIZE_T "-byte session "
+             "for %s.\n", len, ent->key);
+
+    SCACHE_LOCK(cache);
+
+    {
+        struct scache_entry *old = scache_unlink(cache, ent->key);
+        if (old) free_scache_entry(old);
+    }
+
+    ent->next = cache->entries;
+    cache->entries = ent;
+
+    /* Drop the least recently stored entry if the cache is full. */
+    for (n = 0, pp = &cache->entries; *pp; pp = &(*pp)->next) {
+        if (++n > cache->size) {
+            free_scache_entry(*pp);
+            *pp = NULL;
+            break;
+        }
+    }
+
+    SCACHE_UNLOCK(cache);
+}
+
+void ne__ssl_cache_remove(ne_session *sess)
+{
+    ne_ssl_session_cache *cache = sess->ssl_scache;
+    struct scache_entry *ent;
+    char *key;
+
+    if (cache == NULL) return;
+
+    key = scache_key(sess);
+
+    SCACHE_LOCK(cache);
+    ent = scache_unlink(cache, key);
+    SCACHE_UNLOCK(cache);
+
+    if (ent) free_scache_entry(ent);
+    ne_free(key);
+}
+
+void ne__ssl_cache_result(ne_session *sess, int resumed)
+{
+    ne_ssl_session_cache *cache = sess->ssl_scache;
+
+    if (cache == NULL) return;
+
+    SCACHE_LOCK(cache);
+    if (resumed)
+        cache->hits++;
+    else
+        cache->misses++;
+    SCACHE_UNLOCK(cache);
+}
+
+void ne__ssl_trust_update(ne_session *sess, const char *what,
+                          const void *data, size_t len)
+{
+    ne_hash_ctx *hash = ne_hash_create(NE_HASH_SHA256);
+
+    ne_hash_update(hash, sess->ssl_trust, strlen(sess->ssl_trust));
+    ne_hash_update(hash, what, strlen(what) + 1);
+    ne_hash_update(hash, data, len);
+    ne_hash_finish_ascii(hash, sess->ssl_trust);
+    ne_hash_destroy(hash);
+}
+
+/* Returns the verified chain cache key for 'chain' presented by the
+ * session's server, and sets *expires to the earliest time at which
+ * a certificate in the chain expires. */
+static char *vcache_key(ne_session *sess, const ne_ssl_certificate *chain,
+                        time_t *expires)
+{
+    ne_hash_ctx *hash = ne_hash_create(NE_HASH_SHA256);
+    char hex[NE_HASH_MAXHEX + 1];
+    const ne_ssl_certificate *cert;
+
+    *expires = (time_t)-1;
+
+    for (cert = chain; cert; cert = ne_ssl_cert_signedby(cert)) {
+        char *der = ne_ssl_cert_export(cert);
+        time_t from, until;
+
+        ne_hash_update(hash, der, strlen(der) + 1);
+        ne_free(der);
+
+        ne_ssl_cert_validity_time(cert, &from, &until);
+        if (until != (time_t)-1 && (*expires == (time_t)-1 || until < *expires))
+            *expires = until;
+    }
+
+    ne_hash_finish_ascii(hash, hex);
+    ne_hash_destroy(hash);
+
+    return ne_concat(hex, " ", sess->server.hostname, " ", sess->ssl_trust,
+                     NULL);
+}
+
+int ne__ssl_cache_verified(ne_session *sess, const ne_ssl_certificate *chain)
+{
+    ne_ssl_session_cache *cache = sess->ssl_scache;
+    struct vcache_entry *ent, **pp;
+    time_t expires, now = time(NULL);
+    char *key;
+    int ret = 0;
+
+    if (cache == NULL) return 0;
+
+    key = vcache_key(sess, chain, &expires);
+
+    SCACHE_LOCK(cache);
+    for (pp = &cache->verified; (ent = *pp) != NULL; pp = &ent->next) {
+        if (strcmp(ent->key, key) == 0) {
+            if (now < ent->expires) {
+                ret = 1;
+            }
+            else {
+                /* Expired: force full verification. */
+                *pp = ent->next;
+                ne_free(ent->key);
+                ne_free(ent);
+            }
+            break;
+        }
+    }
+    SCACHE_UNLOCK(cache);
+
+    NE_DEBUG(NE_DBG_SSL, "ssl: Verified chain cache %s.\n",
+             ret ? "hit" : "miss");
+    ne_free(key);
+
+    return ret;
+}
+
+void ne__ssl_cache_verify_store(ne_session *sess,
+                                const ne_ssl_certificate *chain)
+{
+    ne_ssl_session_cache *cache = sess->ssl_scache;
+    struct vcache_entry *ent, **pp;
+    unsigned int n;
+
+    if (cache == NULL || cache->size == 0) return;
+
+    ent = ne_malloc(sizeof *ent);
+    ent->key = vcache_key(sess, chain, &ent->expires);
+
+    if (ent->expires == (time_t)-1) {
+        /* Validity period unknown; do not cache. */
+        ne_free(ent->key);
+        ne_free(ent);
+        return;
+    }
+
+    SCACHE_LOCK(cache);
+
+    ent->next = cache->verified;
+    cache->verified = ent;
+
+    /* Drop any older entry for the same key, and the least recently
+     * stored entry if the cache is full. */
+    for (n = 1, pp = &ent->next; *pp; ) {
+        struct vcache_entry *cur = *pp;
+
+        if (strcmp(cur->key, ent->key) == 0 || ++n > cache->size) {
+            *pp = cur->next;
+            ne_free(cur->key);
+            ne_free(cur);
+        }
+        else {
+            pp = &cur->next;
+        }
+    }
+
+    SCACHE_UNLOCK(cache);
+}
+
 /* This doesn't actually implement complete RFC 2818 logic; omits
  * "f*.example.com" support for simplicity. */
 int ne__ssl_match_hostname(const char *cn, size_t cnlen, const char *hostname)
@@ -101,6 +101,14 @@ typedef enum ne_session_flag_e {
     NE_SESSFLAG_EXPECT100, /* enable this flag to enable the flag
                             * NE_REQFLAG_EXPECT100 for new requests. */
 
+    NE_SESSFLAG_TLS_EARLYDATA, /* enable this flag to send GET, HEAD,
+                                * OPTIONS and PROPFIND requests without
+                                * a body as TLS 1.3 early data when
+                                * resuming a session; a 425 (Too Early)
+                                * response causes the request to be
+                                * sent again without early data.
+                                * Requires OpenSSL 1.1.1 or later. */
+
     NE_SESSFLAG_LAST /* enum sentinel value */
 } ne_session_flag;
 
@@ -271,6 +279,12 @@ void ne_ssl_trust_cert(ne_session *sess, const ne_ssl_certificate *cert);
  * this set of CAs. */
 void ne_ssl_trust_default_ca(ne_session *sess);
 
+/* Use the given SSL session cache for connections made by the
+ * session, in place of the single session otherwise cached by the
+ * session's SSL context.  The cache must outlive the session.  This
+ * function has no effect for non-SSL sessions. */
+void ne_ssl_set_session_cache(ne_session *sess, ne_ssl_session_cache *cache);
+
 /* Callback used to load a client certificate on demand.  If dncount
  * is > 0, the 'dnames' array dnames[0] through dnames[dncount-1]
  * gives the list of CA names which the server indicated were
@@ -336,6 +350,34 @@ void ne_set_error(ne_session *sess, const char *format, ...)
 /* Retrieve the error string for the session */
 const char *ne_get_error(ne_session *sess);
 
+/* Statistics counters, kept for each session and for all sessions in
+ * the process. */
+typedef struct {
+    unsigned long requests; /* requests started */
+    unsigned long retries; /* requests sent again after a persistent
+                            * connection was closed by the server */
+    unsigned long connections; /* connections opened */
+    unsigned long reused; /* requests sent on a persistent connection */
+    unsigned long auth_challenges; /* 401 and 407 responses */
+    unsigned long redirects; /* 3xx responses with a Location header */
+    unsigned long ssl_handshakes; /* SSL handshakes completed */
+    unsigned long ssl_resumed; /* SSL handshakes which resumed a
+                                * cached session */
+    ne_off_t bytes_sent; /* bytes of requests sent */
+    ne_off_t bytes_received; /* bytes of responses received */
+    ne_off_t compressed; /* bytes of compressed response bodies */
+    ne_off_t decompressed; /* bytes produced decompressing them */
+} ne_session_stats;
+
+/* Retrieve the statistics counters for session 'sess'. */
+void ne_get_session_stats(ne_session *sess, ne_session_stats *stats);
+
+/* Retrieve the statistics counters for all sessions in the process.
+ * Where supported by the compiler, the counters are updated using
+ * atomic operations, so may be read safely while other threads are
+ * using sessions; the snapshot is not consistent across counters. */
+void ne_get_global_stats(ne_session_stats *stats);
+
 NE_END_DECLS
 
 #endif /* NE_SESSION_H */
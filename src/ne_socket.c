@@ -615,6 +615,16 @@ static int error_ossl(ne_socket *sock, int sret)
     
     /* for all other errors, look at the OpenSSL error stack */
     err = ERR_get_error();
+#ifdef SSL_R_UNEXPECTED_EOF_WHILE_READING
+    /* OpenSSL 3.0 reports EOF without close_notify via the error
+     * stack. */
+    if (ERR_GET_LIB(err) == ERR_LIB_SSL
+        && ERR_GET_REASON(err) == SSL_R_UNEXPECTED_EOF_WHILE_READING) {
+        ERR_clear_error();
+        set_error(sock, _("Secure connection truncated"));
+        return NE_SOCK_TRUNC;
+    }
+#endif
     if (err == 0) {
         /* Empty error stack, presume this is a system call error: */
         if (sret == 0) {
@@ -1750,6 +1760,24 @@ int ne_sock_connect_ssl(ne_socket *sock, ne_ssl_context *ctx, void *userdata)
     if (ctx->sess)
 	SSL_set_session(ssl, ctx->sess);
 
+    ctx->early_accepted = 0;
+#ifdef SSL_EARLY_DATA_ACCEPTED
+    /* Send early data if the session to be resumed permits enough. */
+    if (ctx->early_data && ctx->sess
+        && SSL_SESSION_get_max_early_data(ctx->sess) >= ctx->early_len) {
+        size_t written;
+
+        ret = SSL_write_early_data(ssl, ctx->early_data, ctx->early_len,
+                                   &written);
+        if (ret != 1 || written != ctx->early_len) {
+            error_ossl(sock, ret);
+            SSL_free(ssl);
+            sock->ssl = NULL;
+            return NE_SOCK_ERROR;
+        }
+    }
+#endif
+
     ret = SSL_connect(ssl);
     if (ret != 1) {
 	error_ossl(sock, ret);
@@ -1757,6 +1785,15 @@ int ne_sock_connect_ssl(ne_socket *sock, ne_ssl_context *ctx, void *userdata)
 	sock->ssl = NULL;
 	return NE_SOCK_ERROR;
     }
+
+#ifdef SSL_EARLY_DATA_ACCEPTED
+    if (ctx->early_data) {
+        ctx->early_accepted =
+            SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED;
+        NE_DEBUG(NE_DBG_SSL, "ssl: Early data %s.\n",
+                 ctx->early_accepted ? "accepted" : "not accepted");
+    }
+#endif
 #elif defined(HAVE_GNUTLS)
     /* DH and RSA params are set in ne_ssl_context_create */
     gnutls_init(&sock->ssl, GNUTLS_CLIENT);
@@ -1833,25 +1870,26 @@ int ne_sock_sessid(ne_socket *sock, unsigned char *buf, size_t *buflen)
         return -1;
     }
 #else
-    SSL_SESSION *sess;
+    const unsigned char *id;
+    unsigned int idlen;
 
     if (!sock->ssl) {
         return -1;
     }
 
-    sess = SSL_get0_session(sock->ssl);
+    id = SSL_SESSION_get_id(SSL_get0_session(sock->ssl), &idlen);
 
     if (!buf) {
-        *buflen = sess->session_id_length;
+        *buflen = idlen;
         return 0;
     }
 
-    if (*buflen < sess->session_id_length) {
+    if (*buflen < idlen) {
         return -1;
     }
 
-    *buflen = sess->session_id_length;
-    memcpy(buf, sess->session_id, *buflen);
+    *buflen = idlen;
+    memcpy(buf, id, *buflen);
     return 0;
 #endif
 #else
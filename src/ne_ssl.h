@@ -185,6 +185,63 @@ void ne_ssl_context_set_flag(ne_ssl_context *ctx, int flag, int value);
 /* Destroy an SSL context. */
 void ne_ssl_context_destroy(ne_ssl_context *ctx);
 
+/* An SSL session cache holds negotiated SSL/TLS sessions (including
+ * TLS 1.3 session tickets), keyed by server hostname, port, SNI name,
+ * client certificate and trust configuration, so that connections
+ * made by any session using the cache can resume a previous session
+ * rather than performing a full handshake.  A session using a client
+ * certificate only resumes sessions negotiated with the same
+ * certificate, and a session without one only resumes sessions
+ * negotiated without a certificate, since the server treats a
+ * resumed session as authenticated by the original certificate.
+ * Likewise, since the server certificate is not presented again when
+ * a session is resumed, a session only resumes sessions negotiated
+ * with the same trusted CAs and verification callback.  The callback
+ * is identified by its address and userdata pointer, so where one is
+ * used, sessions loaded by ne_ssl_session_cache_load() are in general
+ * only resumed by the process which saved them.
+ *
+ * The cache also records server certificate chains which were
+ * verified successfully, keyed by the chain, the server hostname and
+ * the trust configuration of the session (trusted CAs and the
+ * verification callback).  A session presented with a recorded chain
+ * skips certificate verification until a certificate in the chain
+ * expires.  Chains which fail verification are never recorded, even
+ * if the verification callback accepts them, so the callback is
+ * invoked again for each new connection.
+ *
+ * If neon is built with thread-safety support, the cache may be
+ * shared by sessions in different threads. */
+typedef struct ne_ssl_session_cache_s ne_ssl_session_cache;
+
+/* Create an SSL session cache holding at most 'size' sessions; the
+ * least recently stored session is discarded when the cache is
+ * full. */
+ne_ssl_session_cache *ne_ssl_session_cache_create(unsigned int size);
+
+/* Retrieve cache statistics: the number of handshakes which resumed
+ * a cached session in *hits, and the number which did not in
+ * *misses. */
+void ne_ssl_session_cache_stats(ne_ssl_session_cache *cache,
+                                unsigned long *hits, unsigned long *misses);
+
+/* Write the contents of the cache to the file 'filename', which is
+ * created readable only by the owner since it contains session
+ * secrets.  Returns non-zero on error. */
+int ne_ssl_session_cache_save(ne_ssl_session_cache *cache,
+                              const char *filename);
+
+/* Add sessions to the cache from the file 'filename', previously
+ * written by ne_ssl_session_cache_save().  Sessions stored more than
+ * 'max_age' seconds ago are discarded.  Returns non-zero if the file
+ * cannot be read, or if it is malformed or fails an integrity check,
+ * in which case no sessions are added. */
+int ne_ssl_session_cache_load(ne_ssl_session_cache *cache,
+                              const char *filename, long max_age);
+
+/* Destroy an SSL session cache. */
+void ne_ssl_session_cache_destroy(ne_ssl_session_cache *cache);
+
 NE_END_DECLS
 
 #endif
@@ -70,31 +70,100 @@ typedef xmlChar ne_xml_char;
 /* Approx. one screen of text: */
 #define ERR_SIZE (2048)
 
+/* Default size of the input blocks returned by ne_xml_get_buffer. */
+#define BLOCK_SIZE (16384)
+
+#if defined(HAVE_EXPAT) && !defined(NEED_BOM_HANDLING)
+/* Input can be read directly into expat's own buffer. */
+#define HAVE_DIRECT_FEED
+#endif
+
 struct handler {
     ne_xml_startelm_cb *startelm_cb; /* start-element callback */
     ne_xml_endelm_cb *endelm_cb; /* end-element callback */
     ne_xml_cdata_cb *cdata_cb; /* character-data callback. */
     void *userdata; /* userdata for the above. */
+    const ne_xml_idtable *accepts; /* elements accepted, or NULL */
     struct handler *next; /* next handler in stack. */
 };
 
+/* An idtable is an open-addressed hash table of pointers into the
+ * idmap array.  The seed is chosen when the table is built such that
+ * no two entries share a slot, so a lookup needs at most one string
+ * comparison; linear probing is used only if no such seed is found. */
+struct ne_xml_idtable_s {
+    const struct ne_xml_idmap **slots;
+    unsigned int mask, seed;
+};
+
+#define IDTABLE_SEEDS (32)
+
 #ifdef HAVE_LIBXML
 static void sax_error(void *ctx, const char *msg, ...);
 #endif
 
 struct element {
     const ne_xml_char *nspace;
-    ne_xml_char *name;
+    const ne_xml_char *name;
 
     int state; /* opaque state integer */
     
     /* Namespaces declared in this element */
-    ne_xml_char *default_ns; /* A default namespace */
+    const ne_xml_char *default_ns; /* A default namespace */
     struct namespace *nspaces; /* List of other namespace scopes */
 
     struct handler *handler; /* Handler for this element */
 
     struct element *parent; /* parent element, or NULL */    
+
+    /* Non-zero if name or default_ns respectively were not interned,
+     * and must be freed with the element. */
+    unsigned int name_owned:1, default_ns_owned:1;
+};
+
+/* Element names, namespace prefixes and namespace URIs are interned
+ * in a per-parser string pool, since a typical document uses a small
+ * set of names repeatedly.  The pool size is bounded; once full,
+ * strings are duplicated per-element as needed. */
+#define INTERN_HASHSIZE (128)
+#define INTERN_MAXBYTES (32768)
+
+struct interned {
+    struct interned *next;
+    unsigned int hash;
+    size_t len;
+    const ne_xml_char *str; /* points to storage following struct */
+};
+
+/* The built-in tokenizer handles the subset of XML used in WebDAV
+ * responses: UTF-8 documents with no document type declaration.  It
+ * passes events to the same start_element, end_element and char_data
+ * callbacks as the XML parser library.  Until the root element is
+ * found, input is saved in 'prolog'; if the prolog includes anything
+ * which the tokenizer does not handle, the saved input is passed to
+ * the XML parser library, which is then used for the remainder of
+ * the document. */
+struct fastparse {
+    enum {
+        fast_prolog = 0, /* before the root element */
+        fast_content, /* within the root element */
+        fast_epilog, /* after the root element */
+        fast_fallback /* the XML parser library must be used */
+    } state;
+    ne_buffer *pending; /* incomplete input carried between blocks */
+    ne_buffer *prolog; /* input consumed before the root element */
+    ne_buffer *scratch; /* decoded names and values of a start tag */
+    ne_buffer *names; /* names of the open elements */
+    size_t *stack; /* offset of each open element's name in 'names' */
+    size_t *offsets; /* offsets of attribute strings in 'scratch' */
+    const char **atts; /* attribute array passed to start_element */
+    int *attset; /* hash set of attribute names, for duplicate checks */
+    int depth, stackalloc, attsalloc;
+    /* Amount of an incomplete markup token at the start of 'pending'
+     * which has been scanned, and the quote state at that point. */
+    size_t scanned;
+    char quote;
+    int line;
 };
 
 /* We pass around a ne_xml_parser as the userdata in the parsing
@@ -105,6 +174,10 @@ struct element {
 struct ne_xml_parser_s {
     struct element *root; /* the root of the document */
     struct element *current; /* current element in the branch */
+    struct element *spare; /* list of free element structures */
+    struct namespace *spare_ns; /* list of free namespace structures */
+    struct interned *interned[INTERN_HASHSIZE]; /* string pool */
+    size_t intern_bytes; /* bytes used by string pool */
     struct handler *top_handlers; /* always points at the 
 					   * handler on top of the stack. */
     int failure; /* zero whilst parse should continue */
@@ -116,10 +189,17 @@ struct ne_xml_parser_s {
 
 #ifdef HAVE_EXPAT
     XML_Parser parser;
-    char *encoding;
 #else
     xmlParserCtxtPtr parser;
 #endif
+    char *encoding; /* document encoding, if known */
+    struct fastparse *fast; /* built-in tokenizer state, or NULL */
+    ne_buffer *cdata; /* coalesced character data, or NULL */
+    size_t cdata_batch; /* delivery threshold for coalesced data */
+    char *feedbuf; /* input buffer for ne_xml_get_buffer */
+    size_t feedlen; /* allocated size of feedbuf */
+    size_t blocksize; /* size of blocks returned by ne_xml_get_buffer */
+    int direct; /* non-zero if input was read into expat's buffer */
     char error[ERR_SIZE];
 };
 
@@ -127,16 +207,81 @@ struct ne_xml_parser_s {
 static void start_element(void *userdata, const ne_xml_char *name, const ne_xml_char **atts);
 static void end_element(void *userdata, const ne_xml_char *name);
 static void char_data(void *userdata, const ne_xml_char *cdata, int len);
+static void flush_cdata(ne_xml_parser *p);
 static const char *resolve_nspace(const struct element *elm, 
                                   const char *prefix, size_t pfxlen);
 
 /* Linked list of namespace scopes */
 struct namespace {
-    ne_xml_char *name;
-    ne_xml_char *uri;
+    const ne_xml_char *name;
+    const ne_xml_char *uri;
+    size_t namelen; /* length of name */
+    int owned; /* non-zero if name and uri must be freed */
     struct namespace *next;
 };
 
+static unsigned int idmap_key(const char *nspace, const char *name);
+static int idtable_find(const ne_xml_idtable *t, unsigned int key,
+                        const char *nspace, const char *name);
+
+/* Returns a hash of the 'len' bytes at 'str'. */
+static unsigned int hash_string(const char *str, size_t len)
+{
+    unsigned int hash = 0;
+    size_t n;
+
+    for (n = 0; n < len; n++)
+        hash = hash * 33 + (unsigned char)str[n];
+
+    return hash;
+}
+
+/* Returns the interned copy of the 'len' bytes at 'str', or NULL if
+ * the string pool is full. */
+static const ne_xml_char *intern(ne_xml_parser *p, const ne_xml_char *str,
+                                 size_t len)
+{
+    struct interned *in;
+    unsigned int hash = hash_string((const char *)str, len);
+
+    for (in = p->interned[hash % INTERN_HASHSIZE]; in; in = in->next) {
+        if (in->hash == hash && in->len == len 
+            && memcmp(in->str, str, len) == 0)
+            return in->str;
+    }
+
+    if (p->intern_bytes + len > INTERN_MAXBYTES)
+        return NULL;
+
+    in = ne_malloc(sizeof *in + len + 1);
+    in->str = (ne_xml_char *)(in + 1);
+    memcpy((ne_xml_char *)in->str, str, len);
+    ((ne_xml_char *)in->str)[len] = '\0';
+    in->len = len;
+    in->hash = hash;
+    in->next = p->interned[hash % INTERN_HASHSIZE];
+    p->interned[hash % INTERN_HASHSIZE] = in;
+    p->intern_bytes += sizeof *in + len + 1;
+
+    return in->str;
+}
+
+/* Returns an interned copy of 'str' if possible, otherwise a
+ * malloc-allocated copy, in which case *owned is set to 1. */
+static const ne_xml_char *intern_or_dup(ne_xml_parser *p, 
+                                        const ne_xml_char *str,
+                                        unsigned int *owned)
+{
+    const ne_xml_char *ret = intern(p, str, strlen(str));
+
+    if (ret == NULL) {
+        *owned = 1;
+        ret = ne_strdup(str);
+    }
+
+    return ret;
+}
+
 #ifdef HAVE_LIBXML
 
 /* Could be const as far as we care, but libxml doesn't want that */
@@ -185,13 +330,14 @@ static void decl_handler(void *userdata,
 			 int standalone)
 {
     ne_xml_parser *p = userdata;
-    if (encoding) p->encoding = ne_strdup(encoding);    
+    if (encoding) p->encoding = ne_strdup(encoding);
 }
 
 #endif /* HAVE_LIBXML */
 
 int ne_xml_currentline(ne_xml_parser *p) 
 {
+    if (p->fast) return p->fast->line;
 #ifdef HAVE_EXPAT
     return XML_GetCurrentLineNumber(p->parser);
 #else
@@ -202,7 +348,8 @@ int ne_xml_currentline(ne_xml_parser *p)
 const char *ne_xml_doc_encoding(const ne_xml_parser *p)
 {
 #ifdef HAVE_LIBXML
-    return p->parser->encoding;
+    if (p->encoding) return p->encoding;
+    return (const char *)p->parser->encoding;
 #else
     return p->encoding;
 #endif
@@ -231,10 +378,16 @@ static int declare_nspaces(ne_xml_parser *p, struct element *elm,
     
     for (n = 0; atts && atts[n]; n += 2) {
         if (strcmp(atts[n], "xmlns") == 0) {
+            unsigned int owned = 0;
+
             /* New default namespace */
-            elm->default_ns = ne_strdup(atts[n+1]);
+            if (elm->default_ns_owned)
+                ne_free((ne_xml_char *)elm->default_ns);
+            elm->default_ns = intern_or_dup(p, atts[n+1], &owned);
+            elm->default_ns_owned = owned;
         } else if (strncmp(atts[n], "xmlns:", 6) == 0) {
             struct namespace *ns;
+            unsigned int owned = 0;
             
             /* Reject some invalid NCNames as namespace prefix, and an
              * empty URI as the namespace URI */
@@ -246,11 +399,25 @@ static int declare_nspaces(ne_xml_parser *p, struct element *elm,
             }
 
             /* New namespace scope */
-            ns = ne_calloc(sizeof(*ns));
+            if (p->spare_ns) {
+                ns = p->spare_ns;
+                p->spare_ns = ns->next;
+            }
+            else {
+                ns = ne_malloc(sizeof(*ns));
+            }
             ns->next = elm->nspaces;
             elm->nspaces = ns;
-            ns->name = ne_strdup(atts[n]+6); /* skip the xmlns= */
-            ns->uri = ne_strdup(atts[n+1]);
+            ns->name = intern_or_dup(p, atts[n]+6, &owned); /* skip xmlns: */
+            if (owned) {
+                ns->uri = ne_strdup(atts[n+1]);
+            }
+            else {
+                ns->uri = intern_or_dup(p, atts[n+1], &owned);
+                if (owned) ns->name = ne_strdup(ns->name);
+            }
+            ns->owned = owned;
+            ns->namelen = strlen(ns->name);
         }
     }
     
@@ -263,6 +430,7 @@ static int expand_qname(ne_xml_parser *p, struct element *elm,
                         const ne_xml_char *qname)
 {
     const ne_xml_char *pfx;
+    unsigned int owned = 0;
 
     pfx = strchr(qname, ':');
     if (pfx == NULL) {
@@ -273,7 +441,8 @@ static int expand_qname(ne_xml_parser *p, struct element *elm,
         while (e->default_ns == NULL)
             e = e->parent;
         
-        elm->name = ne_strdup(qname);
+        elm->name = intern_or_dup(p, qname, &owned);
+        elm->name_owned = owned;
         elm->nspace = e->default_ns;
     } else if (invalid_ncname(pfx + 1) || qname == pfx) {
         ne_snprintf(p->error, ERR_SIZE, 
@@ -284,7 +453,8 @@ static int expand_qname(ne_xml_parser *p, struct element *elm,
         const char *uri = resolve_nspace(elm, qname, pfx-qname);
 
 	if (uri) {
-	    elm->name = ne_strdup(pfx+1);
+	    elm->name = intern_or_dup(p, pfx+1, &owned);
+            elm->name_owned = owned;
             elm->nspace = uri;
 	} else {
 	    ne_snprintf(p->error, ERR_SIZE, 
@@ -303,7 +473,8 @@ static void start_element(void *userdata, const ne_xml_char *name,
     ne_xml_parser *p = userdata;
     struct element *elm;
     struct handler *hand;
-    int state = NE_XML_DECLINE;
+    int state = NE_XML_DECLINE, haskey = 0;
+    unsigned int key = 0;
 
     if (p->failure) return;
     
@@ -312,8 +483,20 @@ static void start_element(void *userdata, const ne_xml_char *name,
         return;
     }
 
-    /* Create a new element */
-    elm = ne_calloc(sizeof *elm);
+    if (p->cdata) {
+        flush_cdata(p);
+        if (p->failure) return;
+    }
+
+    /* Create a new element, reusing a free structure if possible */
+    if (p->spare) {
+        elm = p->spare;
+        p->spare = elm->parent;
+        memset(elm, 0, sizeof *elm);
+    }
+    else {
+        elm = ne_calloc(sizeof *elm);
+    }
     elm->parent = p->current;
     p->current = elm;
 
@@ -325,6 +508,18 @@ static void start_element(void *userdata, const ne_xml_char *name,
     /* Find a handler which will accept this element (or abort the parse) */
     for (hand = elm->parent->handler; hand && state == NE_XML_DECLINE;
          hand = hand->next) {
+        /* Skip any handler which is known to decline this element;
+         * the key is computed at most once per element. */
+        if (hand->accepts) {
+            if (!haskey) {
+                key = idmap_key((const char *)elm->nspace, 
+                                (const char *)elm->name);
+                haskey = 1;
+            }
+            if (idtable_find(hand->accepts, key, (const char *)elm->nspace,
+                             (const char *)elm->name) == 0)
+                continue;
+        }
         elm->handler = hand;
         state = hand->startelm_cb(hand->userdata, elm->parent->state,
                                   elm->nspace, elm->name, PASS_ATTS(atts));
@@ -342,33 +537,38 @@ static void start_element(void *userdata, const ne_xml_char *name,
         p->failure = state;
 }
 
-/* Destroys an element structure. */
-static void destroy_element(struct element *elm) 
+/* Destroys an element structure, placing it and its namespace
+ * structures on the parser's free lists. */
+static void destroy_element(ne_xml_parser *p, struct element *elm) 
 {
     struct namespace *this_ns, *next_ns;
-    ne_free(elm->name);
+
+    if (elm->name_owned)
+        ne_free((ne_xml_char *)elm->name);
     /* Free the namespaces */
     this_ns = elm->nspaces;
     while (this_ns != NULL) {
 	next_ns = this_ns->next;
-	ne_free(this_ns->name);
-	ne_free(this_ns->uri);
-	ne_free(this_ns);
+        if (this_ns->owned) {
+            ne_free((ne_xml_char *)this_ns->name);
+            ne_free((ne_xml_char *)this_ns->uri);
+        }
+        this_ns->next = p->spare_ns;
+        p->spare_ns = this_ns;
 	this_ns = next_ns;
     }
-    if (elm->default_ns)
-        ne_free(elm->default_ns);
-    ne_free(elm);
+    if (elm->default_ns_owned)
+        ne_free((ne_xml_char *)elm->default_ns);
+    elm->parent = p->spare;
+    p->spare = elm;
 }
 
-/* cdata SAX callback */
-static void char_data(void *userdata, const ne_xml_char *data, int len) 
+/* Pass character data to the handler for the current element. */
+static void deliver_cdata(ne_xml_parser *p, const ne_xml_char *data, 
+                          size_t len)
 {
-    ne_xml_parser *p = userdata;
     struct element *elm = p->current;
 
-    if (p->failure || p->prune) return;
-    
     if (elm->handler->cdata_cb) {
         p->failure = elm->handler->cdata_cb(elm->handler->userdata, elm->state, data, len);
         NE_DEBUG(NE_DBG_XML, "XML: char-data (%d) returns %d\n", 
@@ -376,6 +576,32 @@ static void char_data(void *userdata, const ne_xml_char *data, int len)
     }        
 }
 
+/* Deliver any coalesced character data. */
+static void flush_cdata(ne_xml_parser *p)
+{
+    if (p->cdata->used > 1) {
+        deliver_cdata(p, p->cdata->data, p->cdata->used - 1);
+        ne_buffer_clear(p->cdata);
+    }
+}
+
+/* cdata SAX callback */
+static void char_data(void *userdata, const ne_xml_char *data, int len) 
+{
+    ne_xml_parser *p = userdata;
+
+    if (p->failure || p->prune) return;
+
+    if (p->cdata) {
+        ne_buffer_append(p->cdata, data, len);
+        if (p->cdata->used > p->cdata_batch)
+            flush_cdata(p);
+    }
+    else {
+        deliver_cdata(p, data, len);
+    }
+}
+
 /* Called with the end of an element */
 static void end_element(void *userdata, const ne_xml_char *name) 
 {
@@ -386,12 +612,19 @@ static void end_element(void *userdata, const ne_xml_char *name)
 	
     if (p->prune) {
         if (p->prune-- > 1) return;
-    } else if (elm->handler->endelm_cb) {
-        p->failure = elm->handler->endelm_cb(elm->handler->userdata, elm->state,
-                                             elm->nspace, elm->name);
-        if (p->failure) {
-            NE_DEBUG(NE_DBG_XML, "XML: end-element for %d failed with %d.\n", 
-                     elm->state, p->failure);
+    } else {
+        if (p->cdata) {
+            flush_cdata(p);
+            if (p->failure) return;
+        }
+        if (elm->handler->endelm_cb) {
+            p->failure = elm->handler->endelm_cb(elm->handler->userdata, 
+                                                 elm->state, elm->nspace,
+                                                 elm->name);
+            if (p->failure) {
+                NE_DEBUG(NE_DBG_XML, "XML: end-element for %d failed "
+                         "with %d.\n", elm->state, p->failure);
+            }
         }
     }
     
@@ -402,7 +635,7 @@ static void end_element(void *userdata, const ne_xml_char *name)
     p->current = elm->parent;
     p->prune = 0;
 
-    destroy_element(elm);
+    destroy_element(p, elm);
 }
 
 #if defined(HAVE_EXPAT) && XML_MAJOR_VERSION > 1
@@ -439,7 +672,7 @@ static const char *resolve_nspace(const struct element *elm,
 	const struct namespace *ns;
 	/* Iterate over defined spaces on this node. */
 	for (ns = s->nspaces; ns != NULL; ns = ns->next) {
-	    if (strlen(ns->name) == pfxlen && 
+	    if (ns->namelen == pfxlen && 
 		memcmp(ns->name, prefix, pfxlen) == 0)
 		return ns->uri;
 	}
@@ -471,6 +704,7 @@ ne_xml_parser *ne_xml_create(void)
     p->current = p->root = ne_calloc(sizeof *p->root);
     p->root->default_ns = "";
     p->root->state = 0;
+    p->blocksize = BLOCK_SIZE;
     strcpy(p->error, _("Unknown error"));
 #ifdef HAVE_EXPAT
     p->parser = XML_ParserCreate(NULL);
@@ -536,6 +770,11 @@ void ne_xml_push_handler(ne_xml_parser *p,
     }
 }
 
+void ne_xml_handler_accepts(ne_xml_parser *p, const ne_xml_idtable *table)
+{
+    p->top_handlers->accepts = table;
+}
+
 int ne_xml_parse_v(void *userdata, const char *block, size_t len) 
 {
     ne_xml_parser *p = userdata;
@@ -544,9 +783,939 @@ int ne_xml_parse_v(void *userdata, const char *block, size_t len)
 
 #define BOM_UTF8 "\xEF\xBB\xBF" /* UTF-8 BOM */
 
+static int parse_backend(ne_xml_parser *p, const char *block, size_t len);
+
+static void destroy_fastparse(struct fastparse *f)
+{
+    ne_buffer_destroy(f->pending);
+    ne_buffer_destroy(f->prolog);
+    ne_buffer_destroy(f->scratch);
+    ne_buffer_destroy(f->names);
+    if (f->stack) ne_free(f->stack);
+    if (f->offsets) ne_free(f->offsets);
+    if (f->atts) ne_free(f->atts);
+    if (f->attset) ne_free(f->attset);
+    ne_free(f);
+}
+
+void ne_xml_set_fastparse(ne_xml_parser *p, int enable)
+{
+    if (enable && p->fast == NULL) {
+        p->fast = ne_calloc(sizeof *p->fast);
+        p->fast->pending = ne_buffer_create();
+        p->fast->prolog = ne_buffer_create();
+        p->fast->scratch = ne_buffer_create();
+        p->fast->names = ne_buffer_create();
+        p->fast->line = 1;
+    }
+    else if (!enable && p->fast) {
+        destroy_fastparse(p->fast);
+        p->fast = NULL;
+    }
+}
+
+void ne_xml_coalesce_cdata(ne_xml_parser *p, size_t batch)
+{
+    if (batch && p->cdata == NULL) {
+        p->cdata = ne_buffer_create();
+    }
+    else if (batch == 0 && p->cdata) {
+        if (p->failure == 0) flush_cdata(p);
+        ne_buffer_destroy(p->cdata);
+        p->cdata = NULL;
+    }
+    p->cdata_batch = batch;
+}
+
+static void fast_error(ne_xml_parser *p, const char *msg)
+{
+    if (p->failure == 0) {
+        ne_snprintf(p->error, ERR_SIZE, "XML parse error at line %d: %s",
+                    p->fast->line, msg);
+        p->failure = 1;
+        NE_DEBUG(NE_DBG_XMLPARSE, "XML: Parse error: %s\n", p->error);
+    }
+}
+
+/* Character classes for the tokenizer: CC_TEXT is set for characters
+ * which end a run of plain character data, CC_TAG for those which
+ * need attention within a tag.  Both are set for control characters
+ * and bytes of multi-byte UTF-8 sequences, which must be checked. */
+#define CC_TEXT (1)
+#define CC_TAG (2)
+
+static const unsigned char charclass[256] = {
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    0, 0, 2, 0, 0, 0, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 3, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3
+};
+
+/* Returns the length of the valid UTF-8 encoded XML character at 's',
+ * of at most 'len' bytes; zero if the sequence is truncated by the
+ * end of the buffer, or -1 if it is not a valid character. */
+static int utf8_char(const unsigned char *s, size_t len)
+{
+    unsigned int ch = s[0], min;
+    int n, i;
+
+    if (ch < 0x80) {
+        return (ch >= 0x20 || ch == '\t' || ch == '\n' || ch == '\r') ? 1 : -1;
+    }
+    else if (ch < 0xC2) {
+        return -1;
+    }
+    else if (ch < 0xE0) {
+        n = 2; ch &= 0x1F; min = 0x80;
+    }
+    else if (ch < 0xF0) {
+        n = 3; ch &= 0x0F; min = 0x800;
+    }
+    else if (ch < 0xF5) {
+        n = 4; ch &= 0x07; min = 0x10000;
+    }
+    else {
+        return -1;
+    }
+
+    for (i = 1; i < n; i++) {
+        if ((size_t)i >= len) 
+            return 0;
+        if ((s[i] & 0xC0) != 0x80)
+            return -1;
+        ch = (ch << 6) | (s[i] & 0x3F);
+    }
+
+    if (ch < min || ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF)
+        || ch == 0xFFFE || ch == 0xFFFF)
+        return -1;
+
+    return n;
+}
+
+/* Check that the 'len' bytes at 's' are valid XML characters, and
+ * count the lines.  Returns non-zero if not valid. */
+static int fast_check(ne_xml_parser *p, const char *s, size_t len)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    size_t n = 0;
+
+    while (n < len) {
+        if (u[n] >= 0x20 && u[n] < 0x80) {
+            n++;
+        }
+        else {
+            int k = utf8_char(u + n, len - n);
+
+            if (k <= 0) {
+                fast_error(p, "not well-formed (invalid token)");
+                return -1;
+            }
+            if (u[n] == '\n') p->fast->line++;
+            n += k;
+        }
+    }
+
+    return 0;
+}
+
+/* Encode character 'ch' as UTF-8 in 'buf'; returns the length. */
+static int utf8_encode(unsigned int ch, char *buf)
+{
+    if (ch < 0x80) {
+        buf[0] = (char)ch;
+        return 1;
+    }
+    else if (ch < 0x800) {
+        buf[0] = (char)(0xC0 | (ch >> 6));
+        buf[1] = (char)(0x80 | (ch & 0x3F));
+        return 2;
+    }
+    else if (ch < 0x10000) {
+        buf[0] = (char)(0xE0 | (ch >> 12));
+        buf[1] = (char)(0x80 | ((ch >> 6) & 0x3F));
+        buf[2] = (char)(0x80 | (ch & 0x3F));
+        return 3;
+    }
+    else {
+        buf[0] = (char)(0xF0 | (ch >> 18));
+        buf[1] = (char)(0x80 | ((ch >> 12) & 0x3F));
+        buf[2] = (char)(0x80 | ((ch >> 6) & 0x3F));
+        buf[3] = (char)(0x80 | (ch & 0x3F));
+        return 4;
+    }
+}
+
+/* Decode the character or entity reference 'ref' of length 'len',
+ * excluding the '&' and ';' delimiters, into 'buf'.  Returns the
+ * length of the decoded value, or -1 if the reference is invalid. */
+static int decode_reference(const char *ref, size_t len, char *buf)
+{
+    static const struct {
+        const char *name;
+        char value;
+    } entities[] = {
+        { "lt", '<' }, { "gt", '>' }, { "amp", '&' },
+        { "quot", '"' }, { "apos", '\'' }
+    };
+    unsigned int ch = 0;
+    size_t n;
+
+    if (len > 1 && ref[0] == '#') {
+        int hex = ref[1] == 'x';
+
+        if (len == (size_t)(1 + hex) || len > 10) 
+            return -1;
+
+        for (n = 1 + hex; n < len; n++) {
+            char c = ref[n];
+
+            if (c >= '0' && c <= '9')
+                ch = ch * (hex ? 16 : 10) + (c - '0');
+            else if (hex && c >= 'a' && c <= 'f')
+                ch = ch * 16 + (c - 'a' + 10);
+            else if (hex && c >= 'A' && c <= 'F')
+                ch = ch * 16 + (c - 'A' + 10);
+            else
+                return -1;
+            if (ch > 0x10FFFF)
+                return -1;
+        }
+
+        if ((ch < 0x20 && ch != '\t' && ch != '\n' && ch != '\r')
+            || (ch >= 0xD800 && ch <= 0xDFFF) || ch == 0xFFFE || ch == 0xFFFF)
+            return -1;
+
+        return utf8_encode(ch, buf);
+    }
+
+    for (n = 0; n < sizeof entities / sizeof entities[0]; n++) {
+        if (strlen(entities[n].name) == len 
+            && memcmp(entities[n].name, ref, len) == 0) {
+            buf[0] = entities[n].value;
+            return 1;
+        }
+    }
+
+    return -1;
+}
+
+/* Returns non-zero if 'c' can appear in an XML name; non-ASCII
+ * characters are not checked further. */
+#define NAME_CH(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') \
+                    || ((c) >= '0' && (c) <= '9') || (c) == '_' || (c) == ':' \
+                    || (c) == '-' || (c) == '.' || ((unsigned char)(c) >= 0x80))
+/* Returns non-zero if 'c' can start an XML name. */
+#define NAME_CH1(c) (NAME_CH(c) && !((c) >= '0' && (c) <= '9') \
+                     && (c) != '-' && (c) != '.')
+#define SPACE_CH(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+/* Returns the length of the XML name at 's', of at most 'len'
+ * bytes; zero if there is no valid name. */
+static size_t name_length(const char *s, size_t len)
+{
+    size_t n = 0;
+
+    if (len == 0 || !NAME_CH1(s[0]))
+        return 0;
+
+    while (n < len && NAME_CH(s[n]))
+        n++;
+
+    return n;
+}
+
+/* Append a string to the scratch buffer, recording its offset. */
+static void scratch_add(struct fastparse *f, int n, const char *s, size_t len)
+{
+    if (n + 1 >= f->attsalloc) {
+        f->attsalloc = f->attsalloc ? f->attsalloc * 2 : 16;
+        f->offsets = ne_realloc(f->offsets, f->attsalloc * sizeof *f->offsets);
+        f->atts = ne_realloc(f->atts, f->attsalloc * sizeof *f->atts);
+        f->attset = ne_realloc(f->attset, f->attsalloc * sizeof *f->attset);
+    }
+    f->offsets[n] = f->scratch->used - 1;
+    ne_buffer_append(f->scratch, s, len);
+    ne_buffer_append(f->scratch, "", 1);
+}
+
+/* Decode attribute value 'value' of length 'len' into the scratch
+ * buffer.  Returns non-zero if the value is not valid. */
+static int decode_attr(struct fastparse *f, int n, const char *value, size_t len)
+{
+    size_t i, start = 0;
+    char buf[4];
+
+    scratch_add(f, n, "", 0);
+    f->scratch->used--; /* remove the NUL separator again */
+
+    for (i = 0; i <= len; i++) {
+        int k;
+        const char *semi;
+
+        if (i < len && value[i] != '&' && value[i] != '<' 
+            && !SPACE_CH(value[i]))
+            continue;
+
+        ne_buffer_append(f->scratch, value + start, i - start);
+        if (i == len)
+            break;
+
+        switch (value[i]) {
+        case '<':
+            return -1;
+        case '&':
+            semi = memchr(value + i, ';', len - i);
+            if (semi == NULL)
+                return -1;
+            k = decode_reference(value + i + 1, semi - value - i - 1, buf);
+            if (k < 0)
+                return -1;
+            ne_buffer_append(f->scratch, buf, k);
+            i = semi - value;
+            break;
+        default:
+            /* Normalize whitespace, treating CRLF as one character. */
+            if (value[i] == '\r' && i + 1 < len && value[i + 1] == '\n')
+                i++;
+            ne_buffer_append(f->scratch, " ", 1);
+            break;
+        }
+        start = i + 1;
+    }
+
+    ne_buffer_append(f->scratch, "", 1);
+    return 0;
+}
+
+/* Returns non-zero if an attribute name is repeated in the 'n'
+ * strings (names and values) of the attribute array. */
+static int duplicate_atts(struct fastparse *f, int n)
+{
+    unsigned int size = 4, mask, slot;
+    int m;
+
+    /* Size the set at twice the number of names or more; 'attset'
+     * has room since 'attsalloc' is a power of two above n. */
+    while ((int)size < n)
+        size *= 2;
+    mask = size - 1;
+    memset(f->attset, 0, size * sizeof *f->attset);
+
+    for (m = 0; m < n; m += 2) {
+        slot = hash_string(f->atts[m], strlen(f->atts[m])) & mask;
+
+        while (f->attset[slot]) {
+            if (strcmp(f->atts[f->attset[slot] - 1], f->atts[m]) == 0)
+                return 1;
+            slot = (slot + 1) & mask;
+        }
+        f->attset[slot] = m + 1;
+    }
+
+    return 0;
+}
+
+/* Process a start tag 's' of length 'len', excluding the '<' and the
+ * '>' or '/>' delimiters.  'empty' is non-zero for an empty element
+ * tag.  Returns non-zero on error. */
+static int fast_start_tag(ne_xml_parser *p, const char *s, size_t len, 
+                          int empty)
+{
+    struct fastparse *f = p->fast;
+    size_t i, nlen = name_length(s, len);
+    int n = 1, m;
+
+    if (nlen == 0) 
+        goto invalid;
+
+    ne_buffer_clear(f->scratch);
+    scratch_add(f, 0, s, nlen);
+    i = nlen;
+
+    for (;;) {
+        size_t alen, vstart;
+        char quote;
+
+        if (i < len && !SPACE_CH(s[i]))
+            goto invalid;
+        while (i < len && SPACE_CH(s[i]))
+            i++;
+        if (i == len)
+            break;
+
+        alen = name_length(s + i, len - i);
+        if (alen == 0) 
+            goto invalid;
+        scratch_add(f, n, s + i, alen);
+        i += alen;
+
+        while (i < len && SPACE_CH(s[i])) i++;
+        if (i == len || s[i] != '=') goto invalid;
+        i++;
+        while (i < len && SPACE_CH(s[i])) i++;
+        if (i == len || (s[i] != '"' && s[i] != '\''))
+            goto invalid;
+
+        quote = s[i++];
+        vstart = i;
+        while (i < len && s[i] != quote)
+            i++;
+        if (i == len || decode_attr(f, n + 1, s + vstart, i - vstart))
+            goto invalid;
+        i++;
+        n += 2;
+    }
+
+    /* Build the attribute array, now the scratch buffer is complete. */
+    for (m = 1; m < n; m++)
+        f->atts[m - 1] = f->scratch->data + f->offsets[m];
+    f->atts[n - 1] = NULL;
+
+    if (n > 3 && duplicate_atts(f, n - 1)) {
+        fast_error(p, "duplicate attribute");
+        return -1;
+    }
+
+    if (f->state == fast_prolog) {
+        f->state = fast_content;
+        ne_buffer_clear(f->prolog);
+    }
+
+    start_element(p, (const ne_xml_char *)f->scratch->data, 
+                  (const ne_xml_char **)f->atts);
+
+    if (empty) {
+        end_element(p, (const ne_xml_char *)f->scratch->data);
+    }
+    else {
+        if (f->depth == f->stackalloc) {
+            f->stackalloc = f->stackalloc ? f->stackalloc * 2 : 16;
+            f->stack = ne_realloc(f->stack, f->stackalloc * sizeof *f->stack);
+        }
+        f->stack[f->depth++] = f->names->used - 1;
+        ne_buffer_append(f->names, s, nlen);
+        ne_buffer_append(f->names, "", 1);
+    }
+
+    if (f->depth == 0)
+        f->state = fast_epilog;
+
+    return 0;
+
+invalid:
+    fast_error(p, "not well-formed (invalid token)");
+    return -1;
+}
+
+/* Process an end tag 's' of length 'len', excluding the '</' and '>'
+ * delimiters. */
+static int fast_end_tag(ne_xml_parser *p, const char *s, size_t len)
+{
+    struct fastparse *f = p->fast;
+    size_t nlen = name_length(s, len), i;
+    const char *name;
+
+    for (i = nlen; i < len && SPACE_CH(s[i]); i++)
+        /* nothing */;
+
+    if (nlen == 0 || i != len || f->state != fast_content) {
+        fast_error(p, "not well-formed (invalid token)");
+        return -1;
+    }
+
+    name = f->names->data + f->stack[f->depth - 1];
+    if (strlen(name) != nlen || memcmp(name, s, nlen) != 0) {
+        fast_error(p, "mismatched tag");
+        return -1;
+    }
+
+    end_element(p, (const ne_xml_char *)name);
+
+    f->names->used = f->stack[--f->depth] + 1;
+    f->names->data[f->names->used - 1] = '\0';
+
+    if (f->depth == 0)
+        f->state = fast_epilog;
+
+    return 0;
+}
+
+/* Deliver character data 's' of length 'len', which has been
+ * checked, normalizing line endings. */
+static void fast_text(ne_xml_parser *p, const char *s, size_t len)
+{
+    const char *cr;
+
+    while (len > 0 && p->failure == 0 
+           && (cr = memchr(s, '\r', len)) != NULL) {
+        if (cr > s)
+            char_data(p, (const ne_xml_char *)s, cr - s);
+        char_data(p, (const ne_xml_char *)"\n", 1);
+        if (cr + 1 < s + len && cr[1] == '\n')
+            cr++;
+        len -= cr + 1 - s;
+        s = cr + 1;
+    }
+
+    if (len > 0 && p->failure == 0)
+        char_data(p, (const ne_xml_char *)s, len);
+}
+
+/* Returns a pointer to the end of the first occurrence of 'needle' in
+ * the 'len' bytes at 's', or NULL. */
+static const char *find_string(const char *s, size_t len, const char *needle)
+{
+    size_t nlen = strlen(needle);
+    const char *end = s + len, *q = s;
+
+    while ((q = memchr(q, needle[0], end - q)) != NULL) {
+        if ((size_t)(end - q) < nlen)
+            return NULL;
+        if (memcmp(q, needle, nlen) == 0)
+            return q + nlen;
+        q++;
+    }
+
+    return NULL;
+}
+
+/* Returns the length of the markup at 's' of at most 'len' bytes,
+ * which begins with the string 'start' and ends with 'end', or zero
+ * if incomplete. */
+static size_t delimited_length(struct fastparse *f, const char *s, size_t len,
+                               size_t startlen, const char *end)
+{
+    size_t from = startlen, endlen = strlen(end);
+    const char *q;
+
+    /* Resume the search where it stopped in the previous block. */
+    if (f->scanned > from + endlen)
+        from = f->scanned - endlen;
+
+    q = find_string(s + from, len - from, end);
+    if (q == NULL) {
+        f->scanned = len;
+        return 0;
+    }
+
+    return q - s;
+}
+
+/* Returns the length of the tag at 's' of at most 'len' bytes, or
+ * zero if incomplete or invalid.  The characters within the tag are
+ * checked as it is scanned. */
+static size_t tag_length(ne_xml_parser *p, const char *s, size_t len)
+{
+    struct fastparse *f = p->fast;
+    const unsigned char *u = (const unsigned char *)s;
+    size_t n = f->scanned ? f->scanned : 1;
+    char quote = f->quote;
+
+    while (n < len) {
+        unsigned char c = u[n];
+        int k;
+
+        if ((charclass[c] & CC_TAG) == 0) {
+            n++;
+            continue;
+        }
+
+        switch (c) {
+        case '>':
+            if (!quote)
+                return n + 1;
+            n++;
+            break;
+        case '"': case '\'':
+            if (!quote)
+                quote = c;
+            else if (quote == c)
+                quote = 0;
+            n++;
+            break;
+        default:
+            k = utf8_char(u + n, len - n);
+            if (k == 0) {
+                goto incomplete;
+            }
+            else if (k < 0) {
+                fast_error(p, "not well-formed (invalid token)");
+                return 0;
+            }
+            if (c == '\n') f->line++;
+            n += k;
+            break;
+        }
+    }
+
+incomplete:
+    f->scanned = n;
+    f->quote = quote;
+    return 0;
+}
+
+/* Process the XML declaration 's' of length 'len'.  Returns non-zero
+ * if the declaration is not in the simple form handled here, or the
+ * document encoding is not supported by the tokenizer. */
+static int fast_xmldecl(ne_xml_parser *p, const char *s, size_t len)
+{
+    static const char *const names[] = { "version", "encoding", "standalone" };
+    const char *q = s + 5, *end = s + len - 2;
+    int which = 0;
+
+    while (q < end) {
+        const char *name, *value;
+        size_t nlen, vlen;
+        char quote;
+
+        if (!SPACE_CH(*q))
+            return -1;
+        while (q < end && SPACE_CH(*q))
+            q++;
+        if (q == end)
+            break;
+
+        for (name = q; q < end && NAME_CH(*q); q++)
+            /* nothing */;
+        nlen = q - name;
+        while (q < end && SPACE_CH(*q))
+            q++;
+        if (q == end || *q++ != '=')
+            return -1;
+        while (q < end && SPACE_CH(*q))
+            q++;
+        if (q == end || (*q != '"' && *q != '\''))
+            return -1;
+        quote = *q++;
+        for (value = q; q < end && *q != quote; q++)
+            /* nothing */;
+        if (q == end)
+            return -1;
+        vlen = q++ - value;
+
+        /* The pseudo-attributes must appear in order, and only the
+         * version is mandatory. */
+        while (which < 3 && (strlen(names[which]) != nlen
+                             || memcmp(names[which], name, nlen) != 0)) {
+            if (which == 0)
+                return -1;
+            which++;
+        }
+
+        switch (which) {
+        case 0:
+            if (vlen < 3 || memcmp(value, "1.", 2) != 0
+                || strspn(value + 2, "0123456789") < vlen - 2)
+                return -1;
+            break;
+        case 1:
+            if (p->encoding) ne_free(p->encoding);
+            p->encoding = ne_strndup(value, vlen);
+            if (ne_strcasecmp(p->encoding, "UTF-8") != 0
+                && ne_strcasecmp(p->encoding, "US-ASCII") != 0)
+                return -1;
+            break;
+        case 2:
+            if (!(vlen == 3 && memcmp(value, "yes", 3) == 0)
+                && !(vlen == 2 && memcmp(value, "no", 2) == 0))
+                return -1;
+            break;
+        default:
+            return -1;
+        }
+        which++;
+    }
+
+    return which == 0;
+}
+
+/* Returns non-zero if the processing instruction 's' of length 'len'
+ * has a valid target other than the reserved "xml". */
+static int valid_pi(const char *s, size_t len)
+{
+    size_t n = name_length(s + 2, len - 4);
+
+    if (n == 0 || (n == 3 && ne_strncasecmp(s + 2, "xml", 3) == 0))
+        return 0;
+
+    return n == len - 4 || SPACE_CH(s[n + 2]);
+}
+
+/* Returns non-zero if nothing other than a byte order mark has been
+ * consumed before the root element. */
+static int prolog_empty(struct fastparse *f)
+{
+    return f->prolog->used == 1 
+        || (f->prolog->used == 4 && memcmp(f->prolog->data, BOM_UTF8, 3) == 0);
+}
+
+/* Tokenize the 'len' bytes of input at 's'; 'final' is non-zero if
+ * this is the end of the document.  Returns the number of bytes
+ * consumed; the remainder is an incomplete token. */
+static size_t fast_tokenize(ne_xml_parser *p, const char *s, size_t len,
+                            int final)
+{
+    struct fastparse *f = p->fast;
+    size_t pos = 0;
+
+    while (pos < len && p->failure == 0 && f->state != fast_fallback) {
+        const char *t = s + pos;
+        size_t rem = len - pos, n;
+
+        if (f->state == fast_prolog && f->prolog->used == 1 && rem >= 3
+            && memcmp(t, BOM_UTF8, 3) == 0) {
+            /* UTF-8 byte order mark */
+            n = 3;
+        }
+        else if (t[0] == '<') {
+            if (rem < 2 || (t[1] == '!' && rem < 9 
+                            && memcmp(t, "<![CDATA[", rem) == 0)
+                || (t[1] == '!' && rem < 4 && memcmp(t, "<!--", rem) == 0))
+                break;
+
+            if (t[1] == '?') {
+                n = delimited_length(f, t, rem, 2, "?>");
+                if (n == 0) break;
+                if (fast_check(p, t, n)) break;
+                if (f->state == fast_prolog && prolog_empty(f)
+                    && n > 6 && memcmp(t, "<?xml", 5) == 0
+                    && SPACE_CH(t[5])) {
+                    if (fast_xmldecl(p, t, n)) {
+                        f->state = fast_fallback;
+                        break;
+                    }
+                }
+                else if (!valid_pi(t, n)) {
+                    if (f->state == fast_prolog)
+                        f->state = fast_fallback;
+                    else
+                        fast_error(p, "not well-formed (invalid token)");
+                    break;
+                }
+            }
+            else if (rem >= 4 && memcmp(t, "<!--", 4) == 0) {
+                n = delimited_length(f, t, rem, 4, "-->");
+                if (n == 0) break;
+                if (fast_check(p, t, n)) break;
+                if ((n > 7 && t[n - 4] == '-')
+                    || find_string(t + 4, n - 7, "--")) {
+                    fast_error(p, "not well-formed (invalid token)");
+                    break;
+                }
+            }
+            else if (rem >= 9 && memcmp(t, "<![CDATA[", 9) == 0) {
+                n = delimited_length(f, t, rem, 9, "]]>");
+                if (n == 0) break;
+                if (f->state != fast_content) {
+                    fast_error(p, "not well-formed (invalid token)");
+                    break;
+                }
+                if (fast_check(p, t, n)) break;
+                fast_text(p, t + 9, n - 12);
+            }
+            else if (t[1] == '!') {
+                /* A document type declaration, or junk. */
+                if (f->state == fast_prolog) {
+                    f->state = fast_fallback;
+                    break;
+                }
+                fast_error(p, "not well-formed (invalid token)");
+                break;
+            }
+            else {
+                n = tag_length(p, t, rem);
+                if (n == 0) break;
+                if (t[1] == '/') {
+                    if (f->state == fast_prolog) {
+                        f->state = fast_fallback;
+                        break;
+                    }
+                    fast_end_tag(p, t + 2, n - 3);
+                }
+                else if (f->state == fast_epilog) {
+                    fast_error(p, "junk after document element");
+                }
+                else if (t[n - 2] == '/') {
+                    fast_start_tag(p, t + 1, n - 3, 1);
+                }
+                else {
+                    fast_start_tag(p, t + 1, n - 2, 0);
+                }
+            }
+            f->scanned = 0;
+            f->quote = 0;
+        }
+        else if (f->state != fast_content) {
+            /* Only whitespace is allowed outside the root element. */
+            for (n = 0; n < rem && SPACE_CH(t[n]); n++)
+                if (t[n] == '\n') f->line++;
+            if (n == 0) {
+                if (f->state == fast_prolog)
+                    f->state = fast_fallback;
+                else
+                    fast_error(p, "junk after document element");
+                break;
+            }
+        }
+        else if (t[0] == '&') {
+            const char *semi = memchr(t, ';', rem < 12 ? rem : 12);
+            char buf[4];
+            int k;
+
+            if (semi == NULL && rem < 12 && !final)
+                break;
+            
+            k = semi ? decode_reference(t + 1, semi - t - 1, buf) : -1;
+            if (k < 0) {
+                fast_error(p, "undefined entity");
+                break;
+            }
+            char_data(p, (const ne_xml_char *)buf, k);
+            n = semi + 1 - t;
+        }
+        else {
+            const unsigned char *u = (const unsigned char *)t;
+            int trunc = 0;
+            
+            /* Find the end of the run of character data, which must
+             * not end with a truncated character or a CR which may
+             * begin a CRLF pair. */
+            for (n = 0; n < rem; ) {
+                if ((charclass[u[n]] & CC_TEXT) == 0) {
+                    n++;
+                }
+                else if (u[n] == '<' || u[n] == '&') {
+                    break;
+                }
+                else if (u[n] == ']') {
+                    /* Hold back a trailing "]" or "]]" which may
+                     * begin a "]]>" sequence. */
+                    if (!final && (n + 1 == rem 
+                                   || (n + 2 == rem && u[n + 1] == ']'))) {
+                        trunc = 1;
+                        break;
+                    }
+                    n++;
+                }
+                else if (u[n] == '>') {
+                    if (n >= 2 && u[n - 1] == ']' && u[n - 2] == ']') {
+                        fast_error(p, "not well-formed (invalid token)");
+                        break;
+                    }
+                    n++;
+                }
+                else {
+                    int k = utf8_char(u + n, rem - n);
+
+                    if (k == 0 || (u[n] == '\r' && n + 1 == rem)) {
+                        trunc = !final;
+                        if (trunc) break;
+                    }
+                    if (k <= 0) {
+                        fast_error(p, "not well-formed (invalid token)");
+                        break;
+                    }
+                    if (u[n] == '\n') f->line++;
+                    n += k;
+                }
+            }
+            if (p->failure) break;
+            fast_text(p, t, n);
+            if (trunc && n == 0) break;
+        }
+
+        if (f->state == fast_prolog)
+            ne_buffer_append(f->prolog, t, n);
+        pos += n;
+    }
+
+    return pos;
+}
+
+/* Pass the saved prolog and the remaining input 's' to the XML parser
+ * library. */
+static int fallback_parse(ne_xml_parser *p, const char *s, size_t len, 
+                          int final)
+{
+    struct fastparse *f = p->fast;
+    int ret;
+
+    NE_DEBUG(NE_DBG_XMLPARSE, "XML: Using XML parser library.\n");
+
+    ne_buffer_append(f->prolog, s, len);
+    p->fast = NULL;
+
+    /* The encoding is found again by the XML parser library. */
+    if (p->encoding) {
+        ne_free(p->encoding);
+        p->encoding = NULL;
+    }
+
+    ret = parse_backend(p, f->prolog->data, f->prolog->used - 1);
+    if (ret == 0 && final)
+        ret = parse_backend(p, "", 0);
+
+    destroy_fastparse(f);
+    return ret;
+}
+
+static int fast_parse(ne_xml_parser *p, const char *block, size_t len)
+{
+    struct fastparse *f = p->fast;
+    const char *data = block;
+    size_t dlen = len, used, rest;
+    int final = len == 0;
+
+    if (f->pending->used > 1) {
+        ne_buffer_append(f->pending, block, len);
+        data = f->pending->data;
+        dlen = f->pending->used - 1;
+    }
+
+    used = fast_tokenize(p, data, dlen, final);
+
+    if (f->state == fast_fallback
+        || (final && f->state == fast_prolog && p->failure == 0)) {
+        return fallback_parse(p, data + used, dlen - used, final);
+    }
+    else if (p->failure) {
+        return p->failure;
+    }
+
+    rest = dlen - used;
+    if (final) {
+        if (rest)
+            fast_error(p, "unclosed token");
+        else if (f->state != fast_epilog)
+            fast_error(p, "no element found");
+    }
+    else if (data == f->pending->data) {
+        memmove(f->pending->data, data + used, rest);
+        f->pending->used = rest + 1;
+        f->pending->data[rest] = '\0';
+    }
+    else {
+        ne_buffer_append(f->pending, data + used, rest);
+    }
+
+    return p->failure;
+}
+
 int ne_xml_parse(ne_xml_parser *p, const char *block, size_t len) 
 {
-    int ret, flag;
     /* duck out if it's broken */
     if (p->failure) {
 	NE_DEBUG(NE_DBG_XMLPARSE, "XML: Failed; ignoring %" NE_FMT_SIZE_T 
@@ -554,14 +1723,92 @@ int ne_xml_parse(ne_xml_parser *p, const char *block, size_t len)
 	return p->failure;
     }
     if (len == 0) {
-	flag = -1;
 	block = "";
 	NE_DEBUG(NE_DBG_XMLPARSE, "XML: End of document.\n");
     } else {	
 	NE_DEBUG(NE_DBG_XMLPARSE, "XML: Parsing %" NE_FMT_SIZE_T " bytes.\n", len);
-	flag = 0;
     }
 
+    if (p->fast)
+        return fast_parse(p, block, len);
+    else
+        return parse_backend(p, block, len);
+}
+
+void ne_xml_set_block_size(ne_xml_parser *p, size_t size)
+{
+    p->blocksize = size ? size : BLOCK_SIZE;
+}
+
+char *ne_xml_get_buffer(ne_xml_parser *p, size_t *len)
+{
+    *len = p->blocksize;
+
+#ifdef HAVE_DIRECT_FEED
+    /* Unless the built-in tokenizer is in use, read the input
+     * straight into expat's buffer to avoid copying it there. */
+    if (p->fast == NULL && p->failure == 0) {
+        void *buf = XML_GetBuffer(p->parser, (int)*len);
+
+        if (buf) {
+            p->direct = 1;
+            return buf;
+        }
+    }
+#endif
+
+    p->direct = 0;
+    if (p->feedlen < *len) {
+        p->feedbuf = ne_realloc(p->feedbuf, *len);
+        p->feedlen = *len;
+    }
+    return p->feedbuf;
+}
+
+#ifdef HAVE_EXPAT
+/* Handle the return value 'ret' from XML_Parse or XML_ParseBuffer. */
+static int expat_result(ne_xml_parser *p, int ret)
+{
+    /* Note, don't write a parser error if p->failure, since an error
+     * will already have been written in that case. */
+    if (ret == 0 && p->failure == 0) {
+	ne_snprintf(p->error, ERR_SIZE,
+		    "XML parse error at line %" NE_FMT_XML_SIZE ": %s", 
+		    XML_GetCurrentLineNumber(p->parser),
+		    XML_ErrorString(XML_GetErrorCode(p->parser)));
+	p->failure = 1;
+        NE_DEBUG(NE_DBG_XMLPARSE, "XML: Parse error: %s\n", p->error);
+    }
+    return p->failure;
+}
+#endif
+
+int ne_xml_parse_buffer(ne_xml_parser *p, size_t len)
+{
+#ifdef HAVE_DIRECT_FEED
+    if (p->direct) {
+        int ret;
+
+        p->direct = 0;
+        if (p->failure) 
+            return p->failure;
+
+        NE_DEBUG(NE_DBG_XMLPARSE, "XML: Parsing %" NE_FMT_SIZE_T 
+                 " buffered bytes.\n", len);
+        ret = XML_ParseBuffer(p->parser, (int)len, len == 0);
+        NE_DEBUG(NE_DBG_XMLPARSE, "XML: XML_ParseBuffer returned %d\n", ret);
+        return expat_result(p, ret);
+    }
+#endif
+
+    return ne_xml_parse(p, p->feedbuf, len);
+}
+
+/* Pass a block of input to the XML parser library. */
+static int parse_backend(ne_xml_parser *p, const char *block, size_t len)
+{
+    int ret, flag = len == 0 ? -1 : 0;
+
 #ifdef NEED_BOM_HANDLING
     if (p->bom_pos < 3) {
         NE_DEBUG(NE_DBG_XMLPARSE, "Checking for UTF-8 BOM.\n");
@@ -582,20 +1829,13 @@ int ne_xml_parse(ne_xml_parser *p, const char *block, size_t len)
     }
 #endif
 
-    /* Note, don't write a parser error if p->failure, since an error
-     * will already have been written in that case. */
 #ifdef HAVE_EXPAT
     ret = XML_Parse(p->parser, block, len, flag);
     NE_DEBUG(NE_DBG_XMLPARSE, "XML: XML_Parse returned %d\n", ret);
-    if (ret == 0 && p->failure == 0) {
-	ne_snprintf(p->error, ERR_SIZE,
-		    "XML parse error at line %" NE_FMT_XML_SIZE ": %s", 
-		    XML_GetCurrentLineNumber(p->parser),
-		    XML_ErrorString(XML_GetErrorCode(p->parser)));
-	p->failure = 1;
-        NE_DEBUG(NE_DBG_XMLPARSE, "XML: Parse error: %s\n", p->error);
-    }
+    return expat_result(p, ret);
 #else
+    /* Note, don't write a parser error if p->failure, since an error
+     * will already have been written in that case. */
     ret = xmlParseChunk(p->parser, block, len, flag);
     NE_DEBUG(NE_DBG_XMLPARSE, "XML: xmlParseChunk returned %d\n", ret);
     /* Parse errors are normally caught by the sax_error() callback,
@@ -619,6 +1859,8 @@ void ne_xml_destroy(ne_xml_parser *p)
 {
     struct element *elm, *parent;
     struct handler *hand, *next;
+    struct namespace *ns, *next_ns;
+    int n;
 
     /* Free up the handlers on the stack: the root element has the
      * pointer to the base of the handler stack. */
@@ -630,18 +1872,42 @@ void ne_xml_destroy(ne_xml_parser *p)
     /* Clean up remaining elements */
     for (elm = p->current; elm != p->root; elm = parent) {
 	parent = elm->parent;
-	destroy_element(elm);
+	destroy_element(p, elm);
+    }
+
+    /* Free the free lists and the string pool */
+    for (elm = p->spare; elm != NULL; elm = parent) {
+        parent = elm->parent;
+        ne_free(elm);
+    }
+
+    for (ns = p->spare_ns; ns != NULL; ns = next_ns) {
+        next_ns = ns->next;
+        ne_free(ns);
+    }
+
+    for (n = 0; n < INTERN_HASHSIZE; n++) {
+        struct interned *in, *next_in;
+
+        for (in = p->interned[n]; in != NULL; in = next_in) {
+            next_in = in->next;
+            ne_free(in);
+        }
     }
 
     /* free root element */
     ne_free(p->root);
 
+    if (p->cdata) ne_buffer_destroy(p->cdata);
+
 #ifdef HAVE_EXPAT
     XML_ParserFree(p->parser);
-    if (p->encoding) ne_free(p->encoding);
 #else
     xmlFreeParserCtxt(p->parser);
 #endif
+    if (p->encoding) ne_free(p->encoding);
+    if (p->fast) destroy_fastparse(p->fast);
+    if (p->feedbuf) ne_free(p->feedbuf);
 
     ne_free(p);
 }
@@ -714,3 +1980,124 @@ int ne_xml_mapid(const struct ne_xml_idmap map[], size_t maplen,
     
     return 0;
 }
+
+/* Returns a hash of the {nspace, name} pair, independent of any
+ * table. */
+static unsigned int idmap_key(const char *nspace, const char *name)
+{
+    unsigned int h = 2166136261U;
+
+    while (*nspace)
+        h = (h ^ (unsigned char)*nspace++) * 16777619U;
+    h *= 16777619U;
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619U;
+
+    return h;
+}
+
+/* Returns the initial slot for the given key in table 't'. */
+static unsigned int idtable_slot(const ne_xml_idtable *t, unsigned int key)
+{
+    key ^= t->seed;
+    key *= 0x9E3779B1U;
+    key ^= key >> 16;
+    return key & t->mask;
+}
+
+static int idtable_find(const ne_xml_idtable *t, unsigned int key,
+                        const char *nspace, const char *name)
+{
+    unsigned int slot = idtable_slot(t, key);
+    const struct ne_xml_idmap *ent;
+
+    while ((ent = t->slots[slot]) != NULL) {
+        if (strcmp(name, ent->name) == 0 && strcmp(nspace, ent->nspace) == 0)
+            return ent->id;
+        slot = (slot + 1) & t->mask;
+    }
+    
+    return 0;
+}
+
+/* Fill the (empty) slots of table 't' from the map; returns non-zero
+ * if two entries collide and 'probe' is zero. */
+static int idtable_fill(ne_xml_idtable *t, const struct ne_xml_idmap map[],
+                        const unsigned int *keys, size_t maplen, int probe)
+{
+    size_t n;
+
+    for (n = 0; n < maplen; n++) {
+        unsigned int slot = idtable_slot(t, keys[n]);
+        const struct ne_xml_idmap *ent;
+
+        while ((ent = t->slots[slot]) != NULL) {
+            if (strcmp(map[n].name, ent->name) == 0
+                && strcmp(map[n].nspace, ent->nspace) == 0)
+                break; /* duplicate entry; the first one wins */
+            else if (!probe)
+                return -1;
+            slot = (slot + 1) & t->mask;
+        }
+
+        if (ent == NULL)
+            t->slots[slot] = &map[n];
+    }
+
+    return 0;
+}
+
+ne_xml_idtable *ne_xml_idtable_create(const struct ne_xml_idmap map[],
+                                      size_t maplen)
+{
+    ne_xml_idtable *t = ne_malloc(sizeof *t);
+    unsigned int *keys = ne_malloc((maplen + 1) * sizeof *keys);
+    unsigned int size = 8, seed;
+    size_t n;
+    
+    for (n = 0; n < maplen; n++)
+        keys[n] = idmap_key(map[n].nspace, map[n].name);
+
+    while (size < maplen * 2)
+        size <<= 1;
+
+    t->slots = NULL;
+    
+    /* Search for a collision-free seed, doubling the table size a few
+     * times if necessary. */
+    for (;;) {
+        t->mask = size - 1;
+        t->slots = ne_realloc(t->slots, size * sizeof *t->slots);
+
+        for (seed = 0; seed < IDTABLE_SEEDS; seed++) {
+            t->seed = seed * 0x61C88647U;
+            memset(t->slots, 0, size * sizeof *t->slots);
+            if (idtable_fill(t, map, keys, maplen, 0) == 0) {
+                ne_free(keys);
+                return t;
+            }
+        }
+        
+        if (size >= maplen * 16)
+            break;
+        size <<= 1;
+    }
+
+    /* Fall back on linear probing. */
+    memset(t->slots, 0, size * sizeof *t->slots);
+    idtable_fill(t, map, keys, maplen, 1);
+    ne_free(keys);
+    return t;
+}
+
+int ne_xml_idtable_lookup(const ne_xml_idtable *table,
+                          const char *nspace, const char *name)
+{
+    return idtable_find(table, idmap_key(nspace, name), nspace, name);
+}
+
+void ne_xml_idtable_destroy(ne_xml_idtable *table)
+{
+    ne_free(table->slots);
+    ne_free(table);
+}
@@ -113,6 +113,45 @@ int ne_xml_parse(ne_xml_parser *p, const char *block, size_t len);
  * (This function can be passed to ne_add_response_body_reader) */
 int ne_xml_parse_v(void *userdata, const char *block, size_t len);
 
+/* Return a buffer into which the next block of input for parser 'p'
+ * can be written; *len is set to the size of the buffer.  Where
+ * possible this is the XML parser library's own input buffer, saving
+ * a copy.  The input must then be passed to ne_xml_parse_buffer,
+ * before any other call to ne_xml_parse or ne_xml_get_buffer. */
+char *ne_xml_get_buffer(ne_xml_parser *p, size_t *len);
+
+/* Parse the first 'len' bytes of the buffer returned by the previous
+ * call to ne_xml_get_buffer; a 'len' of zero signifies the end of the
+ * document.  Returns as ne_xml_parse. */
+int ne_xml_parse_buffer(ne_xml_parser *p, size_t len);
+
+/* Set the size of the buffers returned by ne_xml_get_buffer, and
+ * hence of the blocks read by ne_xml_parse_response, to 'size'
+ * bytes; if zero, a default of 16KB is used. */
+void ne_xml_set_block_size(ne_xml_parser *p, size_t size);
+
+/* Enable use of the built-in tokenizer for the document parsed by
+ * 'p' if 'enable' is non-zero, or disable it otherwise; this must be
+ * called before any input is passed to ne_xml_parse.  The built-in
+ * tokenizer is faster than the XML parser library, and handles UTF-8
+ * documents without a document type declaration, such as WebDAV
+ * multistatus responses; for any other document, the XML parser
+ * library is used.  The same callbacks are invoked in either case.
+ * The tokenizer is enabled by ne_207_create for the parser it is
+ * passed. */
+void ne_xml_set_fastparse(ne_xml_parser *p, int enable);
+
+/* Enable coalescing of character data for parser 'p' if 'batch' is
+ * non-zero, or disable it otherwise.  When enabled, the character
+ * data within an element is collected by the parser and passed to
+ * the char-data callback in a single call, made before the next
+ * start-element or end-element callback, rather than in fragments
+ * split at entity references, line breaks or block boundaries.  A
+ * run of character data longer than 'batch' bytes is passed in
+ * several calls.  Coalescing is enabled by ne_207_create for the
+ * parser it is passed. */
+void ne_xml_coalesce_cdata(ne_xml_parser *p, size_t batch);
+
 /* Return current line of document during parsing or after parsing is
  * complete. */
 int ne_xml_currentline(ne_xml_parser *p);
@@ -157,6 +196,33 @@ struct ne_xml_idmap {
 int ne_xml_mapid(const struct ne_xml_idmap map[], size_t maplen,
                  const char *nspace, const char *name);
 
+/* A precompiled idmap, giving constant-time lookups of {nspace,
+ * name} pairs using a perfect hash.  The table references (does not
+ * copy) the strings in the idmap array from which it was built. */
+typedef struct ne_xml_idtable_s ne_xml_idtable;
+
+/* Build a lookup table from the given idmap array.  If the array
+ * contains duplicate {nspace, name} pairs, the first one is used, as
+ * with ne_xml_mapid. */
+ne_xml_idtable *ne_xml_idtable_create(const struct ne_xml_idmap map[],
+                                      size_t maplen);
+
+/* Return the 'id' corresponding to {nspace, name} in the table, or
+ * zero. */
+int ne_xml_idtable_lookup(const ne_xml_idtable *table,
+                          const char *nspace, const char *name);
+
+/* Destroy a lookup table. */
+void ne_xml_idtable_destroy(ne_xml_idtable *table);
+
+/* Register the set of elements accepted by the handler most recently
+ * pushed on parser 'p': the handler's start-element callback will
+ * then only be invoked for elements listed in 'table'; any other
+ * element is treated as declined by that handler without invoking the
+ * callback.  The table must remain valid for the lifetime of the
+ * parser. */
+void ne_xml_handler_accepts(ne_xml_parser *p, const ne_xml_idtable *table);
+
 /* media type, appropriate for adding to a Content-Type header */
 #define NE_XML_MEDIA_TYPE "application/xml"
 
@@ -41,25 +41,23 @@ static int parse_error(ne_session *sess, ne_xml_parser *parser)
 
 int ne_xml_parse_response(ne_request *req, ne_xml_parser *parser)
 {
-    char buf[8000];
     ssize_t bytes;
-    int ret = 0;
 
-    while ((bytes = ne_read_response_block(req, buf, sizeof buf)) > 0) {
-        ret = ne_xml_parse(parser, buf, bytes);
-        if (ret)
-            return parse_error(ne_get_session(req), parser);
-    }
+    /* Each block is read into the parser's buffer and parsed in
+     * place; the final zero-length read ends the document. */
+    do {
+        size_t len;
+        char *buf = ne_xml_get_buffer(parser, &len);
 
-    if (bytes == 0) {
-        /* Tell the parser that end of document was reached: */
-        if (ne_xml_parse(parser, NULL, 0) == 0)
-            return NE_OK;
-        else
+        bytes = ne_read_response_block(req, buf, len);
+        if (bytes < 0)
+            return NE_ERROR;
+
+        if (ne_xml_parse_buffer(parser, bytes))
             return parse_error(ne_get_session(req), parser);
-    } else {
-        return NE_ERROR;
-    }    
+    } while (bytes > 0);
+
+    return NE_OK;
 }
 
 /* Returns non-zero if given content-type is an XML media type,
@@ -32,7 +32,7 @@
 #include "ne_request.h"
 #include "ne_auth.h"
 #include "ne_basic.h"
-#include "ne_md5.h"
+#include "ne_hash.h"
 
 #include "tests.h"
 #include "child.h"
@@ -396,76 +396,96 @@ struct digest_parms {
         fail_ai_omit_nc,
         fail_outside_domain
     } failure;
+    unsigned int hash; /* NE_HASH_* algorithm, or zero for MD5 */
+    int userhash;
 };
 
 struct digest_state {
     const char *realm, *nonce, *uri, *username, *password, *algorithm, *qop,
         *method, *opaque;
     char *cnonce, *digest, *ncval;
+    const char *userhash;
     long nc;
 };
 
+/* Returns the algorithm name for given digest parameters. */
+static const char *digest_alg(struct digest_parms *parms)
+{
+    switch (parms->hash) {
+    case NE_HASH_SHA256:
+        return parms->md5_sess ? "SHA-256-sess" : "SHA-256";
+    case NE_HASH_SHA512_256:
+        return parms->md5_sess ? "SHA-512-256-sess" : "SHA-512-256";
+    default:
+        return parms->md5_sess ? "MD5-sess" : "MD5";
+    }
+}
+
 /* Write the request-digest into 'digest' (or response-digest if
  * auth_info is non-zero) for given digest auth state and
  * parameters.  */
 static void make_digest(struct digest_state *state, struct digest_parms *parms,
-                        int auth_info, char digest[33])
+                        int auth_info, char *digest)
 {
-    struct ne_md5_ctx *ctx;
-    char h_a1[33], h_a2[33];
+    unsigned int hash = parms->hash ? parms->hash : NE_HASH_MD5;
+    ne_hash_ctx *ctx;
+    char h_a1[NE_HASH_MAXHEX + 1], h_a2[NE_HASH_MAXHEX + 1];
 
     /* H(A1) */
-    ctx = ne_md5_create_ctx();
-    ne_md5_process_bytes(state->username, strlen(state->username), ctx);
-    ne_md5_process_bytes(":", 1, ctx);
-    ne_md5_process_bytes(state->realm, strlen(state->realm), ctx);
-    ne_md5_process_bytes(":", 1, ctx);
-    ne_md5_process_bytes(state->password, strlen(state->password), ctx);
-    ne_md5_finish_ascii(ctx, h_a1);
+    ctx = ne_hash_create(hash);
+    ne_hash_update(ctx, state->username, strlen(state->username));
+    ne_hash_update(ctx, ":", 1);
+    ne_hash_update(ctx, state->realm, strlen(state->realm));
+    ne_hash_update(ctx, ":", 1);
+    ne_hash_update(ctx, state->password, strlen(state->password));
+    ne_hash_finish_ascii(ctx, h_a1);
+    ne_hash_destroy(ctx);
 
     if (parms->md5_sess) {
-        ne_md5_reset_ctx(ctx);
-        ne_md5_process_bytes(h_a1, 32, ctx);
-        ne_md5_process_bytes(":", 1, ctx);
-        ne_md5_process_bytes(state->nonce, strlen(state->nonce), ctx);
-        ne_md5_process_bytes(":", 1, ctx);
-        ne_md5_process_bytes(state->cnonce, strlen(state->cnonce), ctx);
-        ne_md5_finish_ascii(ctx, h_a1);
+        ctx = ne_hash_create(hash);
+        ne_hash_update(ctx, h_a1, strlen(h_a1));
+        ne_hash_update(ctx, ":", 1);
+        ne_hash_update(ctx, state->nonce, strlen(state->nonce));
+        ne_hash_update(ctx, ":", 1);
+        ne_hash_update(ctx, state->cnonce, strlen(state->cnonce));
+        ne_hash_finish_ascii(ctx, h_a1);
+        ne_hash_destroy(ctx);
     }
 
     /* H(A2) */
-    ne_md5_reset_ctx(ctx);
+    ctx = ne_hash_create(hash);
     if (!auth_info)
-        ne_md5_process_bytes(state->method, strlen(state->method), ctx);
-    ne_md5_process_bytes(":", 1, ctx);
-    ne_md5_process_bytes(state->uri, strlen(state->uri), ctx);
-    ne_md5_finish_ascii(ctx, h_a2);
+        ne_hash_update(ctx, state->method, strlen(state->method));
+    ne_hash_update(ctx, ":", 1);
+    ne_hash_update(ctx, state->uri, strlen(state->uri));
+    ne_hash_finish_ascii(ctx, h_a2);
+    ne_hash_destroy(ctx);
 
     /* request-digest */
-    ne_md5_reset_ctx(ctx);
-    ne_md5_process_bytes(h_a1, strlen(h_a1), ctx);
-    ne_md5_process_bytes(":", 1, ctx);
-    ne_md5_process_bytes(state->nonce, strlen(state->nonce), ctx);
-    ne_md5_process_bytes(":", 1, ctx);
+    ctx = ne_hash_create(hash);
+    ne_hash_update(ctx, h_a1, strlen(h_a1));
+    ne_hash_update(ctx, ":", 1);
+    ne_hash_update(ctx, state->nonce, strlen(state->nonce));
+    ne_hash_update(ctx, ":", 1);
 
     if (parms->rfc2617) {
-        ne_md5_process_bytes(state->ncval, strlen(state->ncval), ctx);
-        ne_md5_process_bytes(":", 1, ctx);
-        ne_md5_process_bytes(state->cnonce, strlen(state->cnonce), ctx);
-        ne_md5_process_bytes(":", 1, ctx);
-        ne_md5_process_bytes(state->qop, strlen(state->qop), ctx);
-        ne_md5_process_bytes(":", 1, ctx);
+        ne_hash_update(ctx, state->ncval, strlen(state->ncval));
+        ne_hash_update(ctx, ":", 1);
+        ne_hash_update(ctx, state->cnonce, strlen(state->cnonce));
+        ne_hash_update(ctx, ":", 1);
+        ne_hash_update(ctx, state->qop, strlen(state->qop));
+        ne_hash_update(ctx, ":", 1);
     }
 
-    ne_md5_process_bytes(h_a2, strlen(h_a2), ctx);
-    ne_md5_finish_ascii(ctx, digest);
-    ne_md5_destroy_ctx(ctx);
+    ne_hash_update(ctx, h_a2, strlen(h_a2));
+    ne_hash_finish_ascii(ctx, digest);
+    ne_hash_destroy(ctx);
 }
 
 /* Verify that the response-digest matches expected state. */
 static int check_digest(struct digest_state *state, struct digest_parms *parms)
 {
-    char digest[33];
+    char digest[NE_HASH_MAXHEX + 1];
 
     make_digest(state, parms, 0, digest);
 
@@ -529,6 +549,7 @@ static int verify_digest_header(struct digest_state *state,
         PARAM(qop);
         PARAM(opaque);
         PARAM(cnonce);
+        PARAM(userhash);
 
         if (ne_strcasecmp(name, "nc") == 0) {
             long nc = strtol(val, NULL, 16);
@@ -548,7 +569,25 @@ static int verify_digest_header(struct digest_state *state,
         parms->rfc2617 && !newstate.cnonce);
 
     DIGCMP(realm);
-    DIGCMP(username);
+    if (parms->userhash) {
+        ne_hash_ctx *ctx = ne_hash_create(parms->hash);
+        char uh[NE_HASH_MAXHEX + 1];
+
+        ne_hash_update(ctx, state->username, strlen(state->username));
+        ne_hash_update(ctx, ":", 1);
+        ne_hash_update(ctx, state->realm, strlen(state->realm));
+        ne_hash_finish_ascii(ctx, uh);
+        ne_hash_destroy(ctx);
+
+        ONCMP(uh, newstate.username, "Digest response header", "username");
+        ONCMP("true", newstate.userhash, "Digest response header",
+              "userhash");
+    }
+    else {
+        DIGCMP(username);
+        ONV(newstate.userhash != NULL,
+            ("unexpected userhash param: %s", newstate.userhash));
+    }
     if (!parms->domain)
         DIGCMP(uri);
     DIGCMP(nonce);
@@ -579,7 +618,7 @@ static char *make_authinfo_header(struct digest_state *state,
                                   struct digest_parms *parms)
 {
     ne_buffer *buf = ne_buffer_create();
-    char digest[33], *ncval, *cnonce;
+    char digest[NE_HASH_MAXHEX + 1], *ncval, *cnonce;
 
     if (parms->failure == fail_ai_bad_digest) {
         strcpy(digest, "fish");
@@ -639,6 +678,16 @@ static char *make_digest_header(struct digest_state *state,
     algorithm = parms->failure == fail_bogus_alg ? "fish" 
         : state->algorithm;
 
+    if (parms->hash && parms->hash != NE_HASH_MD5 && parms->rfc2617) {
+        /* Offer MD5 first; the stronger algorithm must be used. */
+        ne_buffer_concat(buf, 
+                         parms->proxy ? "Proxy-Authenticate"
+                         : "WWW-Authenticate",
+                         ": Digest realm=\"", parms->realm, "\", "
+                         "algorithm=\"MD5\", qop=\"auth\", "
+                         "nonce=\"md5-nonce\"\r\n", NULL);
+    }
+
     ne_buffer_concat(buf, 
                      parms->proxy ? "Proxy-Authenticate"
                      : "WWW-Authenticate",
@@ -650,6 +699,10 @@ static char *make_digest_header(struct digest_state *state,
                          "qop=\"", state->qop, "\", ", NULL);
     }
 
+    if (parms->userhash) {
+        ne_buffer_czappend(buf, "userhash=true, ");
+    }
+
     if (parms->opaque) {
         ne_buffer_concat(buf, "opaque=\"", parms->opaque, "\", ", NULL);
     }
@@ -689,7 +742,7 @@ static int serve_digest(ne_socket *sock, void *userdata)
     state.username = username;
     state.password = password;
     state.nc = 1;
-    state.algorithm = parms->md5_sess ? "MD5-sess" : "MD5";
+    state.algorithm = digest_alg(parms);
     state.qop = "auth";
 
     state.cnonce = state.digest = state.ncval = NULL;
@@ -837,6 +890,15 @@ static int digest(void)
         /* Proxy + A-I */
         { "WallyWorld", "this-is-also-a-nonce", "opaque-string", NULL, 1, 1, 0, 1, 0, 1, 0, fail_not },
 
+        /* RFC 7616 algorithms */
+        { "WallyWorld", "this-is-a-nonce", NULL, NULL, 1, 0, 0, 0, 0, 1, 0, fail_not, NE_HASH_SHA256 },
+        { "WallyWorld", "nonce-nonce-nonce", "opaque-string", NULL, 1, 1, 1, 0, 0, 1, 0, fail_not, NE_HASH_SHA256 },
+        { "WallyWorld", "this-is-a-nonce", "opaque-thingy", NULL, 1, 1, 0, 0, 1, 5, 0, fail_not, NE_HASH_SHA512_256 },
+        { "WallyWorld", "this-is-a-nonce", "opaque-thingy", NULL, 1, 1, 0, 0, 0, 3, 2, fail_not, NE_HASH_SHA512_256 },
+        /* ... with userhash */
+        { "WallyWorld", "this-is-a-nonce", NULL, NULL, 1, 1, 0, 0, 0, 1, 0, fail_not, NE_HASH_SHA256, 1 },
+        { "WallyWorld", "this-is-a-nonce", NULL, NULL, 1, 0, 0, 1, 0, 1, 0, fail_not, NE_HASH_SHA512_256, 1 },
+
         { NULL }
     };
     size_t n;
@@ -1088,6 +1150,188 @@ static int domains(void)
     return await_server();
 }
 
+static int cache_cb_count;
+
+static int cache_cb(void *userdata, const char *realm, int tries, 
+                    char *un, char *pw)
+{
+    cache_cb_count++;
+    return auth_cb(userdata, realm, tries, un, pw);
+}
+
+/* Server for the auth cache test; each connection is from a new
+ * session sharing the cache. */
+static int serve_cached_digest(ne_socket *sock, void *userdata)
+{
+    static struct digest_parms parms;
+    static struct digest_state state;
+    static int conn;
+    char resp[NE_BUFSIZ];
+
+    if (conn == 0) {
+        parms.realm = "WallyWorld";
+        parms.nonce = "cached-nonce";
+        parms.opaque = "opaque-string";
+        parms.rfc2617 = 1;
+        parms.num_requests = 1; /* no stale flag unless stale is 1 */
+        state.uri = "/fish";
+        state.method = "GET";
+        state.realm = parms.realm;
+        state.nonce = parms.nonce;
+        state.opaque = parms.opaque;
+        state.username = username;
+        state.password = password;
+        state.nc = 1;
+        state.algorithm = "MD5";
+        state.qop = "auth";
+    }
+
+    want_header = "Authorization";
+    got_header = dup_header;
+    digest_hdr = NULL;
+
+    CALL(discard_request(sock));
+
+    if (conn == 0) {
+        /* First session: challenge, then accept the credentials. */
+        ONN("first request sent credentials", digest_hdr != NULL);
+
+        ne_snprintf(resp, sizeof resp, "HTTP/1.1 401 Auth Denied\r\n"
+                    "%s\r\n" "Content-Length: 0\r\n" "\r\n",
+                    make_digest_header(&state, &parms));
+        SEND_STRING(sock, resp);
+
+        digest_hdr = NULL;
+        CALL(discard_request(sock));
+    }
+
+    ONV(digest_hdr == NULL,
+        ("no credentials sent for connection %d", conn));
+    CALL(verify_digest_header(&state, &parms, digest_hdr));
+
+    if (conn == 2) {
+        /* Third session: the nonce has gone stale. */
+        state.nonce = "fresh-nonce";
+        state.nc = 1;
+        parms.stale = 1;
+
+        ne_snprintf(resp, sizeof resp, "HTTP/1.1 401 Auth Denied\r\n"
+                    "%s\r\n" "Content-Length: 0\r\n" "\r\n",
+                    make_digest_header(&state, &parms));
+        SEND_STRING(sock, resp);
+        parms.stale = 0;
+
+        digest_hdr = NULL;
+        CALL(discard_request(sock));
+        ONN("no credentials sent after stale challenge", digest_hdr == NULL);
+        CALL(verify_digest_header(&state, &parms, digest_hdr));
+    }
+
+    conn++;
+
+    return SEND_STRING(sock, "HTTP/1.1 200 OK\r\n"
+                       "Connection: close\r\n" "\r\n");
+}
+
+/* Test that the auth cache allows Digest credentials to be sent
+ * preemptively by a new session. */
+static int digest_cache(void)
+{
+    ne_auth_cache *cache = ne_auth_cache_create();
+    int n;
+
+    cache_cb_count = 0;
+
+    CALL(spawn_server_repeat(7777, serve_cached_digest, NULL, 5));
+
+    for (n = 0; n < 4; n++) {
+        ne_session *sess = ne_session_create("http", "localhost", 7777);
+
+        ne_set_server_auth(sess, cache_cb, NULL);
+        ne_set_auth_cache(sess, cache);
+
+        ONV(any_request(sess, "/fish"),
+            ("request %d failed: %s", n, ne_get_error(sess)));
+
+        ne_session_destroy(sess);
+    }
+
+    ONV(cache_cb_count != 1,
+        ("credentials callback invoked %d times", cache_cb_count));
+
+    ne_auth_cache_destroy(cache);
+
+    return reap_server();
+}
+
+/* Server for the Basic auth cache test; each connection is from a
+ * new session sharing the cache. */
+static int serve_cached_basic(ne_socket *sock, void *userdata)
+{
+    static int conn;
+
+    got_header = auth_hdr;
+    want_header = "Authorization";
+
+    auth_failed = 1;
+    CALL(discard_request(sock));
+
+    if (conn == 2) {
+        /* Outside the configured prefix: challenge. */
+        ONN("credentials sent outside prefix", auth_failed == 0);
+        send_response(sock, CHAL_WALLY, 401, 0);
+
+        auth_failed = 1;
+        CALL(discard_request(sock));
+    }
+
+    ONV(auth_failed, ("no valid credentials sent for connection %d", conn));
+
+    conn++;
+
+    return send_response(sock, NULL, 200, 1);
+}
+
+/* Test that the auth cache allows Basic credentials to be sent
+ * preemptively, and reused without invoking the callback. */
+static int basic_cache(void)
+{
+    static const char *paths[] = {
+        "/dav/a", "/dav/b/c", "/davx/x", "/davx/y"
+    };
+    ne_auth_cache *cache = ne_auth_cache_create();
+    size_t n;
+
+    cache_cb_count = 0;
+
+    ONN("bad URI accepted",
+        ne_auth_cache_add_basic(cache, "/dav/", "WallyWorld") == 0);
+    ONN("prefix not accepted",
+        ne_auth_cache_add_basic(cache, "http://localhost:7777/dav",
+                                "WallyWorld"));
+
+    CALL(spawn_server_repeat(7777, serve_cached_basic, NULL, 5));
+
+    for (n = 0; n < sizeof(paths)/sizeof(paths[0]); n++) {
+        ne_session *sess = ne_session_create("http", "localhost", 7777);
+
+        ne_set_server_auth(sess, cache_cb, NULL);
+        ne_set_auth_cache(sess, cache);
+
+        ONV(any_2xx_request(sess, paths[n]),
+            ("request for %s failed: %s", paths[n], ne_get_error(sess)));
+
+        ne_session_destroy(sess);
+    }
+
+    ONV(cache_cb_count != 1,
+        ("credentials callback invoked %d times", cache_cb_count));
+
+    ne_auth_cache_destroy(cache);
+
+    return reap_server();
+}
+
 /* This segfaulted with 0.28.0 through 0.28.2 inclusive. */
 static int CVE_2008_3746(void)
 {
@@ -1201,6 +1445,8 @@ ne_test tests[] = {
     T(fail_challenge),
     T(multi_handler),
     T(domains),
+    T(digest_cache),
+    T(basic_cache),
     T(defaults),
     T(CVE_2008_3746),
     T(forget),
@@ -271,6 +271,96 @@ static int get(void)
     return OK;
 }
 
+static char *resume_range;
+
+static void got_range(char *value)
+{
+    resume_range = ne_strdup(value);
+}
+
+/* Serves a truncated response to the first request, and the
+ * remainder of the entity as a 206 to the second. */
+static int serve_resume(ne_socket *sock, void *userdata)
+{
+    static int count;
+
+    want_header = "Range";
+    got_header = got_range;
+    CALL(discard_request(sock));
+
+    if (count++ == 0) {
+        SEND_STRING(sock, "HTTP/1.1 200 OK\r\n"
+                    "ETag: \"abcd\"\r\n"
+                    "Content-Length: 10\r\n"
+                    "\r\n"
+                    "abcde");
+    }
+    else {
+        ONV(resume_range == NULL || strcmp(resume_range, "bytes=5-"),
+            ("resumed with Range '%s' not 'bytes=5-'",
+             resume_range ? resume_range : "(none)"));
+        SEND_STRING(sock, "HTTP/1.1 206 Partial Content\r\n"
+                    "ETag: \"abcd\"\r\n"
+                    "Content-Range: bytes 5-9/10\r\n"
+                    "Content-Length: 5\r\n"
+                    "\r\n"
+                    "fghij");
+    }
+
+    return OK;
+}
+
+static int get2_resume(void)
+{
+    ne_session *sess = ne_session_create("http", "localhost", 7777);
+    char buf[20];
+    ssize_t len;
+    int fd;
+
+    fd = open("resume.out", O_RDWR|O_CREAT|O_TRUNC, 0644);
+    ONN("could not create resume.out", fd < 0);
+
+    CALL(spawn_server_repeat(7777, serve_resume, NULL, 3));
+
+    ONREQ(ne_get2(sess, "/getit", fd, NE_GETFLAG_RESUME));
+
+    ONN("could not rewind file", lseek(fd, 0, SEEK_SET) != 0);
+    len = read(fd, buf, sizeof buf);
+    close(fd);
+
+    ONV(len != 10 || memcmp(buf, "abcdefghij", 10),
+        ("resumed entity was %d bytes: '%.*s'", (int)len, 
+         len > 0 ? (int)len : 0, buf));
+
+    ne_session_destroy(sess);
+    CALL(reap_server());
+
+    return OK;
+}
+
+static int get2_noresume(void)
+{
+    ne_session *sess;
+    int fd, ret;
+    
+    CALL(make_session(&sess, single_serve_string, 
+                      "HTTP/1.1 200 OK\r\n"
+                      "Content-Length: 10\r\n"
+                      "\r\n"
+                      "abcde"));
+    
+    fd = open("/dev/null", O_WRONLY);
+    ret = ne_get2(sess, "/getit", fd, NE_GETFLAG_RESUME);
+    close(fd);
+
+    ONN("truncated response without validator did not fail", ret == NE_OK);
+
+    ne_session_destroy(sess);
+    CALL(await_server());
+
+    return OK;
+}
+
 ne_test tests[] = {
     T(lookup_localhost),
     T(content_type),
@@ -282,6 +372,8 @@ ne_test tests[] = {
     T(fail_range_unsatify),
     T(dav_capabilities),
     T(get),
+    T(get2_resume),
+    T(get2_noresume),
     T(NULL) 
 };
 
@@ -27,6 +27,7 @@
 #include <fcntl.h>
 
 #include "ne_compress.h"
+#include "ne_basic.h"
 #include "ne_auth.h"
 
 #include "tests.h"
@@ -424,6 +425,45 @@ static int compress_abort(void)
 
 }
 
+/* Check that ne_get2 decompresses a gzip-encoded entity. */
+static int get2_decompress(void)
+{
+    ne_session *sess;
+    struct serve_file_args sfargs;
+    ne_buffer *expect = ne_buffer_create(), *got = ne_buffer_create();
+    int fd;
+
+    fd = open(newsfn, O_RDONLY);
+    ONN("failed to open file", fd < 0);
+    file2buf(fd, expect);
+    close(fd);
+
+    sfargs.fname = "file1.gz";
+    sfargs.headers = "Content-Encoding: gzip\r\n";
+    sfargs.chunks = 0;
+
+    CALL(make_session(&sess, serve_file, &sfargs));
+
+    fd = open("get2.out", O_RDWR|O_CREAT|O_TRUNC, 0644);
+    ONN("could not create get2.out", fd < 0);
+
+    ONREQ(ne_get2(sess, "/", fd, NE_GETFLAG_DECOMPRESS));
+
+    ONN("could not rewind file", lseek(fd, 0, SEEK_SET) != 0);
+    file2buf(fd, got);
+    close(fd);
+
+    ONN("decompressed entity mismatch", 
+        got->used != expect->used 
+        || memcmp(got->data, expect->data, got->used) != 0);
+
+    ne_buffer_destroy(expect);
+    ne_buffer_destroy(got);
+    ne_session_destroy(sess);
+
+    return await_server();
+}
+
 ne_test tests[] = {
     T_LEAKY(init),
     T(not_compressed),
@@ -446,5 +486,6 @@ ne_test tests[] = {
     T(retry_notcompress),
     T(retry_compress),
     T(compress_abort),
+    T(get2_decompress),
     T(NULL)
 };
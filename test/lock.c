@@ -217,6 +217,57 @@ static int store_several(void)
     return OK;
 }
 
+/* Test the lock store with many locks. */
+static int store_many(void)
+{
+    ne_lock_store *store = ne_lockstore_create();
+    struct ne_lock *locks[300], *lk;
+    int n, count;
+
+    for (n = 0; n < 300; n++) {
+        char path[64];
+        
+        ne_snprintf(path, sizeof path, "/dir%d/sub%d/file%d", n % 3, n % 7, n);
+        locks[n] = make_lock(path, NULL, ne_lockscope_exclusive, 0);
+        ne_lockstore_add(store, locks[n]);
+    }
+
+    /* a lock on another server, with the same path. */
+    lk = make_lock("/dir0/sub0/file0", NULL, ne_lockscope_exclusive, 0);
+    lk->uri.port = 7778;
+    ne_lockstore_add(store, lk);
+
+    ONN("lock on other server not found",
+        ne_lockstore_findbyuri(store, &lk->uri) != lk);
+    
+    for (n = 0; n < 300; n++) {
+        ONV(ne_lockstore_findbyuri(store, &locks[n]->uri) != locks[n],
+            ("lock %d not found by URI", n));
+    }
+
+    for (n = 0; n < 300; n += 2) {
+        ne_lockstore_remove(store, locks[n]);
+        ONV(ne_lockstore_findbyuri(store, &locks[n]->uri) != NULL,
+            ("lock %d found after removal", n));
+        ne_lock_destroy(locks[n]);
+    }
+
+    for (n = 1; n < 300; n += 2) {
+        ONV(ne_lockstore_findbyuri(store, &locks[n]->uri) != locks[n],
+            ("lock %d not found by URI after removals", n));
+    }
+
+    for (count = 0, lk = ne_lockstore_first(store); lk; 
+         lk = ne_lockstore_next(store))
+        count++;
+    
+    ONV(count != 151, ("%d locks in store, not 151", count));
+
+    ne_lockstore_destroy(store);
+    
+    return OK;
+}
+
 /* regression test for <= 0.18.2, where timeout field was not parsed correctly. */
 static int lock_timeout(void)
 {
@@ -250,6 +301,94 @@ static int lock_timeout(void)
     return OK;
 }
 
+static int refresh_failures;
+
+static void refresh_failed(void *userdata, struct ne_lock *lock, int result)
+{
+    struct ne_lock *expected = userdata;
+
+    if (lock == expected && result == NE_ERROR)
+        refresh_failures++;
+    else
+        refresh_failures += 100;
+}
+
+/* Test refreshing locks from a store in order of expiry. */
+static int store_refresh(void)
+{
+    ne_lock_store *store = ne_lockstore_create();
+    struct ne_lock *lka = make_lock("/a", NULL, ne_lockscope_exclusive, 0),
+        *lkb = make_lock("/b", NULL, ne_lockscope_exclusive, 0),
+        *lkc = make_lock("/c", NULL, ne_lockscope_exclusive, 0),
+        *lkd = make_lock("/d", NULL, ne_lockscope_exclusive, 0);
+    struct double_serve_args args;
+    ne_session *sess;
+    char *body;
+    long next;
+    int ret;
+
+    lka->token = ne_strdup("opaquelocktoken:a");
+    lka->timeout = 1;
+    lkb->token = ne_strdup("opaquelocktoken:b");
+    lkb->timeout = 2;
+    lkc->token = ne_strdup("opaquelocktoken:c");
+    lkc->timeout = 3600;
+    lkd->token = ne_strdup("opaquelocktoken:d");
+    lkd->timeout = NE_TIMEOUT_INFINITE;
+
+    ONN("empty store needs refresh", 
+        ne_lockstore_next_refresh(store, 10) != -1);
+
+    ne_lockstore_add(store, lkd);
+    ONN("store with infinite lock needs refresh", 
+        ne_lockstore_next_refresh(store, 10) != -1);
+
+    ne_lockstore_add(store, lkc);
+    ne_lockstore_add(store, lkb);
+    ne_lockstore_add(store, lka);
+
+    ONN("refresh not due", ne_lockstore_next_refresh(store, 10) != 0);
+
+    body = lock_response(ne_lockscope_exclusive, 0, "me", 7200, 
+                         "opaquelocktoken:a");
+    args.first.data = ne_malloc(strlen(body) + 200);
+    sprintf(args.first.data, "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/xml\r\n"
+            "Content-Length: %" NE_FMT_SIZE_T "\r\n\r\n%s", 
+            strlen(body), body);
+    args.first.len = strlen(args.first.data);
+    args.second.data = "HTTP/1.1 412 Precondition Failed\r\n"
+        "Content-Length: 0\r\n\r\n";
+    args.second.len = strlen(args.second.data);
+
+    CALL(make_session(&sess, double_serve_sstring, &args));
+    
+    refresh_failures = 0;
+    ret = ne_lockstore_refresh(store, sess, 10, refresh_failed, lkb);
+    ONV(ret != 1, ("%d locks refreshed, not 1", ret));
+    ONV(refresh_failures != 1, ("failure callback count %d, not 1",
+                                refresh_failures));
+    ONV(lka->timeout != 7200, ("refreshed timeout was %ld", lka->timeout));
+
+    CALL(await_server());
+
+    next = ne_lockstore_next_refresh(store, 10);
+    ONV(next < 3500 || next > 3590,
+        ("next refresh due in %ld seconds", next));
+
+    ne_lockstore_remove(store, lkc);
+    next = ne_lockstore_next_refresh(store, 10);
+    ONV(next < 7100 || next > 7190,
+        ("next refresh due in %ld seconds after removal", next));
+
+    ne_free(args.first.data);
+    ne_session_destroy(sess);
+    ne_lock_destroy(lkc);
+    ne_lockstore_destroy(store);
+
+    return OK;
+}
+
 static int verify_if;
 static const char *verify_if_expect;
 
@@ -311,10 +450,11 @@ static int do_request(ne_session *sess, const char *path, int depth,
 /* Tests If: header submission, for a lock of depth 'lockdepth' at
  * 'lockpath', with a request to 'reqpath' which Depth header of
  * 'reqdepth'.  If modparent is non-zero; the request is flagged to
- * modify the parent resource too. */
-static int submit_test(const char *lockpath, int lockdepth,
-		       const char *reqpath, int reqdepth,
-		       int modparent)
+ * modify the parent resource too.  If 'decoys' is non-zero, that many
+ * locks which should not be submitted are also stored. */
+static int submit_test_decoys(const char *lockpath, int lockdepth,
+                              const char *reqpath, int reqdepth,
+                              int modparent, int decoys)
 {
     ne_lock_store *store = ne_lockstore_create();
     ne_session *sess;
@@ -336,6 +476,18 @@ static int submit_test(const char *lockpath, int lockdepth,
     ne_lockstore_register(store, sess);
     ne_lockstore_add(store, lk);
 
+    while (decoys-- > 0) {
+        char path[64];
+        struct ne_lock *decoy;
+
+        ne_snprintf(path, sizeof path, "/decoy/%d", decoys);
+        decoy = make_lock(decoys % 2 ? path : reqpath, NULL, 
+                          ne_lockscope_exclusive, NE_DEPTH_INFINITE);
+        decoy->token = ne_strdup(path);
+        if (decoys % 2 == 0) decoy->uri.port = 7778;
+        ne_lockstore_add(store, decoy);
+    }
+
     ret = do_request(sess, reqpath, reqdepth, modparent);
     CALL(await_server());
 
@@ -345,6 +497,14 @@ static int submit_test(const char *lockpath, int lockdepth,
     return ret;
 }
 
+static int submit_test(const char *lockpath, int lockdepth,
+		       const char *reqpath, int reqdepth,
+		       int modparent)
+{
+    return submit_test_decoys(lockpath, lockdepth, reqpath, reqdepth,
+                              modparent, 0);
+}
+
 static int if_simple(void)
 {
     return submit_test("/foo", 0, "/foo", 0, 0);
@@ -365,6 +525,14 @@ static int if_child(void)
     return submit_test("/foo/", 0, "/foo/bar", 0, 1);
 }
 
+/* the If header must only list applicable locks from a large store,
+ * including none stored for another server. */
+static int if_many_locks(void)
+{
+    return submit_test_decoys("/foo", NE_DEPTH_INFINITE, "/foo/bar/", 
+                              NE_DEPTH_INFINITE, 1, 500);
+}
+
 /* this is a special test, where the PARENT resource of "/foo/bar" is
  * modified, but NOT "/foo/bar" itself.  An UNLOCK request on a
  * lock-null resource can do this; see ne_unlock() for the comment.
@@ -609,12 +777,15 @@ ne_test tests[] = {
     T(lookup_localhost),
     T(store_single),
     T(store_several),
+    T(store_many),
     T(if_simple),
     T(if_under_infinite),
     T(if_infinite_over),
     T(if_child),
     T(if_covered_child),
+    T(if_many_locks),
     T(lock_timeout),
+    T(store_refresh),
     T(lock_shared),
     T(discover),
     T(fail_discover),
@@ -30,6 +30,7 @@
 #endif
 
 #include "ne_props.h"
+#include "ne_basic.h"
 
 #include "tests.h"
 #include "child.h"
@@ -298,6 +299,7 @@ static int run_207_response(char *resp, const char *expected)
 #define DESCR_REM "The end of the world, as we know it"
 
 #define PROPS_207(x) "<D:prop>" x "</D:prop>"
+#define COLL_207 "<D:resourcetype><D:collection/></D:resourcetype>"
 #define APROP_207(n, c) "<D:" n ">" c "</D:" n ">"
 
 /* Tests for the 207 interface: send a 207 response body, compare the
@@ -494,7 +496,8 @@ static void pf_destructor(void *userdata, void *private)
 enum pftype { 
     PF_SIMPLE, /* using ne_simple_propfind */
     PF_NAMED,  /* using ne_propfind_named */
-    PF_ALLPROP /* using ne_propfind_allprop */
+    PF_ALLPROP, /* using ne_propfind_allprop */
+    PF_PULL /* using ne_propfind_start/ne_propfind_next */
 };
 
 static int run_propfind(const ne_propname *props, char *resp, 
@@ -520,6 +523,17 @@ static int run_propfind(const ne_propname *props, char *resp,
         if (type == PF_NAMED) {
             ONREQ(ne_propfind_named(hdl, props, simple_results, buf));
         }
+        else if (type == PF_PULL) {
+            const ne_prop_result_set *rset;
+
+            ONREQ(ne_propfind_start(hdl, props));
+
+            do {
+                ONREQ(ne_propfind_next(hdl, &rset));
+                if (rset)
+                    simple_results(buf, ne_propset_uri(rset), rset);
+            } while (rset);
+        }
         else {
             ONREQ(ne_propfind_allprop(hdl, simple_results, buf));
         }
@@ -613,7 +627,21 @@ static int propfind(void)
           "creator[/foop]//"
           "results(/foop,prop:[{DAV:,fishbone}='hello, world':{212 Well OK}];)//"
           "destructor[/foop]//",
-          0, PF_NAMED }
+          0, PF_NAMED },
+
+        /* pull interface. */
+        { MULTI_207(RESP_207("/alpha",
+                             PSTAT_207(PROPS_207(APROP_207("fishbone", "strike one"))
+                                       STAT_207("234 First is OK")))
+                    RESP_207("/beta",
+                             PSTAT_207(PROPS_207(APROP_207("fishbone", "strike two"))
+                                       STAT_207("256 Second is OK")))),
+          "creator[/alpha]//creator[/beta]//"
+          "results(/alpha,prop:[{DAV:,fishbone}='strike one':{234 First is OK}];)//"
+          "destructor[/alpha]//"
+          "results(/beta,prop:[{DAV:,fishbone}='strike two':{256 Second is OK}];)//"
+          "destructor[/beta]//",
+          0, PF_PULL }
 
     };
     const ne_propname pset1[] = {
@@ -633,6 +661,375 @@ static int propfind(void)
     return OK;
 }
 
+/* Test property lookups in a result set large enough to be
+ * indexed. */
+static int propset_lookup(void)
+{
+    static char resp[] = MULTI_207(RESP_207("/alpha",
+        PSTAT_207(PROPS_207(APROP_207("p1", "v1") APROP_207("p2", "v2")
+                            APROP_207("p3", "v3") APROP_207("p4", "v4")
+                            APROP_207("p5", "v5") APROP_207("p6", "v6")
+                            APROP_207("p1", "dup")
+                            "<nons xmlns=''>plain</nons>"
+                            "<X:p1 xmlns:X='urn:x'>other</X:p1>")
+                  STAT_207("200 OK"))
+        PSTAT_207(PROPS_207(APROP_207("gone", "") APROP_207("p7", ""))
+                  STAT_207("404 Not Found"))));
+    static const ne_propname names[] = {
+        { "DAV:", "p1" }, { "urn:x", "p1" }, { NULL, "nons" },
+        { "DAV:", "p6" }, { "DAV:", "gone" }, { "DAV:", "missing" },
+        { "", "nons" }, { NULL, NULL }
+    };
+    static const char *const expected[] = {
+        "v1", "other", "plain", "v6", NULL, NULL, NULL
+    };
+    const char *values[7];
+    const ne_prop_result_set *rset;
+    const ne_status *st;
+    ne_propfind_handler *hdl;
+    ne_session *sess;
+    int n, count;
+
+    CALL(make_session(&sess, single_serve_string, resp));
+
+    hdl = ne_propfind_create(sess, "/propfind", 0);
+    ONREQ(ne_propfind_start(hdl, NULL));
+    ONREQ(ne_propfind_next(hdl, &rset));
+    ONN("no results set", rset == NULL);
+
+    count = ne_propset_values(rset, names, values);
+    ONV(count != 4, ("got %d values, not 4", count));
+
+    for (n = 0; n < 7; n++) {
+        const char *v = ne_propset_value(rset, &names[n]);
+
+        ONV(v != values[n], ("bulk and single lookups differ for %s", 
+                             names[n].name));
+        if (expected[n] == NULL) {
+            ONV(v != NULL, ("value for %s was %s not NULL", 
+                            names[n].name, v));
+        }
+        else {
+            ONV(v == NULL || strcmp(v, expected[n]),
+                ("value for %s was %s not %s", names[n].name,
+                 v ? v : "NULL", expected[n]));
+        }
+    }
+
+    st = ne_propset_status(rset, &names[4]);
+    ONN("no status for failed property", st == NULL);
+    ONV(st->code != 404, ("failed property had status %d", st->code));
+
+    st = ne_propset_status(rset, &names[5]);
+    ONN("got status for missing property", st != NULL);
+
+    ONREQ(ne_propfind_next(hdl, &rset));
+    ONN("unexpected second results set", rset != NULL);
+
+    ne_propfind_destroy(hdl);
+    ne_session_destroy(sess);
+
+    return await_server();
+}
+
+/* Serves a Depth: 1 PROPFIND response for a small tree, based on the
+ * request-URI; the collection /z/ cannot be listed. */
+static int serve_tree(ne_socket *sock, void *userdata)
+{
+    static const struct {
+        const char *path, *body;
+    } tree[] = {
+        { "/",
+          MULTI_207(RESP_207("/", PSTAT_207(PROPS_207(COLL_207) STAT_207("200 OK")))
+                    RESP_207("/a/", PSTAT_207(PROPS_207(COLL_207) STAT_207("200 OK")))
+                    RESP_207("/x/", PSTAT_207(PROPS_207(COLL_207) STAT_207("200 OK")))
+                    RESP_207("/z/", PSTAT_207(PROPS_207(COLL_207) STAT_207("200 OK")))
+                    RESP_207("/b", PSTAT_207(PROPS_207(APROP_207("resourcetype", ""))
+                                             STAT_207("200 OK")))
+                    RESP_207("/f", PSTAT_207(PROPS_207(APROP_207("resourcetype", 
+                                                                 "<D:collectionfoo/>"))
+                                             STAT_207("200 OK")))) },
+        { "/a/",
+          MULTI_207(RESP_207("/a", PSTAT_207(PROPS_207(COLL_207) STAT_207("200 OK")))
+                    RESP_207("/a/c", PSTAT_207(PROPS_207(APROP_207("resourcetype", ""))
+                                               STAT_207("200 OK")))
+                    RESP_207("/a/d/", PSTAT_207(PROPS_207(COLL_207) STAT_207("200 OK")))) },
+        { "/a/d/",
+          MULTI_207(RESP_207("/a/d/", PSTAT_207(PROPS_207(COLL_207) STAT_207("200 OK")))
+                    RESP_207("/A/D/E", PSTAT_207(PROPS_207(APROP_207("resourcetype", ""))
+                                                 STAT_207("200 OK")))
+                    RESP_207("/B", PSTAT_207(PROPS_207(APROP_207("resourcetype", ""))
+                                             STAT_207("200 OK")))) },
+        { "/x/",
+          MULTI_207(RESP_207("/x/y", PSTAT_207(PROPS_207(APROP_207("resourcetype", ""))
+                                               STAT_207("200 OK")))
+                    RESP_207("/x/g", PSTAT_207(PROPS_207(APROP_207("resourcetype", 
+                                                 "<D:foo><D:collection/></D:foo>"))
+                                               STAT_207("200 OK")))) }
+    };
+    char line[1024], *path, *end;
+    size_t n;
+
+    ONN("failed to read request line", ne_sock_readline(sock, line, sizeof line) < 0);
+    
+    path = strchr(line, ' ');
+    ONN("malformed request line", path == NULL);
+    path++;
+    end = strchr(path, ' ');
+    ONN("malformed request line", end == NULL);
+    *end = '\0';
+
+    CALL(discard_request(sock));
+    CALL(discard_body(sock));
+
+    for (n = 0; n < sizeof(tree)/sizeof(tree[0]); n++) {
+        if (strcmp(tree[n].path, path) == 0) {
+            ONN("failed to send response", SEND_STRING(sock, tree[n].body));
+            return OK;
+        }
+    }
+
+    SEND_STRING(sock, "HTTP/1.1 404 Not Found\r\nConnection: close\r\n\r\n");
+    return OK;
+}
+
+static int walk_result(void *userdata, const ne_uri *uri,
+                       const ne_prop_result_set *rset, int collection)
+{
+    ne_buffer_concat(userdata, uri->path, collection ? "(coll)" : "", 
+                     rset ? "" : "(failed)", "//", NULL);
+    return 0;
+}
+
+static int tree_walk(void)
+{
+    static const ne_propname props[] = {
+        { "DAV:", "getetag" },
+        { NULL }
+    };
+    /* the order in which results are read depends on the number of
+     * workers. */
+    static const char *const expected[] = {
+        "/(coll)///a/(coll)///x/(coll)///z/(coll)///b///f///a/c///a/d/(coll)//"
+        "/x/y///x/g///z/(coll)(failed)///A/D/E//",
+        "/(coll)///a/(coll)///x/(coll)///z/(coll)///b///f///x/y///x/g///a/c//"
+        "/a/d/(coll)///z/(coll)(failed)///A/D/E//"
+    };
+    ne_session *sess, *sessions[2];
+    ne_buffer *buf = ne_buffer_create();
+    int n;
+
+    for (n = 1; n <= 2; n++) {
+        sess = sessions[0] = ne_session_create("http", "localhost", 7777);
+        sessions[1] = ne_session_create("http", "localhost", 7777);
+        ne_buffer_clear(buf);
+
+        CALL(spawn_server_repeat(7777, serve_tree, NULL, 8));
+
+        ONREQ(ne_tree_walk(sessions, n, "/", props, walk_result, buf));
+
+        CALL(reap_server());
+
+        ONV(strcmp(buf->data, expected[n - 1]),
+            ("walk with %d workers gave %s", n, buf->data));
+
+        ne_session_destroy(sessions[0]);
+        ne_session_destroy(sessions[1]);
+    }
+
+    ne_buffer_destroy(buf);
+    
+    return OK;
+}
+
+/* Serves a sync-collection response if the request body includes the
+ * expected sync-token. */
+static int serve_sync(ne_socket *sock, void *userdata)
+{
+    char body[2048];
+
+    CALL(discard_request(sock));
+    ONN("request body too large", clength >= (int)sizeof body);
+    ONN("failed to read body", ne_sock_fullread(sock, body, clength));
+    body[clength] = '\0';
+
+    ONV(strstr(body, "<sync-token>tok&amp;1</sync-token>") == NULL,
+        ("sync-token missing from request body: %s", body));
+    ONV(strstr(body, "<getetag xmlns=\"DAV:\"/>") == NULL,
+        ("property missing from request body: %s", body));
+
+    SEND_STRING(sock, userdata);
+    return OK;
+}
+
+static void sync_result(void *userdata, const ne_uri *uri,
+                        const ne_prop_result_set *rset)
+{
+    static const ne_propname etag = { "DAV:", "getetag" };
+
+    if (rset) {
+        const char *value = ne_propset_value(rset, &etag);
+        ne_buffer_concat(userdata, "changed(", uri->path, ",", 
+                         value ? value : "#novalue#", ")//", NULL);
+    }
+    else {
+        ne_buffer_concat(userdata, "removed(", uri->path, ")//", NULL);
+    }
+}
+
+static int sync_collection(void)
+{
+    static const ne_propname props[] = {
+        { "DAV:", "getetag" },
+        { NULL }
+    };
+    ne_session *sess;
+    ne_buffer *buf = ne_buffer_create();
+    char *token = NULL;
+    int truncated = -1;
+
+    CALL(make_session(&sess, serve_sync, 
+        MULTI_207(RESP_207("/coll/new", PSTAT_207(PROPS_207(APROP_207("getetag", "e1"))
+                                                  STAT_207("200 OK")))
+                  "<D:response><D:href>/coll/gone</D:href>"
+                  STAT_207("404 Not Found") "</D:response>"
+                  "<D:sync-token> http://example.com/sync/2 </D:sync-token>")));
+
+    ONREQ(ne_sync_collection(sess, "/coll/", "tok&1", props, 
+                             sync_result, buf, &token, &truncated));
+    CALL(await_server());
+
+    ONV(strcmp(buf->data, "changed(/coll/new,e1)//removed(/coll/gone)//"),
+        ("unexpected results: %s", buf->data));
+    ONV(token == NULL || strcmp(token, "http://example.com/sync/2"),
+        ("new sync-token was %s", token ? token : "NULL"));
+    ONV(truncated != 0, ("truncated was %d", truncated));
+    ne_free(token);
+    ne_session_destroy(sess);
+
+    /* a 507 for the request-URI marks truncated results. */
+    ne_buffer_clear(buf);
+    CALL(make_session(&sess, serve_sync, 
+        MULTI_207(RESP_207("/coll/new", PSTAT_207(PROPS_207(APROP_207("getetag", "e1"))
+                                                  STAT_207("200 OK")))
+                  "<D:response><D:href>/coll/</D:href>"
+                  STAT_207("507 Insufficient Storage") "</D:response>"
+                  "<D:sync-token>http://example.com/sync/3</D:sync-token>")));
+
+    ONREQ(ne_sync_collection(sess, "/coll/", "tok&1", props, 
+                             sync_result, buf, &token, &truncated));
+    CALL(await_server());
+
+    ONV(strcmp(buf->data, "changed(/coll/new,e1)//"),
+        ("unexpected results: %s", buf->data));
+    ONV(token == NULL || strcmp(token, "http://example.com/sync/3"),
+        ("new sync-token was %s", token ? token : "NULL"));
+    ONN("truncated results not reported", truncated != 1);
+    ne_free(token);
+    ne_session_destroy(sess);
+
+    /* a response lacking the sync-token must fail. */
+    CALL(make_session(&sess, serve_sync, MULTI_207("")));
+    ONN("response without sync-token succeeded",
+        ne_sync_collection(sess, "/coll/", "tok&1", props, 
+                           sync_result, buf, &token, &truncated) != NE_ERROR);
+    ONN("sync-token set on failure", token != NULL);
+    CALL(await_server());
+    ne_session_destroy(sess);
+
+    ne_buffer_destroy(buf);
+
+    return OK;
+}
+
+/* Serves the validator and full PROPFIND requests for the cache test:
+ * the sync-token changes after the first validator request.  The
+ * displayname value gives the number of full PROPFIND requests served
+ * and the total number of requests served. */
+static int serve_cached(ne_socket *sock, void *userdata)
+{
+    static int requests, validators, fulls;
+    char body[2048], name[32];
+    const char *token;
+
+    CALL(discard_request(sock));
+    ONN("request body too large", clength >= (int)sizeof body);
+    ONN("failed to read body", ne_sock_fullread(sock, body, clength));
+    body[clength] = '\0';
+    requests++;
+
+    if (strstr(body, "displayname") == NULL) {
+        if (++validators == 1)
+            SEND_STRING(sock, MULTI_207(RESP_207("/coll/", PSTAT_207(
+                PROPS_207(APROP_207("sync-token", " t1 ")) STAT_207("200 OK")))));
+        else
+            SEND_STRING(sock, MULTI_207(RESP_207("/coll/", PSTAT_207(
+                PROPS_207(APROP_207("sync-token", "t2")) STAT_207("200 OK")))));
+        return OK;
+    }
+
+    token = ++fulls == 1 ? "t1" : "t2";
+    ne_snprintf(name, sizeof name, "v%d-%d", fulls, requests);
+    ne_snprintf(body, sizeof body, 
+                MULTI_207(RESP_207("/coll/", PSTAT_207(
+                    PROPS_207(APROP_207("displayname", "")
+                              APROP_207("sync-token", "%s")) STAT_207("200 OK")))
+                          RESP_207("/coll/a", PSTAT_207(
+                    PROPS_207(APROP_207("displayname", "%s")) STAT_207("200 OK")))),
+                token, name);
+    SEND_STRING(sock, body);
+    return OK;
+}
+
+static void cached_result(void *userdata, const ne_uri *uri,
+                          const ne_prop_result_set *rset)
+{
+    static const ne_propname name = { "DAV:", "displayname" };
+    const char *value = ne_propset_value(rset, &name);
+
+    ne_buffer_concat(userdata, uri->path, "=", 
+                     value ? value : "#novalue#", "//", NULL);
+}
+
+static int propfind_cache(void)
+{
+    static const ne_propname props[] = {
+        { "DAV:", "displayname" },
+        { "DAV:", "sync-token" },
+        { NULL }
+    };
+    static const char *expected = 
+        "/coll/=//" "/coll/a=v1-1//"  /* initial fetch, not validated */
+        "/coll/=//" "/coll/a=v1-1//"  /* from cache */
+        "/coll/=//" "/coll/a=v2-4//"  /* refetched after change */
+        "/coll/=//" "/coll/a=v2-4//"; /* from cache */
+    ne_session *sess = ne_session_create("http", "localhost", 7777);
+    ne_propfind_cache *cache = ne_propfind_cache_create(65536);
+    ne_buffer *buf = ne_buffer_create();
+    int n;
+
+    CALL(spawn_server_repeat(7777, serve_cached, NULL, 6));
+
+    for (n = 0; n < 4; n++) {
+        ne_propfind_handler *hdl = ne_propfind_create(sess, "/coll/", 
+                                                      NE_DEPTH_ONE);
+
+        ne_propfind_set_cache(hdl, cache);
+        ONREQ(ne_propfind_named(hdl, props, cached_result, buf));
+        ne_propfind_destroy(hdl);
+    }
+
+    CALL(reap_server());
+
+    ONV(strcmp(buf->data, expected), ("unexpected results: %s", buf->data));
+
+    ne_propfind_cache_destroy(cache);
+    ne_buffer_destroy(buf);
+    ne_session_destroy(sess);
+
+    return OK;
+}
+
 static int unbounded_response(const char *header, const char *repeats)
 {
     ne_session *sess;
@@ -674,6 +1071,10 @@ ne_test tests[] = {
     T(two_oh_seven),
     T(patch_simple),
     T(propfind),
+    T(propset_lookup),
+    T(tree_walk),
+    T(sync_collection),
+    T(propfind_cache),
     T(regress),
     T(patch_regress),
     T(unbounded_props),
@@ -1363,6 +1363,164 @@ static int send_progress(void)
     return OK;    
 }
 
+/* Progress callback counting the calls made after sending starts. */
+static void count_progress(void *userdata, ne_off_t prog, ne_off_t total)
+{
+    int *count = userdata;
+
+    if (prog > 0) (*count)++;
+}
+
+/* Test that small blocks from the body provider are coalesced into
+ * larger writes. */
+static int send_coalesce(void)
+{
+    int remain = 20000, count = 0;
+
+    ON(prepare_request(single_serve_string,
+		       RESP200 "Connection: close\r\n\r\n"));
+
+    ne_set_progress(def_sess, count_progress, &count);
+    ne_set_request_body_provider(def_req, remain,
+				 provide_progress, &remain);
+
+#define sess def_sess
+    ONREQ(ne_request_dispatch(def_req));
+#undef sess
+
+    ON(finish_request());
+
+    ONV(count != 2, ("body sent in %d writes, expected 2", count));
+
+    return OK;
+}
+
+/* Dispatch a GET request and retrieve its timings. */
+static int timed_request(ne_session *sess, ne_request_timings *t)
+{
+    ne_request *req = ne_request_create(sess, "GET", "/");
+
+    ONREQ(ne_request_dispatch(req));
+    ne_get_request_timings(req, t);
+    ne_request_destroy(req);
+
+    return OK;
+}
+
+static int request_timings(void)
+{
+    ne_session *sess;
+    struct many_serve_args args;
+    ne_request_timings t;
+
+    args.str = RESP200 "Content-Length: 5\r\n" "\r\n" "abcde";
+    args.count = 2;
+
+    CALL(make_session(&sess, many_serve_string, &args));
+
+    CALL(timed_request(sess, &t));
+
+    ONN("lookup not timed", t.lookup_start < 0
+        || t.lookup_end < t.lookup_start);
+    ONN("connect not timed", t.connect_start < t.lookup_end
+        || t.connect_end < t.connect_start);
+    ONN("tunnel or SSL handshake timed",
+        t.tunnel_start != -1 || t.ssl_start != -1);
+    ONN("events out of order", t.request_sent < t.connect_end
+        || t.first_byte < t.request_sent || t.headers_done < t.first_byte
+        || t.body_done < t.headers_done);
+    ONN("no request bytes counted", t.bytes_sent <= 0);
+    ONV(t.bytes_received != (ne_off_t)strlen(args.str),
+        ("%" NE_FMT_NE_OFF_T " response bytes counted, expected %"
+         NE_FMT_SIZE_T, t.bytes_received, strlen(args.str)));
+    ONN("new connection marked reused", t.reused);
+
+    CALL(timed_request(sess, &t));
+
+    ONN("persistent connection not marked reused", !t.reused);
+    ONN("connection setup timed for reused connection",
+        t.lookup_start != -1 || t.connect_start != -1);
+    ONN("response not timed", t.first_byte < 0 || t.body_done < 0);
+
+    ne_session_destroy(sess);
+    return await_server();
+}
+
+/* Test that the timings of a request retried after a persistent
+ * connection timeout cover only the second attempt. */
+static int retry_timings(void)
+{
+    ne_session *sess;
+    struct many_serve_args args;
+    ne_request_timings first, t;
+
+    args.str = RESP200 "Content-Length: 5\r\n" "\r\n" "abcde";
+    args.count = 2;
+
+    /* Time the second request, which is sent once the server is
+     * known to be HTTP/1.1 compliant, as is the retried request. */
+    CALL(make_session(&sess, many_serve_string, &args));
+    CALL(timed_request(sess, &first));
+    CALL(timed_request(sess, &first));
+    CALL(await_server());
+
+    /* The server has closed the connection; the next request fails
+     * on the persistent connection and is retried. */
+    args.count = 1;
+    CALL(spawn_server(7777, many_serve_string, &args));
+    CALL(timed_request(sess, &t));
+
+    ONV(t.bytes_sent != first.bytes_sent,
+        ("%" NE_FMT_NE_OFF_T " request bytes counted for retried request, "
+         "expected %" NE_FMT_NE_OFF_T, t.bytes_sent, first.bytes_sent));
+    ONV(t.bytes_received != first.bytes_received,
+        ("%" NE_FMT_NE_OFF_T " response bytes counted for retried request, "
+         "expected %" NE_FMT_NE_OFF_T, t.bytes_received, 
+         first.bytes_received));
+    ONN("retried request marked reused", t.reused);
+
+    ne_session_destroy(sess);
+    return await_server();
+}
+
+static int session_stats(void)
+{
+    ne_session *sess;
+    struct many_serve_args args;
+    ne_session_stats st, before, after;
+
+    args.str = RESP200 "Content-Length: 5\r\n" "\r\n" "abcde";
+    args.count = 2;
+
+    ne_get_global_stats(&before);
+
+    CALL(make_session(&sess, many_serve_string, &args));
+
+    ne_get_session_stats(sess, &st);
+    ONN("new session has non-zero stats", st.requests || st.connections
+        || st.bytes_sent || st.bytes_received);
+
+    ONREQ(any_request(sess, "/first"));
+    ONREQ(any_request(sess, "/second"));
+
+    ne_get_session_stats(sess, &st);
+    ONV(st.requests != 2, ("%lu requests counted", st.requests));
+    ONV(st.connections != 1, ("%lu connections counted", st.connections));
+    ONV(st.reused != 1, ("%lu reused connections counted", st.reused));
+    ONN("retries counted", st.retries);
+    ONN("no request bytes counted", st.bytes_sent <= 0);
+    ONV(st.bytes_received != 2 * (ne_off_t)strlen(args.str),
+        ("%" NE_FMT_NE_OFF_T " response bytes counted", st.bytes_received));
+
+    ne_get_global_stats(&after);
+    ONN("global requests not counted", after.requests < before.requests + 2);
+    ONN("global bytes not counted",
+        after.bytes_received < before.bytes_received + st.bytes_received);
+
+    ne_session_destroy(sess);
+    return await_server();
+}
+
 static int read_timeout(void)
 {
     ne_session *sess;
@@ -2362,6 +2520,10 @@ ne_test tests[] = {
     T(closed_connection),
     T(close_not_retried),
     T(send_progress),
+    T(send_coalesce),
+    T(request_timings),
+    T(retry_timings),
+    T(session_stats),
     T(ignore_bad_headers),
     T(fold_headers),
     T(fold_many_headers),
@@ -179,8 +179,9 @@ static int ssl_server(ne_socket *sock, void *userdata)
             /* save the session. */
             memcpy(args->session.id, sessid, len);
             args->session.len = len;
-        } else {
-            /* Compare with stored session. */
+        } else if (args->session.len) {
+            /* Compare with stored session; a server issuing session
+             * tickets may not assign an ID to the initial session. */
             ONN("cached session not used", 
                 args->session.len != len
                 || memcmp(args->session.id, sessid, len));
@@ -1006,6 +1007,263 @@ static int session_cache(void)
     return OK;
 }
 
+/* Run a request against the server using a new session with the
+ * given session cache. */
+static int cached_request(ne_ssl_session_cache *cache, const char *path)
+{
+    ne_session *sess = ne_session_create("https", "localhost", 7777);
+
+    ne_ssl_trust_cert(sess, def_ca_cert);
+    ne_ssl_set_session_cache(sess, cache);
+    ONREQ(any_request(sess, path));
+    ne_session_destroy(sess);
+
+    return OK;
+}
+
+/* As cached_request, using client certificate 'cc'. */
+static int cached_cc_request(ne_ssl_session_cache *cache, const char *path,
+                             const ne_ssl_client_cert *cc)
+{
+    ne_session *sess = ne_session_create("https", "localhost", 7777);
+
+    ne_ssl_trust_cert(sess, def_ca_cert);
+    ne_ssl_set_clicert(sess, cc);
+    ne_ssl_set_session_cache(sess, cache);
+    ONREQ(any_request(sess, path));
+    ne_session_destroy(sess);
+
+    return OK;
+}
+
+/* Check the session cache hit and miss counts. */
+static int check_scache(ne_ssl_session_cache *cache,
+                        unsigned long ehits, unsigned long emisses)
+{
+    unsigned long hits, misses;
+
+    ne_ssl_session_cache_stats(cache, &hits, &misses);
+    ONV(hits != ehits || misses != emisses,
+        ("cache stats were %lu hits, %lu misses, expected %lu, %lu",
+         hits, misses, ehits, emisses));
+
+    return OK;
+}
+
+/* Test that a session cache shared between sessions allows the
+ * second session to resume the first session's SSL session. */
+static int shared_session_cache(void)
+{
+    struct ssl_server_args args = {0};
+    ne_ssl_session_cache *cache = ne_ssl_session_cache_create(4);
+
+    args.cert = SERVER_CERT;
+    args.cache = 1;
+
+    CALL(spawn_server_repeat(7777, ssl_server, &args, 4));
+
+    CALL(cached_request(cache, "/req1"));
+    CALL(cached_request(cache, "/req2"));
+
+    ONN("error from child", dead_server());
+    reap_server();
+
+    CALL(check_scache(cache, 1, 1));
+
+    ne_ssl_session_cache_destroy(cache);
+
+    return OK;
+}
+
+/* Test that a cached session is only resumed by sessions using the
+ * same client certificate, or none. */
+static int session_cache_clicert(void)
+{
+    struct ssl_server_args args = {0};
+    ne_ssl_session_cache *cache = ne_ssl_session_cache_create(4);
+
+    PRECOND(def_cli_cert);
+
+    args.cert = SERVER_CERT;
+
+    CALL(spawn_server_repeat(7777, ssl_server, &args, 6));
+
+    CALL(cached_request(cache, "/req1"));
+    CALL(cached_cc_request(cache, "/req2", def_cli_cert));
+    CALL(check_scache(cache, 0, 2));
+    CALL(cached_cc_request(cache, "/req3", def_cli_cert));
+    CALL(check_scache(cache, 1, 2));
+    CALL(cached_request(cache, "/req4"));
+    CALL(check_scache(cache, 2, 2));
+
+    ONN("error from child", dead_server());
+    reap_server();
+
+    ne_ssl_session_cache_destroy(cache);
+
+    return OK;
+}
+
+/* Test that requests succeed with early data enabled, where the
+ * server does not accept early data. */
+static int early_data_fallback(void)
+{
+    struct ssl_server_args args = {0};
+    ne_ssl_session_cache *cache = ne_ssl_session_cache_create(4);
+    ne_session *sess = ne_session_create("https", "localhost", 7777);
+
+    args.cert = SERVER_CERT;
+    args.cache = 1;
+
+    ne_ssl_trust_cert(sess, def_ca_cert);
+    ne_ssl_set_session_cache(sess, cache);
+    ne_set_session_flag(sess, NE_SESSFLAG_TLS_EARLYDATA, 1);
+
+    CALL(spawn_server_repeat(7777, ssl_server, &args, 4));
+
+    ONREQ(any_request(sess, "/req1"));
+    ne_close_connection(sess);
+    ONREQ(any_request(sess, "/req2"));
+    ne_session_destroy(sess);
+
+    ONN("error from child", dead_server());
+    reap_server();
+
+    CALL(check_scache(cache, 1, 1));
+
+    ne_ssl_session_cache_destroy(cache);
+
+    return OK;
+}
+
+/* Run a request using a new session with the given session cache,
+ * counting verify callback invocations in *count. */
+static int counted_request(ne_ssl_session_cache *cache, int *count)
+{
+    ne_session *sess = ne_session_create("https", "localhost", 7777);
+
+    ne_ssl_set_verify(sess, count_vfy, count);
+    ne_ssl_set_session_cache(sess, cache);
+    ONREQ(any_request(sess, "/foo"));
+    ne_session_destroy(sess);
+
+    return OK;
+}
+
+/* Test that a certificate chain accepted only by the verify callback
+ * is not recorded as verified, so the callback is invoked for each
+ * session. */
+static int verified_chain_cache(void)
+{
+    struct ssl_server_args args = {SERVER_CERT, 0};
+    ne_ssl_session_cache *cache = ne_ssl_session_cache_create(4);
+    int count = 0;
+
+    CALL(spawn_server_repeat(7777, ssl_server, &args, 4));
+
+    CALL(counted_request(cache, &count));
+    CALL(counted_request(cache, &count));
+
+    ONN("error from child", dead_server());
+    reap_server();
+
+    ONV(count != 2, ("verify callback called %d times, expected 2", count));
+
+    ne_ssl_session_cache_destroy(cache);
+
+    return OK;
+}
+
+/* Test that a cached session is only resumed by sessions with the
+ * same trust configuration. */
+static int session_cache_trust(void)
+{
+    struct ssl_server_args args = {SERVER_CERT, 0};
+    ne_ssl_session_cache *cache = ne_ssl_session_cache_create(4);
+    int count = 0;
+
+    CALL(spawn_server_repeat(7777, ssl_server, &args, 5));
+
+    /* Session accepted by the verify callback alone. */
+    CALL(counted_request(cache, &count));
+    CALL(cached_request(cache, "/req2"));
+    CALL(check_scache(cache, 0, 2));
+    CALL(counted_request(cache, &count));
+    CALL(check_scache(cache, 1, 2));
+
+    ONN("error from child", dead_server());
+    reap_server();
+
+    ne_ssl_session_cache_destroy(cache);
+
+    return OK;
+}
+
+/* Test that a session cache saved to a file allows a new cache loaded
+ * from it to resume the session. */
+static int persist_session_cache(void)
+{
+    struct ssl_server_args args = {0};
+    ne_ssl_session_cache *c1, *c2, *c3;
+    FILE *fp;
+    char line[4096];
+    struct stat st;
+
+    args.cert = SERVER_CERT;
+
+    CALL(spawn_server_repeat(7777, ssl_server, &args, 5));
+
+    /* An existing file must be made readable only by the owner. */
+    fp = fopen("sessions.txt", "w");
+    ONN("could not create sessions.txt", fp == NULL);
+    fclose(fp);
+    ONN("could not chmod sessions.txt", chmod("sessions.txt", 0644));
+
+    c1 = ne_ssl_session_cache_create(4);
+    CALL(cached_request(c1, "/req1"));
+    ONN("could not save session cache",
+        ne_ssl_session_cache_save(c1, "sessions.txt"));
+    ONN("could not stat sessions.txt", stat("sessions.txt", &st));
+    ONV((st.st_mode & 0777) != 0600,
+        ("session cache file mode was %o", (unsigned)(st.st_mode & 0777)));
+    CALL(check_scache(c1, 0, 1));
+    ne_ssl_session_cache_destroy(c1);
+
+    c2 = ne_ssl_session_cache_create(4);
+    ONN("could not load session cache",
+        ne_ssl_session_cache_load(c2, "sessions.txt", 3600));
+    CALL(cached_request(c2, "/req2"));
+    CALL(check_scache(c2, 1, 0));
+    ne_ssl_session_cache_destroy(c2);
+
+    /* With a negative maximum age, every stored session has expired. */
+    c3 = ne_ssl_session_cache_create(4);
+    ONN("could not load session cache",
+        ne_ssl_session_cache_load(c3, "sessions.txt", -1));
+    CALL(cached_request(c3, "/req3"));
+    CALL(check_scache(c3, 0, 1));
+
+    ONN("error from child", dead_server());
+    reap_server();
+
+    /* Corrupt the first entry and check the file is rejected. */
+    fp = fopen("sessions.txt", "r+");
+    ONN("could not open sessions.txt", fp == NULL);
+    ONN("could not read header", fgets(line, sizeof line, fp) == NULL);
+    fseek(fp, 0, SEEK_CUR);
+    fputc('9', fp);
+    fclose(fp);
+
+    ONN("loaded corrupt session cache",
+        ne_ssl_session_cache_load(c3, "sessions.txt", 3600) == 0);
+    ONN("loaded nonexistent session cache",
+        ne_ssl_session_cache_load(c3, "nonesuch/sessions.txt", 3600) == 0);
+
+    ne_ssl_session_cache_destroy(c3);
+
+    return OK;
+}
+
 /* Callback for client_cert_provider; takes a c. cert as userdata and
  * registers it. */
 static void ccert_provider(void *userdata, ne_session *sess,
@@ -1906,6 +2164,12 @@ ne_test tests[] = {
     T(fail_nul_san),
     
     T(session_cache),
+    T(shared_session_cache),
+    T(session_cache_clicert),
+    T(persist_session_cache),
+    T(early_data_fallback),
+    T(verified_chain_cache),
+    T(session_cache_trust),
 	
     T(fail_tunnel),
     T(proxy_tunnel),
@@ -29,6 +29,7 @@
 
 #include "ne_utils.h"
 #include "ne_md5.h"
+#include "ne_hash.h"
 #include "ne_alloc.h"
 #include "ne_dates.h"
 #include "ne_string.h"
@@ -161,6 +162,98 @@ static int md5_alignment(void)
     return OK;
 }
 
+/* Hash 'len' bytes of 'data' using algorithm 'alg' in chunks of
+ * 'chunk' bytes, writing the result to 'ascii'.  Also checks that a
+ * copy of the context taken part way through gives the same
+ * result. */
+static int digest_hash(unsigned int alg, const char *data, size_t len,
+                       size_t chunk, char *ascii)
+{
+    ne_hash_ctx *ctx, *dup = NULL;
+    char dupascii[NE_HASH_MAXHEX + 1];
+    size_t half = len / 2;
+
+    ctx = ne_hash_create(alg);
+    ONN("hash algorithm not supported", ctx == NULL);
+
+    while (len > 0) {
+        size_t n = len > chunk ? chunk : len;
+
+        if (dup == NULL && len <= half) {
+            dup = ne_hash_dup(ctx);
+            ne_hash_update(dup, data, len);
+        }
+
+        ne_hash_update(ctx, data, n);
+        data += n;
+        len -= n;
+    }
+
+    ne_hash_finish_ascii(ctx, ascii);
+    ne_hash_destroy(ctx);
+
+    if (dup) {
+        ne_hash_finish_ascii(dup, dupascii);
+        ne_hash_destroy(dup);
+        ONV(strcmp(ascii, dupascii),
+            ("duplicated context gave %s not %s", dupascii, ascii));
+    }
+
+    return OK;
+}
+
+static int hashes(void)
+{
+    static const struct {
+        unsigned int alg;
+        const char *data;
+        size_t zs; /* if data is NULL, hash this many 'z's */
+        const char *expect;
+    } ts[] = {
+        { NE_HASH_MD5, "abc", 0, "900150983cd24fb0d6963f7d28e17f72" },
+        { NE_HASH_MD5, NULL, 500, "8b9323bd72250ea7f1b2b3fb5046391a" },
+        { NE_HASH_SHA256, "", 0,
+          "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+        { NE_HASH_SHA256, "abc", 0,
+          "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+        { NE_HASH_SHA256, NULL, 500,
+          "36559492ba4d65f724a98a1f5d810c0ac354baa4d523b8fba695f9b3452894db" },
+        { NE_HASH_SHA256, NULL, 1000,
+          "950f88b09cf1d5e2cdbc5660c77dce3962265c548797950095629a0ea2daea46" },
+        { NE_HASH_SHA512_256, "", 0,
+          "c672b8d1ef56ed28ab87c3622c5114069bdd3ad7b8f9737498d0c01ecef0967a" },
+        { NE_HASH_SHA512_256, "abc", 0,
+          "53048e2681941ef99b2e29b76b4c7dabe4c2d0c634fc6d46e0e2f13107e7af23" },
+        { NE_HASH_SHA512_256, NULL, 500,
+          "2a2272c9f7d8a850f8ce49323b1b31f868873da0c5fafbbf138d2e0700d3379c" },
+        { NE_HASH_SHA512_256, NULL, 1000,
+          "00fcd6c529ebf6dd659e0b066eeedb3df384673ebe3e504f3aa898282d7d4225" },
+        { 0, NULL, 0, NULL }
+    };
+    static const size_t chunks[] = { 1, 7, 64, 100, 128, 4096 };
+    char zzzs[1000], ascii[NE_HASH_MAXHEX + 1];
+    size_t n, m;
+
+    memset(zzzs, 'z', sizeof zzzs);
+
+    ONN("bogus algorithm supported", ne_hash_create(42) != NULL);
+
+    for (n = 0; ts[n].expect; n++) {
+        const char *data = ts[n].data ? ts[n].data : zzzs;
+        size_t len = ts[n].data ? strlen(data) : ts[n].zs;
+
+        for (m = 0; m < sizeof(chunks)/sizeof(chunks[0]); m++) {
+            CALL(digest_hash(ts[n].alg, data, len, chunks[m], ascii));
+            ONV(strcmp(ascii, ts[n].expect),
+                ("hash %u of %" NE_FMT_SIZE_T " bytes in %" NE_FMT_SIZE_T
+                 "-byte chunks was %s not %s", ts[n].alg, len, chunks[m],
+                 ascii, ts[n].expect));
+        }
+    }
+
+    return OK;
+}
+
 static const struct {
     const char *str;
     time_t time;
@@ -302,6 +395,7 @@ ne_test tests[] = {
     T(status_lines),
     T(md5),
     T(md5_alignment),
+    T(hashes),
     T(parse_dates),
     T(regress_dates),
     T(versioning),
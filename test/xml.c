@@ -193,6 +193,10 @@ enum match_type {
     match_chunked /* parse the document one byte at a time */
 };
 
+/* Non-zero if the built-in tokenizer is used by parse_match and
+ * fail_parse. */
+static int fastparse;
+
 static int parse_match(const char *doc, const char *result, 
                        enum match_type t)
 {
@@ -205,6 +209,9 @@ static int parse_match(const char *doc, const char *result,
     ctx.buf = buf;
     ctx.parser = p;
 
+    if (fastparse)
+        ne_xml_set_fastparse(p, 1);
+
     if (t == match_invalid)
         ne_xml_push_handler(p, startelm_abort, chardata, endelm_abort, &ctx);
     if (t != match_encoding && t != match_nohands) {
@@ -393,6 +400,100 @@ static int mapping(void)
     return OK;
 }
 
+static int idtable(void)
+{
+    static const struct ne_xml_idmap map[] = {
+        { "fee", "bar", 1 },
+        { "foo", "bar", 2 },
+        { "bar", "foo", 3 },
+        { "", "bob", 4 },
+        { "balloon", "buffoon", 5},
+        { "foo", "bar", 6 }, /* duplicate: ignored */
+        { "foob", "ar", 7 }
+    };
+    struct ne_xml_idmap big[500];
+    char names[500][8];
+    ne_xml_idtable *t = ne_xml_idtable_create(map, NE_XML_MAPLEN(map));
+    int n;
+
+    for (n = 0; n < 5; n++) {
+        int id = ne_xml_idtable_lookup(t, map[n].nspace, map[n].name);
+        ONV(id != map[n].id, ("mapped to id %d not %d", id, map[n].id));
+    }
+
+    n = ne_xml_idtable_lookup(t, "foob", "ar");
+    ONV(n != 7, ("{foob, ar} got id %d not 7", n));
+
+    n = ne_xml_idtable_lookup(t, "no-such", "element");
+    ONV(n != 0, ("unknown element got id %d not zero", n));
+
+    ne_xml_idtable_destroy(t);
+
+    for (n = 0; n < 500; n++) {
+        ne_snprintf(names[n], sizeof names[n], "e%d", n);
+        big[n].nspace = "DAV:";
+        big[n].name = names[n];
+        big[n].id = n + 1;
+    }
+
+    t = ne_xml_idtable_create(big, 500);
+    for (n = 0; n < 500; n++) {
+        int id = ne_xml_idtable_lookup(t, "DAV:", names[n]);
+        ONV(id != n + 1, ("%s mapped to id %d not %d", names[n], id, n + 1));
+    }
+    n = ne_xml_idtable_lookup(t, "DAV:", "e500");
+    ONV(n != 0, ("unknown element got id %d not zero", n));
+    ne_xml_idtable_destroy(t);
+
+    return OK;
+}
+
+static int count_a, count_b;
+
+static int accepts_a(void *userdata, int parent,
+                     const char *nspace, const char *name, const char **atts)
+{
+    count_a++;
+    return strcmp(name, "a") == 0 ? 1 : NE_XML_DECLINE;
+}
+
+static int accepts_any(void *userdata, int parent,
+                       const char *nspace, const char *name, const char **atts)
+{
+    count_b++;
+    return 2;
+}
+
+/* Test that a handler's start-element callback is skipped for
+ * elements outside its registered set. */
+static int handler_accepts(void)
+{
+    static const struct ne_xml_idmap map[] = {
+        { "ns", "a", 1 }
+    };
+    static const char doc[] = 
+        "<?xml version='1.0'?><a xmlns='ns'><b/><a/><c><a/></c></a>";
+    ne_xml_parser *p = ne_xml_create();
+    ne_xml_idtable *t = ne_xml_idtable_create(map, NE_XML_MAPLEN(map));
+
+    count_a = count_b = 0;
+
+    ne_xml_push_handler(p, accepts_a, NULL, NULL, NULL);
+    ne_xml_handler_accepts(p, t);
+    ne_xml_push_handler(p, accepts_any, NULL, NULL, NULL);
+    
+    ONN("parse failed", ne_xml_parse(p, doc, strlen(doc)) 
+        || ne_xml_parse(p, "", 0));
+
+    ONV(count_a != 2, ("first handler called %d times, not 2", count_a));
+    ONV(count_b != 3, ("second handler called %d times, not 3", count_b));
+
+    ne_xml_destroy(p);
+    ne_xml_idtable_destroy(t);
+    
+    return OK;
+}
+
 /* Test for some parse failures */
 static int fail_parse(void)
 {
@@ -441,6 +542,24 @@ static int fail_parse(void)
         "\xEF\xBB" PFX "<hello/>",
         "\xEF" PFX "<hello/>",
 
+        /* Malformed documents. */
+        PFX "<a></b>",
+        PFX "<a>",
+        PFX "<a/><b/>",
+        PFX "<a/>junk",
+        PFX "<a>&foo;</a>",
+        PFX "<a>&#0;</a>",
+        PFX "<a>\x01</a>",
+        PFX "<a b='1' b='2'/>",
+        PFX "<a b='<'/>",
+        PFX "<a><!DOCTYPE a></a>",
+        PFX "<a><![CDATA[x</a>",
+        PFX "<a>x]]>y</a>",
+        PFX "<a><!-- x -- y --></a>",
+        PFX "<a><? x?></a>",
+        PFX "<a><?xml version='1.0'?></a>",
+        "<?xml version='1.0' encoding='UTF-8' version='1.0'?><a/>",
+
 "<?xml version=\"1.0\"?>\
 <!DOCTYPE billion [\
 <!ELEMENT billion (#PCDATA)>\
@@ -487,6 +606,9 @@ static int fail_parse(void)
         ne_xml_parser *p = ne_xml_create();
         const char *err;
 
+        if (fastparse)
+            ne_xml_set_fastparse(p, 1);
+
         ne_xml_parse(p, docs[n], strlen(docs[n]));
         ne_xml_parse(p, "", 0);
         ONV(ne_xml_failed(p) <= 0, 
@@ -570,6 +692,82 @@ static int attributes(void)
     return OK;
 }
 
+/* Test parsing a document with enough distinct element names and
+ * namespaces to exceed the parser's string pool. */
+static int many_names(void)
+{
+    ne_buffer *doc = ne_buffer_create(), *expect = ne_buffer_create();
+    int n;
+
+    ne_buffer_czappend(doc, PFX "<root>");
+    ne_buffer_czappend(expect, "<{}root>");
+
+    for (n = 0; n < 4000; n++) {
+        char num[20];
+
+        ne_snprintf(num, sizeof num, "%d", n);
+        ne_buffer_concat(doc, "<n", num, " xmlns='urn:", num, "'>"
+                         "<x:child xmlns:x='urn:x", num, "'/></n", num, ">",
+                         NULL);
+        ne_buffer_concat(expect, "<{urn:", num, "}n", num, 
+                         " xmlns='urn:", num, "'>"
+                         "<{urn:x", num, "}child xmlns:x='urn:x", num, "'>"
+                         "</{urn:x", num, "}child>"
+                         "</{urn:", num, "}n", num, ">", NULL);
+    }
+
+    ne_buffer_czappend(doc, "</root>");
+    ne_buffer_czappend(expect, "</{}root>");
+
+    CALL(parse_match(doc->data, expect->data, match_valid));
+
+    ne_buffer_destroy(doc);
+    ne_buffer_destroy(expect);
+
+    return OK;
+}
+
+/* Test the built-in tokenizer with an element with many attributes,
+ * which must be checked for duplicates in linear time. */
+static int many_attributes(void)
+{
+    ne_buffer *doc = ne_buffer_create();
+    ne_xml_parser *p;
+    int n, ret;
+
+    ne_buffer_czappend(doc, PFX "<a");
+    for (n = 0; n < 50000; n++) {
+        char num[20];
+
+        ne_snprintf(num, sizeof num, "%d", n);
+        ne_buffer_concat(doc, " x", num, "='", num, "'", NULL);
+    }
+
+    p = ne_xml_create();
+    ne_xml_set_fastparse(p, 1);
+    ne_xml_push_handler(p, startelm_attrib, NULL, NULL, p);
+    ret = ne_xml_parse(p, doc->data, doc->used - 1);
+    if (ret == 0) ret = ne_xml_parse(p, "/>", 2);
+    if (ret == 0) ret = ne_xml_parse(p, "", 0);
+    ONV(ret, ("parse failed: %s", ne_xml_get_error(p)));
+    ne_xml_destroy(p);
+
+    ne_buffer_czappend(doc, " x49999='dup'/>");
+
+    p = ne_xml_create();
+    ne_xml_set_fastparse(p, 1);
+    ne_xml_push_handler(p, startelm_attrib, NULL, NULL, p);
+    ret = ne_xml_parse(p, doc->data, doc->used - 1);
+    if (ret == 0) ret = ne_xml_parse(p, "", 0);
+    ONN("duplicate attribute accepted", ret == 0);
+    ONV(strstr(ne_xml_get_error(p), "duplicate attribute") == NULL,
+        ("unexpected parse error: %s", ne_xml_get_error(p)));
+    ne_xml_destroy(p);
+
+    ne_buffer_destroy(doc);
+    return OK;
+}
+
 /* Test for the get/set error interface */
 static int errors(void)
 {
@@ -588,12 +786,128 @@ static int errors(void)
     return 0;        
 }
 
+/* Repeat the parse tests using the built-in tokenizer, with some
+ * additional tests for the syntax it handles. */
+static int fast_parse(void)
+{
+    static const struct {
+        const char *in, *out;
+    } ms[] = {
+        { PFX "<a><![CDATA[x<y>&z]]></a>", "<{}a>x<y>&z</{}a>" },
+        { PFX "<!-- c --><?pi x?><a><!--in-->b<?pi?>c</a><!-- after -->\n",
+          "<{}a>bc</{}a>" },
+        { PFX "<a>&lt;&gt;&amp;&quot;&apos;&#65;&#x42;&#xe9;</a>",
+          "<{}a><>&\"'AB\xC3\xA9</{}a>" },
+        { PFX "<a>x\r\ny\rz</a>", "<{}a>x\ny\nz</{}a>" },
+        { PFX "<a b='x\r\ny\tz&#9;' c = \"'>'\" />", 
+          "<{}a b='x y z\t' c=''>''></{}a>" },
+        { PFX "<a>\xC3\xA9\xE2\x82\xAC\xF0\x9D\x84\x9E</a>",
+          "<{}a>\xC3\xA9\xE2\x82\xAC\xF0\x9D\x84\x9E</{}a>" },
+        /* documents handled by the XML parser library: */
+        { "<?xml version='1.0'?><!DOCTYPE a><a/>", "<{}a></{}a>" },
+        { "<?xml version='1.0' encoding='ISO-8859-1'?><a>\xE9</a>", 
+          "<{}a>\xC3\xA9</{}a>" },
+        { NULL, NULL }
+    };
+    int n;
+
+    fastparse = 1;
+
+    for (n = 0; ms[n].in != NULL; n++) {
+        CALL(parse_match(ms[n].in, ms[n].out, match_valid));
+        CALL(parse_match(ms[n].in, ms[n].out, match_chunked));
+    }
+
+    CALL(matches());
+    CALL(fail_parse());
+    CALL(many_names());
+
+    fastparse = 0;
+
+    return OK;
+}
+
+static int cdata_pieces(void *userdata, int state, 
+                        const char *cdata, size_t len)
+{
+    ne_buffer_concat(userdata, "[", NULL);
+    ne_buffer_append(userdata, cdata, len);
+    ne_buffer_concat(userdata, "]", NULL);
+    return 0;
+}
+
+static int startelm_pieces(void *userdata, int state,
+                           const char *nspace, const char *name,
+                           const char **atts)
+{
+    if (strcmp(name, "decline") == 0)
+        return NE_XML_DECLINE;
+    ne_buffer_concat(userdata, "<", name, ">", NULL);
+    return 1;
+}
+
+/* Check that character data is delivered in one piece per run when
+ * coalescing is enabled, whichever tokenizer is used. */
+static int coalesce_cdata(void)
+{
+    static const struct {
+        const char *in, *out;
+        size_t batch;
+    } ts[] = {
+        { PFX "<a>x&amp;y\nz&#65;</a>", "<a>[x&y\nzA]", 1024 },
+        { PFX "<a>x<b>y</b>z</a>", "<a>[x]<b>[y][z]", 1024 },
+        { PFX "<a>x<decline>y</decline>z</a>", "<a>[x][z]", 1024 },
+        { PFX "<a><![CDATA[x]]>y<!-- c -->z</a>", "<a>[xyz]", 1024 },
+        { PFX "<a>&#97;&#98;&#99;&#100;&#101;&#102;&#103;&#104;&#105;"
+          "&#106;</a>", "<a>[abcd][efgh][ij]", 4 },
+        { NULL, NULL, 0 }
+    };
+    int n;
+
+    for (fastparse = 0; fastparse < 2; fastparse++) {
+        for (n = 0; ts[n].in != NULL; n++) {
+            ne_xml_parser *p = ne_xml_create();
+            ne_buffer *buf = ne_buffer_create();
+            const char *doc;
+
+            if (fastparse) ne_xml_set_fastparse(p, 1);
+            ne_xml_coalesce_cdata(p, ts[n].batch);
+            ne_xml_push_handler(p, startelm_pieces, cdata_pieces, NULL, buf);
+
+            /* Feed the document one byte at a time, so the tokenizer
+             * produces as many fragments as possible. */
+            for (doc = ts[n].in; *doc && !ne_xml_failed(p); doc++)
+                ne_xml_parse(p, doc, 1);
+            ne_xml_parse(p, "", 0);
+
+            ONV(ne_xml_failed(p), ("parse of `%s' failed: %s", ts[n].in,
+                                   ne_xml_get_error(p)));
+            ONV(strcmp(buf->data, ts[n].out),
+                ("parse of `%s' gave `%s' not `%s' (fastparse %d)", 
+                 ts[n].in, buf->data, ts[n].out, fastparse));
+
+            ne_xml_destroy(p);
+            ne_buffer_destroy(buf);
+        }
+    }
+
+    fastparse = 0;
+
+    return OK;
+}
+
 ne_test tests[] = {
     T(matches),
     T(mapping),
+    T(idtable),
+    T(handler_accepts),
     T(fail_parse),
+    T(fast_parse),
+    T(coalesce_cdata),
     T(attributes),
     T(errors),
+    T(many_names),
+    T(many_attributes),
     T(NULL)
 };
 
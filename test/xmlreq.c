@@ -167,10 +167,69 @@ static int types(void)
     return OK;
 }
 
+static int count_elm(void *userdata, int state,
+                     const char *nspace, const char *name,
+                     const char **atts)
+{
+    int *count = userdata;
+
+    (*count)++;
+    return ++state;
+}
+
+/* Parse a response using various block sizes, with and without the
+ * built-in tokenizer. */
+static int blocks(void)
+{
+    static const size_t sizes[] = { 1, 7, 4096, 0 };
+    ne_buffer *resp = ne_buffer_create();
+    unsigned n;
+    int fast, x;
+
+    ne_buffer_czappend(resp, "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/xml\r\n"
+                       "Connection: close\r\n" "\r\n"
+                       "<?xml version='1.0' encoding='UTF-8'?>\n"
+                       "<hello>");
+    for (x = 0; x < 500; x++)
+        ne_buffer_czappend(resp, "<x a='b'>text &amp; more text</x>\n");
+    ne_buffer_czappend(resp, "</hello>");
+
+    for (fast = 0; fast < 2; fast++) {
+        for (n = 0; n < sizeof(sizes)/sizeof(sizes[0]); n++) {
+            ne_session *sess;
+            ne_request *req;
+            ne_xml_parser *parser;
+            int count = 0;
+
+            CALL(make_session(&sess, single_serve_string, resp->data));
+
+            req = ne_request_create(sess, "PARSE", "/");
+            parser = ne_xml_create();
+            ne_xml_set_fastparse(parser, fast);
+            ne_xml_set_block_size(parser, sizes[n]);
+            ne_xml_push_handler(parser, count_elm, NULL, NULL, &count);
+
+            ONREQ(ne_xml_dispatch_request(req, parser));
+            ONV(count != 501, ("got %d elements not 501 with block size "
+                               "%" NE_FMT_SIZE_T, count, sizes[n]));
+
+            ne_xml_destroy(parser);
+            ne_request_destroy(req);
+            ne_session_destroy(sess);
+            CALL(await_server());
+        }
+    }
+
+    ne_buffer_destroy(resp);
+    return OK;
+}
+
 ne_test tests[] = {
     T(success),
     T(failure),
     T(types),
+    T(blocks),
     T(NULL)
 };
 